@@ -0,0 +1,114 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __ARENA_H_
+#define __ARENA_H_
+#include "node.h"
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+// Bump allocator that owns every AST node of a compilation unit.
+// Nodes are carved out of large chunks in the order the parser creates them,
+// so traversals touch memory mostly sequentially.  Releasing the arena runs
+// the node destructors and frees all chunks at once.
+class Arena {
+private:
+  static const size_t CHUNK_SIZE = 64 * 1024;
+  std::vector<char*> chunks;
+  std::vector<Node*> nodes;
+  char* cur = NULL;
+  size_t left = 0;
+  size_t used = 0;
+  size_t reserved = 0;
+  size_t firstSize = 0;
+
+  void* allocate(size_t size, size_t align) {
+    size_t pad = (align - ((uintptr_t)cur % align)) % align;
+    if (cur == NULL || pad + size > left) {
+      size_t csize = size + align > CHUNK_SIZE ? size + align : CHUNK_SIZE;
+      cur = (char*) malloc(csize);
+      if (cur == NULL) {
+        fprintf(stderr, "ERR: Out of memory allocating AST nodes\n");
+        abort();
+      }
+      if (chunks.empty()) firstSize = csize;
+      chunks.push_back(cur);
+      left = csize;
+      reserved += csize;
+      pad = (align - ((uintptr_t)cur % align)) % align;
+    }
+    void* mem = cur + pad;
+    cur += pad + size;
+    left -= pad + size;
+    used += size;
+    return mem;
+  }
+
+public:
+  Arena() { }
+  ~Arena() { release(); }
+
+  template<typename T, typename... Args>
+  T* make(Args&&... args) {
+    T* node = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    nodes.push_back(node);
+    return node;
+  }
+  void release() {
+    for (std::vector<Node*>::reverse_iterator it = nodes.rbegin(); it != nodes.rend(); ++it) {
+      (*it)->~Node();
+    }
+    nodes.clear();
+    for (std::vector<char*>::iterator it = chunks.begin(); it != chunks.end(); ++it) {
+      free(*it);
+    }
+    chunks.clear();
+    cur = NULL;
+    left = 0;
+    used = 0;
+    reserved = 0;
+  }
+  // Like release, but keeps the first chunk for the nodes made next, for
+  // an arena that is emptied over and over
+  void reset() {
+    if (chunks.empty()) return;
+    for (std::vector<Node*>::reverse_iterator it = nodes.rbegin(); it != nodes.rend(); ++it) {
+      (*it)->~Node();
+    }
+    nodes.clear();
+    for (size_t i = 1; i < chunks.size(); i++) {
+      free(chunks[i]);
+    }
+    chunks.resize(1);
+    cur = chunks[0];
+    left = firstSize;
+    used = 0;
+    reserved = firstSize;
+  }
+  size_t getNodeCount() { return nodes.size(); }
+  size_t getBytesUsed() { return used; }
+  size_t getBytesReserved() { return reserved; }
+  size_t getChunkCount() { return chunks.size(); }
+};
+#endif // __ARENA_H_
@@ -0,0 +1,98 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#include "batch.h"
+#include "workPool.h"
+#include "mappedFile.h"
+#include <chrono>
+#include <fstream>
+#include <stdio.h>
+
+/* Reads one file name per line, skipping blank lines and # comments */
+bool BatchCompiler::addManifest(const char* manifest)
+{
+  std::ifstream input(manifest);
+  if (!input) {
+    fprintf(stderr, "ERR: Could not open manifest %s\n", manifest);
+    return false;
+  }
+  for (std::string line; getline(input, line);) {
+    size_t begin = line.find_first_not_of(" \t\r");
+    if (begin == std::string::npos || line[begin] == '#') continue;
+    size_t end = line.find_last_not_of(" \t\r");
+    add(line.substr(begin, end - begin + 1));
+  }
+  return true;
+}
+
+void BatchCompiler::compile(Job& job)
+{
+  MappedFile input;
+  if (!input.open(job.filename.c_str())) {
+    fprintf(stderr, "ERR: Could not open file %s\n", job.filename.c_str());
+    job.readable = false;
+    return;
+  }
+
+  size_t dot = job.filename.find_last_of('.');
+  size_t slash = job.filename.find_last_of('/');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) dot = job.filename.size();
+  job.output = job.filename.substr(0, dot) + ".bc";
+
+  CompileOptions jobOptions = options;
+  jobOptions.filename = &job.filename[0];
+  jobOptions.output = job.output.c_str();
+  Compilation compilation(jobOptions);
+  job.status = compilation.compile(input.data(), input.size());
+  if (job.status == Compilation::TYPE_ERROR) {
+    fprintf(stderr, "ERR: %s: Type checker failed\n", job.filename.c_str());
+  }
+  if (job.status == Compilation::OK && running) {
+    int line = compilation.run();
+    if (line > 0) {
+      fprintf(stderr, "ERR: %s line %d: %s\n", job.filename.c_str(), line, compilation.getFailure());
+      job.violated = true;
+    }
+  }
+  job.timings = compilation.getTimings();
+}
+
+int BatchCompiler::run()
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  WorkStealingPool pool(jobs);
+  for (size_t i = 0; i < files.size(); i++) {
+    Job* job = &files[i];
+    pool.submit([this, job]() { compile(*job); });
+  }
+  pool.run();
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  int failed = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    if (!files[i].readable || files[i].status != Compilation::OK || files[i].violated) failed++;
+    // Printed once all jobs are done, so that files do not interleave
+    if (files[i].readable) files[i].timings.print(stderr, files[i].filename, options.timing);
+  }
+  printf("Compiled %zu files (%d failed) on %zu threads in %.3f s, %.1f files/s\n",
+         files.size(), failed, pool.size(), seconds,
+         seconds > 0 ? files.size() / seconds : 0.0);
+  return failed;
+}
@@ -0,0 +1,57 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __BATCH_H_
+#define __BATCH_H_
+#include "compiler.h"
+#include <string>
+#include <vector>
+
+// Compiles many files at once, spread over a WorkStealingPool.  Each file
+// gets its own Compilation and writes its own <basename>.bc next to the
+// input, so nothing is shared between jobs.
+class BatchCompiler {
+private:
+  class Job {
+  public:
+    std::string filename;
+    std::string output;
+    Compilation::Status status = Compilation::OK;
+    bool readable = true;
+    bool violated = false;     // Stopped by a run-time flow or bounds check
+    Timings timings;
+    Job(const std::string& filename) : filename(filename) { }
+  };
+  CompileOptions options;
+  bool running;
+  unsigned jobs;
+  std::vector<Job> files;
+
+  void compile(Job& job);
+
+public:
+  BatchCompiler(const CompileOptions& options, bool running, unsigned jobs) :
+      options(options), running(running), jobs(jobs) { }
+  void add(const std::string& filename) { files.push_back(Job(filename)); };
+  bool addManifest(const char* manifest);
+  // Returns the number of files that failed
+  int run();
+};
+#endif // __BATCH_H_
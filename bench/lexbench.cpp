@@ -0,0 +1,145 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#include "node.h"
+#include "lattice.h"
+#include "parserState.h"
+#include "parser.hpp"
+#include "tokens.hpp"
+#include "lexer.h"
+#include "mappedFile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+
+// Times the flex scanner against the hand-written Lexer on one file, and
+// checks that both return the same tokens on the same lines.  Nothing is
+// parsed, so inputs of hundreds of megabytes fit in memory.
+// Usage: lexbench fname [repeat]
+
+static void release(int kind, YYSTYPE& lval)
+{
+  if (kind == T_VAL_INTEGER || kind == T_VAL_DOUBLE || kind == T_VAL_BOOL) delete lval.string;
+}
+
+static double scanFlex(const MappedFile& input, size_t& tokens)
+{
+  Arena arena;
+  Lattice lattice;
+  ParserState state(&arena, &lattice);
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  yyscan_t scanner;
+  yylex_init_extra(&state, &scanner);
+  // Same as Compilation::compile, including the copy flex makes
+  YY_BUFFER_STATE buffer = yy_scan_bytes(input.data(), input.size(), scanner);
+  YYSTYPE lval;
+  int kind;
+  tokens = 0;
+  while ((kind = yylex(&lval, scanner)) != 0) {
+    release(kind, lval);
+    tokens++;
+  }
+  yy_delete_buffer(buffer, scanner);
+  yylex_destroy(scanner);
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double scanFast(const MappedFile& input, size_t& tokens)
+{
+  Lattice lattice;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  Lexer lexer(input.data(), input.size(), &lattice);
+  YYSTYPE lval;
+  int kind;
+  tokens = 0;
+  while ((kind = lexer.next(&lval)) != 0) {
+    release(kind, lval);
+    tokens++;
+  }
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* Returns the index of the first token where the scanners disagree, or -1 */
+static long compare(const MappedFile& input)
+{
+  Arena arena;
+  Lattice lattice;
+  ParserState state(&arena, &lattice);
+  yyscan_t scanner;
+  yylex_init_extra(&state, &scanner);
+  YY_BUFFER_STATE buffer = yy_scan_bytes(input.data(), input.size(), scanner);
+  Lexer lexer(input.data(), input.size(), &lattice);
+  long index = 0;
+  for (;; index++) {
+    YYSTYPE flexVal, fastVal;
+    int flexKind = yylex(&flexVal, scanner);
+    int fastKind = lexer.next(&fastVal);
+    bool same = flexKind == fastKind && yyget_lineno(scanner) == lexer.getLine();
+    if (same && (flexKind == T_TYPE || flexKind == T_SEC || flexKind == T_IDENTIFIER)) {
+      same = flexVal.name == fastVal.name;
+    } else if (same && (flexKind == T_VAL_INTEGER || flexKind == T_VAL_DOUBLE || flexKind == T_VAL_BOOL)) {
+      same = *flexVal.string == *fastVal.string;
+    }
+    release(flexKind, flexVal);
+    release(fastKind, fastVal);
+    if (!same) break;
+    if (flexKind == 0) {
+      index = -1;
+      break;
+    }
+  }
+  yy_delete_buffer(buffer, scanner);
+  yylex_destroy(scanner);
+  return index;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s fname [repeat]\n", argv[0]);
+    return 1;
+  }
+  int repeat = argc > 2 ? atoi(argv[2]) : 3;
+  MappedFile input;
+  if (!input.open(argv[1])) {
+    fprintf(stderr, "ERR: Could not open file %s\n", argv[1]);
+    return 1;
+  }
+  long mismatch = compare(input);
+  if (mismatch >= 0) {
+    fprintf(stderr, "ERR: The scanners disagree on token %ld\n", mismatch);
+    return 1;
+  }
+  double flex = 0, fast = 0;
+  size_t tokens = 0;
+  for (int i = 0; i < repeat; i++) {
+    // Best of the runs, after the page cache is warm
+    double t = scanFlex(input, tokens);
+    if (i == 0 || t < flex) flex = t;
+    t = scanFast(input, tokens);
+    if (i == 0 || t < fast) fast = t;
+  }
+  double mb = input.size() / 1e6;
+  printf("%.1f MB, %zu tokens\n", mb, tokens);
+  printf("  flex %8.3f s %8.1f MB/s\n", flex, mb / flex);
+  printf("  fast %8.3f s %8.1f MB/s  %.2fx\n", fast, mb / fast, flex / fast);
+  return 0;
+}
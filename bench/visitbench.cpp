@@ -0,0 +1,186 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#include "node.h"
+#include "visitor.h"
+#include "staticVisitor.h"
+#include "arena.h"
+#include "lattice.h"
+#include "parserState.h"
+#include "parser.hpp"
+#include "lexer.h"
+#include "mappedFile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+
+// Times the same traversal through the virtual Visitor and through
+// StaticVisitor, on the AST of one file, and checks that both see the same
+// events.  The handlers do what small passes do: switch on the flag, keep
+// a scope depth and look at the nodes, so that the difference is the cost
+// of dispatch.
+// Usage: visitbench fname [repeat]
+
+// What both visitors compute
+class Tally {
+public:
+  uint64_t events = 0;
+  uint64_t depth = 0;
+  uint64_t deepest = 0;
+  uint64_t branches = 0;
+  uint64_t loops = 0;
+  uint64_t names = 0;   // Sum of the ids of every name used
+  uint64_t values = 0;  // Sum of the integer constants
+  uint64_t trace = 0;   // Hash of the events, in order
+
+  void event(uint64_t code) {
+    events++;
+    trace = trace * 1000003 + code;
+  };
+  void block(uint64_t flag) {
+    event(flag);
+    if (flag == V_FLAG_ENTER) {
+      if (++depth > deepest) deepest = depth;
+    } else {
+      depth--;
+    }
+  };
+  void guarded(uint64_t flag, uint64_t& count) {
+    event(16 + flag);
+    switch (flag) {
+      case V_FLAG_ENTER: count++; break;
+      case V_FLAG_GUARD | V_FLAG_EXIT: depth++; break;
+      case V_FLAG_EXIT: depth--; break;
+      default: break;
+    }
+  };
+  void name(Name name) {
+    event(32 + name.getId());
+    names += name.getId();
+  };
+  void leaf() { event(2); };
+  bool operator==(const Tally& other) const {
+    return events == other.events && deepest == other.deepest &&
+           branches == other.branches && loops == other.loops &&
+           names == other.names && values == other.values &&
+           trace == other.trace;
+  };
+};
+
+class VirtualTally : public Visitor {
+public:
+  Tally tally;
+  void walk(Node* root) { root->accept(*this); };
+  virtual void visit(NSkip* element, uint64_t flag) { tally.leaf(); };
+  virtual void visit(NInteger* element, uint64_t flag) { tally.leaf(); tally.values += element->value; };
+  virtual void visit(NBool* element, uint64_t flag) { tally.leaf(); };
+  virtual void visit(NDouble* element, uint64_t flag) { tally.leaf(); };
+  virtual void visit(NType* element, uint64_t flag) { tally.name(element->name); };
+  virtual void visit(NSecurity* element, uint64_t flag) { tally.name(element->name); };
+  virtual void visit(NIdentifier* element, uint64_t flag) { tally.name(element->name); };
+  virtual void visit(NIfExpression* element, uint64_t flag) { tally.guarded(flag, tally.branches); };
+  virtual void visit(NWhileExpression* element, uint64_t flag) { tally.guarded(flag, tally.loops); };
+  virtual void visit(NBinaryOperator* element, uint64_t flag) { tally.leaf(); };
+  virtual void visit(NAssignment* element, uint64_t flag) { tally.name(element->lhs.name); };
+  virtual void visit(NBlock* element, uint64_t flag) { tally.block(flag); };
+  virtual void visit(NExpressionStatement* element, uint64_t flag) { tally.leaf(); };
+  virtual void visit(NVariableDeclaration* element, uint64_t flag) { tally.name(element->id.name); };
+  virtual void visit(NProcedure* element, uint64_t flag) { tally.event(48 + flag); };
+  virtual void visit(NCall* element, uint64_t flag) { tally.name(element->id.name); };
+  virtual void visit(NElement* element, uint64_t flag) { tally.name(element->id.name); };
+  virtual void visit(NElementAssignment* element, uint64_t flag) { tally.name(element->id.name); };
+};
+
+class StaticTally : public StaticVisitor<StaticTally> {
+public:
+  Tally tally;
+  using StaticVisitor<StaticTally>::visit;
+  void visit(NSkip* element, uint64_t flag) { tally.leaf(); };
+  void visit(NInteger* element, uint64_t flag) { tally.leaf(); tally.values += element->value; };
+  void visit(NBool* element, uint64_t flag) { tally.leaf(); };
+  void visit(NDouble* element, uint64_t flag) { tally.leaf(); };
+  void visit(NType* element, uint64_t flag) { tally.name(element->name); };
+  void visit(NSecurity* element, uint64_t flag) { tally.name(element->name); };
+  void visit(NIdentifier* element, uint64_t flag) { tally.name(element->name); };
+  void visit(NIfExpression* element, uint64_t flag) { tally.guarded(flag, tally.branches); };
+  void visit(NWhileExpression* element, uint64_t flag) { tally.guarded(flag, tally.loops); };
+  void visit(NBinaryOperator* element, uint64_t flag) { tally.leaf(); };
+  void visit(NAssignment* element, uint64_t flag) { tally.name(element->lhs.name); };
+  void visit(NBlock* element, uint64_t flag) { tally.block(flag); };
+  void visit(NExpressionStatement* element, uint64_t flag) { tally.leaf(); };
+  void visit(NVariableDeclaration* element, uint64_t flag) { tally.name(element->id.name); };
+  void visit(NProcedure* element, uint64_t flag) { tally.event(48 + flag); };
+  void visit(NCall* element, uint64_t flag) { tally.name(element->id.name); };
+  void visit(NElement* element, uint64_t flag) { tally.name(element->id.name); };
+  void visit(NElementAssignment* element, uint64_t flag) { tally.name(element->id.name); };
+};
+
+template <class T>
+static double timeWalk(T& visitor, NBlock* root)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  visitor.walk(root);
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s fname [repeat]\n", argv[0]);
+    return 1;
+  }
+  int repeat = argc > 2 ? atoi(argv[2]) : 5;
+  MappedFile input;
+  if (!input.open(argv[1])) {
+    fprintf(stderr, "ERR: Could not open file %s\n", argv[1]);
+    return 1;
+  }
+  Arena arena;
+  Lattice lattice;
+  ParserState state(&arena, &lattice);
+  Lexer lexer(input.data(), input.size(), &lattice);
+  state.lexer = &lexer;
+  if (yyparse(&state, NULL) != 0 || state.programBlock == NULL) {
+    fprintf(stderr, "ERR: Could not parse %s\n", argv[1]);
+    return 1;
+  }
+
+  double virt = 0, stat = 0;
+  Tally first, second;
+  for (int i = 0; i < repeat; i++) {
+    // Best of the runs, alternating so both see the same cache and clock
+    VirtualTally virtualTally;
+    double t = timeWalk(virtualTally, state.programBlock);
+    if (i == 0 || t < virt) virt = t;
+    StaticTally staticTally;
+    t = timeWalk(staticTally, state.programBlock);
+    if (i == 0 || t < stat) stat = t;
+    first = virtualTally.tally;
+    second = staticTally.tally;
+  }
+  if (!(first == second)) {
+    fprintf(stderr, "ERR: The visitors saw different events\n");
+    return 1;
+  }
+  printf("%zu nodes, %llu events\n", arena.getNodeCount(), (unsigned long long) first.events);
+  printf("  virtual %8.3f s %8.1f Mevents/s\n", virt, first.events / virt / 1e6);
+  printf("  static  %8.3f s %8.1f Mevents/s  %.2fx\n", stat, first.events / stat / 1e6, virt / stat);
+  return 0;
+}
@@ -0,0 +1,46 @@
+#!/usr/bin/python
+# Compares the time to compile and run each example on the LLVM JIT and on
+# the bytecode VM.  Each program is run many times in one batch process, so
+# process start-up does not hide the difference.
+# Usage: benchmark.py [copies] [files...]
+import glob
+import os
+import re
+import subprocess
+import sys
+
+def timeBatch(engine, fname, copies):
+   args = ["./command", "-j", "1", "-x", engine] + [fname] * copies
+   try:
+     out = subprocess.check_output(args, stderr=subprocess.STDOUT, timeout=60)
+   except subprocess.CalledProcessError as e:
+     out = e.output  # Programs that fail to type check still get timed
+   except subprocess.TimeoutExpired:
+     return None
+   match = re.search(r"in ([0-9.]+) s", out.decode())
+   if match is None:
+     return None
+   return float(match.group(1)) / copies
+
+def main(argv):
+   copies = 200
+   if len(argv) > 1:
+     copies = int(argv[1])
+   files = argv[2:]
+   if not files:
+     files = sorted(glob.glob("examples/*.cmd"))
+   if not os.path.exists("./command"):
+     sys.stderr.write("ERR: Build ./command first.\n")
+     return 1
+   print("%-30s %10s %10s %8s" % ("program", "jit us", "vm us", "speedup"))
+   for fname in files:
+     jit = timeBatch("jit", fname, copies)
+     vm = timeBatch("vm", fname, copies)
+     if jit is None or vm is None:
+       print("%-30s %10s" % (os.path.basename(fname), "timeout"))
+       continue
+     print("%-30s %10.1f %10.1f %7.1fx" % (os.path.basename(fname), jit * 1e6, vm * 1e6, jit / vm))
+   return 0
+
+if __name__ == "__main__":
+  sys.exit(main(sys.argv))
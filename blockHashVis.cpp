@@ -0,0 +1,192 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#include "node.h"
+#include "blockHashVis.h"
+#include <string.h>
+
+// Tags keep differently shaped trees with the same leaves apart
+enum {
+  TAG_SKIP = 1, TAG_INTEGER, TAG_BOOL, TAG_DOUBLE, TAG_TYPE, TAG_SECURITY,
+  TAG_IDENTIFIER, TAG_IF, TAG_WHILE, TAG_BINARY, TAG_ASSIGNMENT, TAG_BLOCK,
+  TAG_STATEMENT, TAG_DECLARATION, TAG_PROCEDURE, TAG_CALL, TAG_ELEMENT,
+  TAG_ELEMENT_ASSIGNMENT,
+};
+
+const BlockHashVisitor::Entry* BlockHashVisitor::find(NBlock* block) const
+{
+  std::unordered_map<NBlock*, Entry>::const_iterator it = blocks.find(block);
+  return it == blocks.end() ? NULL : &it->second;
+}
+
+void BlockHashVisitor::use(NIdentifier* id)
+{
+  add(TAG_IDENTIFIER);
+  add(id->name.getId());
+  add(id->slot < 0);
+  uses.push_back(id);
+}
+
+void BlockHashVisitor::visit(NSkip* element, uint64_t flag)
+{
+  add(TAG_SKIP);
+}
+
+void BlockHashVisitor::visit(NInteger* element, uint64_t flag)
+{
+  add(TAG_INTEGER);
+  add(element->value);
+}
+
+void BlockHashVisitor::visit(NBool* element, uint64_t flag)
+{
+  add(TAG_BOOL);
+  add(element->value.compare("true") == 0);
+}
+
+void BlockHashVisitor::visit(NDouble* element, uint64_t flag)
+{
+  uint64_t bits;
+  memcpy(&bits, &element->value, sizeof(bits));
+  add(TAG_DOUBLE);
+  add(bits);
+}
+
+void BlockHashVisitor::visit(NType* element, uint64_t flag)
+{
+  add(TAG_TYPE);
+  add(element->name.getId());
+}
+
+void BlockHashVisitor::visit(NSecurity* element, uint64_t flag)
+{
+  add(TAG_SECURITY);
+  add(element->name.getId());
+}
+
+void BlockHashVisitor::visit(NIdentifier* element, uint64_t flag)
+{
+  use(element);
+}
+
+void BlockHashVisitor::visit(NIfExpression* element, uint64_t flag)
+{
+  add(TAG_IF);
+  add(flag);
+  if (!open.empty()) open.back().branches = true;
+}
+
+void BlockHashVisitor::visit(NWhileExpression* element, uint64_t flag)
+{
+  add(TAG_WHILE);
+  add(flag);
+  if (!open.empty()) open.back().branches = true;
+}
+
+void BlockHashVisitor::visit(NBinaryOperator* element, uint64_t flag)
+{
+  add(TAG_BINARY);
+  add(element->op);
+}
+
+void BlockHashVisitor::visit(NAssignment* element, uint64_t flag)
+{
+  // The left hand side is not visited by NAssignment::accept
+  add(TAG_ASSIGNMENT);
+  use(&element->lhs);
+}
+
+void BlockHashVisitor::visit(NBlock* element, uint64_t flag)
+{
+  switch (flag)
+  {
+    case V_FLAG_ENTER:
+      open.push_back(Open(element, uses.size()));
+      break;
+    case V_FLAG_EXIT:
+      {
+        Open block = open.back();
+        open.pop_back();
+        if (block.calls) {
+          // The hash does not cover the callees' signatures
+          add(hashMix(block.hash, TAG_BLOCK));
+          if (!open.empty()) {
+            open.back().calls = true;
+            open.back().branches |= block.branches;
+          }
+          break;
+        }
+        Entry& entry = blocks[element];
+        entry.hash = hashMix(block.hash, TAG_BLOCK);
+        entry.firstUse = block.firstUse;
+        entry.endUse = uses.size();
+        entry.branches = block.branches;
+        add(entry.hash);
+        if (entry.branches && !open.empty()) open.back().branches = true;
+      }
+      break;
+    default:
+      assert(0);
+  }
+}
+
+void BlockHashVisitor::visit(NExpressionStatement* element, uint64_t flag)
+{
+  add(TAG_STATEMENT);
+}
+
+void BlockHashVisitor::visit(NVariableDeclaration* element, uint64_t flag)
+{
+  add(TAG_DECLARATION);
+  add(element->id.name.getId());
+  add(element->size);
+  add(element->redeclared);
+}
+
+void BlockHashVisitor::visit(NProcedure* element, uint64_t flag)
+{
+  add(TAG_PROCEDURE);
+  add(flag);
+  if (flag == V_FLAG_ENTER) {
+    add(element->id.name.getId());
+    add(element->redeclared);
+  }
+}
+
+void BlockHashVisitor::visit(NCall* element, uint64_t flag)
+{
+  add(TAG_CALL);
+  add(element->id.name.getId());
+  add(element->procedure < 0);
+  if (!open.empty()) open.back().calls = true;
+}
+
+void BlockHashVisitor::visit(NElement* element, uint64_t flag)
+{
+  // The array is not visited by NElement::accept
+  add(TAG_ELEMENT);
+  use(&element->id);
+}
+
+void BlockHashVisitor::visit(NElementAssignment* element, uint64_t flag)
+{
+  add(TAG_ELEMENT_ASSIGNMENT);
+  use(&element->id);
+}
@@ -0,0 +1,92 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __BLOCK_HASH_VISITOR_H_
+#define __BLOCK_HASH_VISITOR_H_
+#include "node.h"
+#include "visitor.h"
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+static inline uint64_t hashMix(uint64_t h, uint64_t v)
+{
+  h ^= v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+  return h * 0xff51afd7ed558ccdull;
+}
+
+// Fingerprints every block for incremental re-checking.  A block's hash
+// covers its structure and the resolver's verdicts on it (undeclared names,
+// redeclarations), but not the types of the variables it reads from
+// enclosing scopes; those are listed in uses so that the type checker can
+// add them when it enters the block.  Runs after the ResolveVisitor.
+class BlockHashVisitor : public Visitor {
+public:
+  class Entry {
+  public:
+    uint64_t hash = 0;
+    size_t firstUse = 0; // Identifiers in the block are uses[firstUse, endUse)
+    size_t endUse = 0;
+    bool branches = false; // Holds an if or a while
+  };
+
+private:
+  class Open {
+  public:
+    NBlock* block;
+    uint64_t hash;
+    size_t firstUse;
+    bool branches = false;
+    bool calls = false; // Holds a call, whose verdict depends on the callee
+    Open(NBlock* block, size_t firstUse) : block(block), hash(0xcbf29ce484222325ull), firstUse(firstUse) { }
+  };
+  std::unordered_map<NBlock*, Entry> blocks;
+  std::vector<NIdentifier*> uses;
+  std::vector<Open> open;
+
+  void add(uint64_t v) { if (!open.empty()) open.back().hash = hashMix(open.back().hash, v); };
+  void use(NIdentifier* id);
+
+public:
+  virtual void visit(NSkip* nSkip, uint64_t flag);
+  virtual void visit(NInteger* nInteger, uint64_t flag);
+  virtual void visit(NBool* nBool, uint64_t flag);
+  virtual void visit(NDouble* nDouble, uint64_t flag);
+  virtual void visit(NType* nType, uint64_t flag);
+  virtual void visit(NSecurity* nSecurity, uint64_t flag);
+  virtual void visit(NIdentifier* nIdentifier, uint64_t flag);
+  virtual void visit(NIfExpression* nIfExpression, uint64_t flag);
+  virtual void visit(NWhileExpression* nWhileExpression, uint64_t flag);
+  virtual void visit(NBinaryOperator* nBinaryOperator, uint64_t flag);
+  virtual void visit(NAssignment* nAssignment, uint64_t flag);
+  virtual void visit(NBlock* nBlock, uint64_t flag);
+  virtual void visit(NExpressionStatement* nExpressionStatement, uint64_t flag);
+  virtual void visit(NVariableDeclaration* nVariableDeclaration, uint64_t flag);
+  virtual void visit(NProcedure* nProcedure, uint64_t flag);
+  virtual void visit(NCall* nCall, uint64_t flag);
+  virtual void visit(NElement* nElement, uint64_t flag);
+  virtual void visit(NElementAssignment* nElementAssignment, uint64_t flag);
+
+  // NULL for blocks that were not hashed, and for blocks holding calls
+  const Entry* find(NBlock* block) const;
+  NIdentifier* getUse(size_t i) const { return uses[i]; };
+  size_t getBlockCount() const { return blocks.size(); };
+};
+#endif // __BLOCK_HASH_VISITOR_H_
@@ -0,0 +1,329 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#include "node.h"
+#include "bytecodeVis.h"
+#include "parser.hpp"
+
+static const Name INT_TYPE("int");
+static const Name DOUBLE_TYPE("double");
+static const Name BOOL_TYPE("bool");
+
+BytecodeVisitor::BytecodeVisitor(Bytecode& program, int slots) :
+    program(program), slots(slots)
+{
+  program.names.assign(slots, Name());
+  program.types.assign(slots, Bytecode::INT);
+  operands.reserve(64);
+}
+
+/* Returns the register above every temporary still on the operand stack */
+int32_t BytecodeVisitor::temporary()
+{
+  int32_t reg = slots;
+  for (std::vector<Operand>::reverse_iterator it = operands.rbegin(); it != operands.rend(); ++it) {
+    if (it->reg >= slots) {
+      reg = it->reg + 1;
+      break;
+    }
+  }
+  if (reg - slots + 1 > program.temporaries) program.temporaries = reg - slots + 1;
+  return reg;
+}
+
+BytecodeVisitor::Operand BytecodeVisitor::constant(Bytecode::Type type, Bytecode::Value value)
+{
+  std::pair<int, int64_t> key(type, value.i);
+  std::map<std::pair<int, int64_t>, int32_t>::iterator it = constantIndex.find(key);
+  if (it != constantIndex.end()) return Operand(it->second, type);
+  int32_t reg = -1 - (int32_t) program.constants.size();
+  program.constants.push_back(value);
+  program.constantTypes.push_back(type);
+  constantIndex[key] = reg;
+  return Operand(reg, type);
+}
+
+/* Converts an int or bool operand in place, it must be on the operand stack
+ * so that the new temporary does not overlap it */
+void BytecodeVisitor::toDouble(Operand& operand)
+{
+  if (operand.type == Bytecode::DOUBLE) return;
+  int32_t reg = temporary();
+  emit(Bytecode::I2D, reg, operand.reg, 0);
+  operand = Operand(reg, Bytecode::DOUBLE);
+}
+
+void BytecodeVisitor::finish()
+{
+  emit(Bytecode::HALT, 0, 0, 0);
+  int32_t base = slots + program.temporaries;
+  for (std::vector<Bytecode::Instr>::iterator it = program.code.begin(); it != program.code.end(); ++it) {
+    if (it->a < 0) it->a = base - 1 - it->a;
+    if (it->b < 0) it->b = base - 1 - it->b;
+  }
+  if (verbose) program.dump(std::cout);
+}
+
+void BytecodeVisitor::visit(NSkip* element, uint64_t flag)
+{
+  if (verbose) std::cout << "BytecodeVisitor " << typeid(element).name() << std::endl;
+}
+
+void BytecodeVisitor::visit(NInteger* element, uint64_t flag)
+{
+  if (verbose) std::cout << "BytecodeVisitor " << typeid(element).name() << std::endl;
+  Bytecode::Value value;
+  value.i = element->value;
+  operands.push_back(constant(Bytecode::INT, value));
+}
+
+void BytecodeVisitor::visit(NBool* element, uint64_t flag)
+{
+  if (verbose) std::cout << "BytecodeVisitor " << typeid(element).name() << std::endl;
+  Bytecode::Value value;
+  value.i = element->value.compare("true") == 0;
+  operands.push_back(constant(Bytecode::BOOL, value));
+}
+
+void BytecodeVisitor::visit(NDouble* element, uint64_t flag)
+{
+  if (verbose) std::cout << "BytecodeVisitor " << typeid(element).name() << std::endl;
+  Bytecode::Value value;
+  value.d = element->value;
+  operands.push_back(constant(Bytecode::DOUBLE, value));
+}
+
+void BytecodeVisitor::visit(NType* element, uint64_t flag)
+{
+  if (verbose) std::cout << "BytecodeVisitor " << typeid(element).name() << std::endl;
+  // Do nothing
+}
+
+void BytecodeVisitor::visit(NSecurity* element, uint64_t flag)
+{
+  if (verbose) std::cout << "BytecodeVisitor " << typeid(element).name() << std::endl;
+  // Do nothing
+}
+
+void BytecodeVisitor::visit(NIdentifier* element, uint64_t flag)
+{
+  if (verbose) std::cout << "BytecodeVisitor " << typeid(element).name() << std::endl;
+  if (element->slot < 0) {
+    assert(0); // Caught by type-checker
+  }
+  operands.push_back(Operand(element->slot, program.types[element->slot]));
+}
+
+/* guard; jmpf else; then; jmp end; else: else; end:
+ * The jump over an empty else branch is left out. */
+void BytecodeVisitor::visit(NIfExpression* element, uint64_t flag)
+{
+  switch (flag)
+  {
+    case V_FLAG_GUARD | V_FLAG_EXIT:
+      {
+        if (verbose) std::cout << "BytecodeVisitor if-guard-exit " << typeid(element).name() << std::endl;
+        Operand cond = pop();
+        ifJumps.push_back(program.code.size());
+        emit(Bytecode::JMPF, -1, cond.reg, 0);
+      }
+      break;
+    case V_FLAG_THEN | V_FLAG_EXIT:
+      if (verbose) std::cout << "BytecodeVisitor then-exit " << typeid(element).name() << std::endl;
+      if (element->ielse.statements.empty()) {
+        program.code[ifJumps.back()].dst = program.code.size();
+        ifJumps.back() = (size_t) -1;
+      } else {
+        size_t jump = program.code.size();
+        emit(Bytecode::JMP, -1, 0, 0);
+        program.code[ifJumps.back()].dst = program.code.size();
+        ifJumps.back() = jump;
+      }
+      break;
+    case V_FLAG_EXIT:
+      if (verbose) std::cout << "BytecodeVisitor exit " << typeid(element).name() << std::endl;
+      if (ifJumps.back() != (size_t) -1) program.code[ifJumps.back()].dst = program.code.size();
+      ifJumps.pop_back();
+      break;
+    default:
+      return;
+  }
+}
+
+/* Loops are rotated so that each iteration runs a single branch:
+ * jmp cond; body: body; cond: guard; jmpt body
+ * The guard is lowered first, in traversal order, and moved below the body
+ * once the body starts. */
+void BytecodeVisitor::visit(NWhileExpression* element, uint64_t flag)
+{
+  switch (flag)
+  {
+    case V_FLAG_GUARD | V_FLAG_ENTER:
+      if (verbose) std::cout << "BytecodeVisitor while-guard-enter " << typeid(element).name() << std::endl;
+      loops.push_back(Loop(program.code.size()));
+      break;
+    case V_FLAG_THEN | V_FLAG_ENTER:
+      {
+        if (verbose) std::cout << "BytecodeVisitor body-enter " << typeid(element).name() << std::endl;
+        Loop& loop = loops.back();
+        loop.cond = pop();
+        loop.guard.assign(program.code.begin() + loop.guardStart, program.code.end());
+        program.code.erase(program.code.begin() + loop.guardStart, program.code.end());
+        loop.entryJump = program.code.size();
+        emit(Bytecode::JMP, -1, 0, 0);
+        loop.bodyStart = program.code.size();
+      }
+      break;
+    case V_FLAG_THEN | V_FLAG_EXIT:
+      {
+        if (verbose) std::cout << "BytecodeVisitor body-exit " << typeid(element).name() << std::endl;
+        Loop& loop = loops.back();
+        size_t condStart = program.code.size();
+        program.code[loop.entryJump].dst = condStart;
+        for (std::vector<Bytecode::Instr>::iterator it = loop.guard.begin(); it != loop.guard.end(); ++it) {
+          Bytecode::Instr in = *it;
+          // Branches inside the guard move with it
+          if (in.op == Bytecode::JMP || in.op == Bytecode::JMPF || in.op == Bytecode::JMPT) {
+            in.dst += condStart - loop.guardStart;
+          }
+          program.code.push_back(in);
+        }
+        emit(Bytecode::JMPT, loop.bodyStart, loop.cond.reg, 0);
+      }
+      break;
+    case V_FLAG_EXIT:
+      if (verbose) std::cout << "BytecodeVisitor exit " << typeid(element).name() << std::endl;
+      loops.pop_back();
+      break;
+    default:
+      return;
+  }
+}
+
+void BytecodeVisitor::visit(NBinaryOperator* element, uint64_t flag)
+{
+  if (verbose) std::cout << "BytecodeVisitor " << typeid(element).name() << std::endl;
+  Operand& rhs = operands[operands.size() - 1];
+  Operand& lhs = operands[operands.size() - 2];
+  bool fp = lhs.type == Bytecode::DOUBLE || rhs.type == Bytecode::DOUBLE;
+  if (fp) {
+    toDouble(lhs);
+    toDouble(rhs);
+  }
+  uint8_t op;
+  Bytecode::Type type = Bytecode::BOOL;
+  switch (element->op) {
+    case TPLUS:  op = fp ? Bytecode::ADDD : Bytecode::ADDI; type = fp ? Bytecode::DOUBLE : Bytecode::INT; break;
+    case TMINUS: op = fp ? Bytecode::SUBD : Bytecode::SUBI; type = fp ? Bytecode::DOUBLE : Bytecode::INT; break;
+    case TMUL:   op = fp ? Bytecode::MULD : Bytecode::MULI; type = fp ? Bytecode::DOUBLE : Bytecode::INT; break;
+    case TDIV:   op = fp ? Bytecode::DIVD : Bytecode::DIVI; type = fp ? Bytecode::DOUBLE : Bytecode::INT; break;
+    case TCEQ:   op = fp ? Bytecode::EQD : Bytecode::EQI; break;
+    case TCNE:   op = fp ? Bytecode::NED : Bytecode::NEI; break;
+    case TCLT:   op = fp ? Bytecode::LTD : Bytecode::LTI; break;
+    case TCLE:   op = fp ? Bytecode::LED : Bytecode::LEI; break;
+    case TCGT:   op = fp ? Bytecode::GTD : Bytecode::GTI; break;
+    case TCGE:   op = fp ? Bytecode::GED : Bytecode::GEI; break;
+    default:
+      assert(0);
+      return;
+  }
+  int32_t b = pop().reg;
+  int32_t a = pop().reg;
+  // Operands are read before the result is written, so the result may
+  // reuse the registers of the temporaries just popped
+  int32_t dst = temporary();
+  emit(op, dst, a, b);
+  operands.push_back(Operand(dst, type));
+}
+
+void BytecodeVisitor::visit(NAssignment* element, uint64_t flag)
+{
+  if (verbose) std::cout << "BytecodeVisitor " << typeid(element).name() << std::endl;
+  if (element->lhs.slot < 0) {
+    assert(0); // Caught by type-checker
+  }
+  int32_t slot = element->lhs.slot;
+  if (program.types[slot] == Bytecode::DOUBLE) toDouble(operands.back());
+  Operand rhs = pop();
+  std::vector<Bytecode::Instr>& code = program.code;
+  if (rhs.reg >= slots && !code.empty() && code.back().dst == rhs.reg &&
+      code.back().op < Bytecode::JMP) {
+    // The value was just computed, write it to the variable directly
+    code.back().dst = slot;
+    return;
+  }
+  emit(Bytecode::MOV, slot, rhs.reg, 0);
+}
+
+void BytecodeVisitor::visit(NBlock* element, uint64_t flag)
+{
+  switch (flag)
+  {
+    case V_FLAG_ENTER:
+      if (verbose) std::cout << "BytecodeVisitor entering " << typeid(element).name() << std::endl;
+      blocks.push_back(operands.size());
+      break;
+    case V_FLAG_EXIT:
+      if (verbose) std::cout << "BytecodeVisitor leaving " << typeid(element).name() << std::endl;
+      // Drop values of expressions used as statements
+      operands.resize(blocks.back(), Operand(0, Bytecode::INT));
+      blocks.pop_back();
+      break;
+    default:
+      assert(0);
+  }
+}
+
+void BytecodeVisitor::visit(NExpressionStatement* element, uint64_t flag)
+{
+  if (verbose) std::cout << "BytecodeVisitor " << typeid(element).name() << std::endl;
+  operands.resize(blocks.back(), Operand(0, Bytecode::INT));
+}
+
+void BytecodeVisitor::visit(NVariableDeclaration* element, uint64_t flag)
+{
+  if (verbose) std::cout << "BytecodeVisitor " << typeid(element).name() << std::endl;
+  int32_t slot = element->id.slot;
+  program.names[slot] = element->id.name;
+  if (element->type.name == DOUBLE_TYPE) program.types[slot] = Bytecode::DOUBLE;
+  else if (element->type.name == BOOL_TYPE) program.types[slot] = Bytecode::BOOL;
+  else program.types[slot] = Bytecode::INT;
+}
+
+void BytecodeVisitor::visit(NProcedure* element, uint64_t flag)
+{
+  // Programs with procedures are compiled to native code only
+  assert(0);
+}
+
+void BytecodeVisitor::visit(NCall* element, uint64_t flag)
+{
+  assert(0);
+}
+
+void BytecodeVisitor::visit(NElement* element, uint64_t flag)
+{
+  assert(0);
+}
+
+void BytecodeVisitor::visit(NElementAssignment* element, uint64_t flag)
+{
+  assert(0);
+}
@@ -0,0 +1,94 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __BYTECODE_VISITOR_H_
+#define __BYTECODE_VISITOR_H_
+#include "node.h"
+#include "visitor.h"
+#include "vm.h"
+#include <map>
+#include <utility>
+#include <vector>
+
+// Lowers the AST into register bytecode for the VM, as a cheaper
+// alternative to building and JIT-compiling an LLVM module.  Every variable
+// keeps its resolved slot as its register; expression results go to
+// temporaries, which are reused in stack order.
+class BytecodeVisitor : public Visitor {
+private:
+  class Operand {
+  public:
+    int32_t reg;  // Negative for constants until finish() places them
+    Bytecode::Type type;
+    Operand(int32_t reg, Bytecode::Type type) : reg(reg), type(type) { }
+  };
+  class Loop {
+  public:
+    size_t guardStart;
+    size_t entryJump = 0;
+    size_t bodyStart = 0;
+    Operand cond = Operand(0, Bytecode::BOOL);
+    std::vector<Bytecode::Instr> guard;
+    Loop(size_t guardStart) : guardStart(guardStart) { }
+  };
+
+  bool verbose = false;
+  Bytecode& program;
+  int slots;
+  std::vector<Operand> operands;
+  std::vector<size_t> blocks;   // Operand stack depth at each block entry
+  std::vector<size_t> ifJumps;  // Branch to patch for each open if
+  std::vector<Loop> loops;
+  std::map<std::pair<int, int64_t>, int32_t> constantIndex;
+
+  void emit(uint8_t op, int32_t dst, int32_t a, int32_t b) { program.code.push_back(Bytecode::Instr(op, dst, a, b)); };
+  int32_t temporary();
+  Operand constant(Bytecode::Type type, Bytecode::Value value);
+  Operand pop() { Operand o = operands.back(); operands.pop_back(); return o; };
+  void toDouble(Operand& operand);
+
+public:
+  virtual void visit(NSkip* nSkip, uint64_t flag);
+  virtual void visit(NInteger* nInteger, uint64_t flag);
+  virtual void visit(NBool* nBool, uint64_t flag);
+  virtual void visit(NDouble* nDouble, uint64_t flag);
+  virtual void visit(NType* nType, uint64_t flag);
+  virtual void visit(NSecurity* nSecurity, uint64_t flag);
+  virtual void visit(NIdentifier* nIdentifier, uint64_t flag);
+  virtual void visit(NIfExpression* nIfExpression, uint64_t flag);
+  virtual void visit(NWhileExpression* nWhileExpression, uint64_t flag);
+  virtual void visit(NBinaryOperator* nBinaryOperator, uint64_t flag);
+  virtual void visit(NAssignment* nAssignment, uint64_t flag);
+  virtual void visit(NBlock* nBlock, uint64_t flag);
+  virtual void visit(NExpressionStatement* nExpressionStatement, uint64_t flag);
+  virtual void visit(NVariableDeclaration* nVariableDeclaration, uint64_t flag);
+  virtual void visit(NProcedure* nProcedure, uint64_t flag);
+  virtual void visit(NCall* nCall, uint64_t flag);
+  virtual void visit(NElement* nElement, uint64_t flag);
+  virtual void visit(NElementAssignment* nElementAssignment, uint64_t flag);
+
+  // slots is the number of variable slots handed out by the ResolveVisitor
+  BytecodeVisitor(Bytecode& program, int slots);
+  // Ends the program and places the constants after the temporaries
+  void finish();
+  void setVerbose(bool v) { verbose = v; };
+  bool getVerbose() { return verbose; };
+};
+#endif // __BYTECODE_VISITOR_H_
@@ -0,0 +1,45 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __CHECK_CACHE_H_
+#define __CHECK_CACHE_H_
+#include <stdint.h>
+#include <unordered_set>
+
+// Blocks that passed the type checker, remembered across the compilations
+// of watch mode.  A key combines a block's BlockHashVisitor hash with all it
+// depends on from outside: the security context it is entered in, the
+// lattice and the types of the variables it uses.  Blocks with errors are
+// never stored, so their messages are printed again with current lines.
+class CheckCache {
+private:
+  static const size_t MAX_ENTRIES = 1 << 20;
+  std::unordered_set<uint64_t> passed;
+
+public:
+  bool contains(uint64_t key) const { return passed.count(key) != 0; };
+  void insert(uint64_t key) {
+    // Edits leave stale keys behind, start over rather than grow forever
+    if (passed.size() >= MAX_ENTRIES) passed.clear();
+    passed.insert(key);
+  };
+  size_t size() const { return passed.size(); };
+};
+#endif // __CHECK_CACHE_H_
@@ -0,0 +1,146 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#include "codeCache.h"
+#include "compiler.h"
+#include <algorithm>
+#include <utime.h>
+#include <vector>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Object/ObjectFile.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+
+using namespace llvm;
+
+// Bump when the generated code changes in a way the key does not capture
+static const char* CACHE_FORMAT = "command-cache-1";
+
+bool CodeCache::open()
+{
+  return !sys::fs::create_directories(dir);
+}
+
+std::string CodeCache::key(const char* source, size_t size, const CompileOptions& options)
+{
+  SHA1 sha;
+  std::string header;
+  raw_string_ostream os(header);
+  os << CACHE_FORMAT << '\0'
+     << LLVM_VERSION_STRING << '\0'
+     << sys::getProcessTriple() << '\0'
+     << sys::getHostCPUName() << '\0'
+     << options.typechecking << options.simplifying << options.tracking << options.optLevel << '\0';
+  sha.update(os.str());
+  sha.update(StringRef(source, size));
+  return toHex(sha.final(), true);
+}
+
+std::unique_ptr<MemoryBuffer> CodeCache::load(const std::string& key)
+{
+  std::string path = pathOf(key);
+  ErrorOr<std::unique_ptr<MemoryBuffer>> buffer = MemoryBuffer::getFile(path);
+  if (!buffer) {
+    misses++;
+    return NULL;
+  }
+  Expected<std::unique_ptr<object::ObjectFile>> object =
+    object::ObjectFile::createObjectFile((*buffer)->getMemBufferRef());
+  if (!object) {
+    // Truncated or foreign file, drop it and compile again
+    consumeError(object.takeError());
+    sys::fs::remove(path);
+    misses++;
+    return NULL;
+  }
+  utime(path.c_str(), NULL); // Most recently used
+  hits++;
+  return std::move(*buffer);
+}
+
+/* Writes to a temporary file first so that readers, possibly in other
+ * processes, never see a partial object */
+void CodeCache::store(const std::string& key, const MemoryBuffer& object)
+{
+  int fd;
+  SmallString<128> tmp;
+  if (sys::fs::createUniqueFile(dir + "/" + key + "-%%%%%%.tmp", fd, tmp)) return;
+  {
+    raw_fd_ostream os(fd, true);
+    os << object.getBuffer();
+    os.close();
+    if (os.has_error()) {
+      os.clear_error();
+      sys::fs::remove(tmp);
+      return;
+    }
+  }
+  if (sys::fs::rename(tmp, pathOf(key))) {
+    sys::fs::remove(tmp);
+    return;
+  }
+  evict();
+}
+
+/* Removes the least recently used objects until the cache fits its limit */
+void CodeCache::evict()
+{
+  class Entry {
+  public:
+    sys::TimePoint<> time;
+    uint64_t size;
+    std::string path;
+    bool operator<(const Entry& other) const { return time < other.time; }
+  };
+  std::lock_guard<std::mutex> guard(lock);
+  std::vector<Entry> entries;
+  uint64_t total = 0;
+  std::error_code ec;
+  for (sys::fs::directory_iterator it(dir, ec), end; it != end && !ec; it.increment(ec)) {
+    if (!StringRef(it->path()).endswith(".o")) continue;
+    ErrorOr<sys::fs::basic_file_status> status = it->status();
+    if (!status) continue;
+    Entry entry;
+    entry.time = status->getLastModificationTime();
+    entry.size = status->getSize();
+    entry.path = it->path();
+    total += entry.size;
+    entries.push_back(entry);
+  }
+  if (total <= limit) return;
+  std::sort(entries.begin(), entries.end());
+  for (std::vector<Entry>::iterator it = entries.begin(); it != entries.end() && total > limit; ++it) {
+    if (sys::fs::remove(it->path)) continue;
+    total -= it->size;
+    evictions++;
+  }
+}
+
+void CodeCache::clear()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  std::error_code ec;
+  for (sys::fs::directory_iterator it(dir, ec), end; it != end && !ec; it.increment(ec)) {
+    if (StringRef(it->path()).endswith(".o")) sys::fs::remove(it->path());
+  }
+}
@@ -0,0 +1,68 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __CODE_CACHE_H_
+#define __CODE_CACHE_H_
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <llvm/Support/MemoryBuffer.h>
+
+class CompileOptions;
+
+// On-disk cache of native objects, one <key>.o file per program.  The key
+// hashes the source together with everything that changes the generated
+// code: the compiler options, the LLVM version and the host target.  A
+// changed source or option therefore never matches a stale entry; stale
+// entries simply age out.  The directory is kept under a size limit by
+// evicting the least recently used objects, using the file modification
+// time, which is refreshed on every hit.  One cache can be shared by the
+// threads of a batch.
+class CodeCache {
+private:
+  std::string dir;
+  uint64_t limit;
+  std::mutex lock; // Serializes eviction scans
+  std::atomic<unsigned> hits{0};
+  std::atomic<unsigned> misses{0};
+  std::atomic<unsigned> evictions{0};
+
+  std::string pathOf(const std::string& key) { return dir + "/" + key + ".o"; };
+  void evict();
+
+public:
+  static const uint64_t DEFAULT_LIMIT = 64 * 1024 * 1024;
+
+  CodeCache(const std::string& dir, uint64_t limit = DEFAULT_LIMIT) : dir(dir), limit(limit) { }
+  // Creates the directory if needed
+  bool open();
+  std::string key(const char* source, size_t size, const CompileOptions& options);
+  // NULL on a miss, or if the entry is not a valid object file
+  std::unique_ptr<llvm::MemoryBuffer> load(const std::string& key);
+  void store(const std::string& key, const llvm::MemoryBuffer& object);
+  // Removes every entry
+  void clear();
+  unsigned getHits() { return hits; };
+  unsigned getMisses() { return misses; };
+  unsigned getEvictions() { return evictions; };
+};
+#endif // __CODE_CACHE_H_
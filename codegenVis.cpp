@@ -26,84 +26,774 @@
 #include <llvm/IR/Type.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/LLVMContext.h>
-#include <llvm/PassManager.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+#include <llvm/Transforms/Utils.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/CallingConv.h>
 #include <llvm-c/BitWriter.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/IR/IRPrintingPasses.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/Support/TargetSelect.h>
-#include <llvm/ExecutionEngine/GenericValue.h>
-#include <llvm/ExecutionEngine/JIT.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/Target/TargetMachine.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/Support/SmallVectorMemoryBuffer.h>
+#include "workPool.h"
+#include <algorithm>
+#include <mutex>
+#include <unordered_set>
 
 using namespace llvm;
 
-static llvm::IRBuilder<> Builder(getGlobalContext()); // TODO: Get rid of this global
+static const Name INT_TYPE("int");
+static const Name DOUBLE_TYPE("double");
+static const Name BOOL_TYPE("bool");
 
 void CodeGenVisitor::init()
 {
   if (verbose) std::cout << "CodeGenVis::init()" << std::endl;
-  Module* m = new Module("main", getGlobalContext());
-  Scope* s = new Scope();
-  context = new CodeGenContext(s, m);
-  // Create a global scope
-  context->scope->InitializeScope("global");
+  context = new CodeGenContext(std::make_unique<Module>("main", llvmContext));
   // Create a main function and add the first basic block to it
   ArrayRef<llvm::Type *> argTypes;
-	//FunctionType *ftype = FunctionType::get(Type::getVoidTy(getGlobalContext()), argTypes, false);
-	FunctionType *ftype = FunctionType::get(Type::getInt32Ty(getGlobalContext()), argTypes, false);
-	mainFunction = Function::Create(ftype, GlobalValue::ExternalLinkage, "main", context->module);
-	BasicBlock *bblock = BasicBlock::Create(getGlobalContext(), "entry", mainFunction, 0);
+	//FunctionType *ftype = FunctionType::get(Type::getVoidTy(llvmContext), argTypes, false);
+	FunctionType *ftype = FunctionType::get(Type::getInt32Ty(llvmContext), argTypes, false);
+	mainFunction = Function::Create(ftype, GlobalValue::ExternalLinkage, "main", context->module.get());
+  function = mainFunction;
+  mayFail.clear();
+  failedLine = NULL;
+	BasicBlock *bblock = BasicBlock::Create(llvmContext, "entry", mainFunction, 0);
   // Set the Builder's basic block to this first block from the main function
   Builder.SetInsertPoint(bblock);
 }
 
-void CodeGenVisitor::generateCode()
+bool CodeGenVisitor::generateCode()
 {
   assert(vals.size() == 0);
+  assert(taints.size() == 0);
   //Builder.CreateRetVoid();
-  Builder.CreateRet(ConstantInt::get(Type::getInt32Ty(getGlobalContext()), 0, true));
-  // Cleanup scopes
-  assert(context->scope->depth() == 1);
-  context->scope->FinalizeScope();
+  Builder.CreateRet(ConstantInt::get(Type::getInt32Ty(llvmContext), 0, true));
   // Validate the generated code, checking for consistency.
   verifyFunction(*mainFunction);
+  if (timings != NULL) countInstructions("ir.blocks", "ir.instructions");
+  if (timings != NULL && !procedures.empty()) timings->count("procedures", procedures.size());
+  // One object for the cache, or for a .o; listings are of the whole module
+  bool parallel = threads > 1 && procedures.size() > 0 && cache == NULL && listings == 0 &&
+                  (native == NULL || sys::path::extension(native) != ".o");
+  std::unique_ptr<TargetMachine> tm;
+  if (optLevel > 0) {
+    // The machine the code runs on, whose costs the vectorizer weighs
+    tm = native != NULL ? createTargetMachine() : hostMachine();
+    if (tm == NULL) return false;
+  }
+  if (parallel) {
+    Timings::Timer timer(timings, "optimize");
+    if (!split(tm.get())) return false;
+  } else if (optLevel > 0) {
+    Timings::Timer timer(timings, "optimize");
+    if (verbose) std::cout << "Optimizing at -O" << optLevel << std::endl;
+    optimize(*context->module, *tm);
+  }
+  if (timings != NULL && optLevel > 0) countInstructions("ir.blocks.opt", "ir.instructions.opt");
   // Dump IR to screen
 	if (verbose) std::cout << "Code is generated." << std::endl;
-  if (verbose) context->module->dump();
+  if (verbose && parts.empty()) context->module->print(errs(), NULL);
+  for (size_t i = 0; verbose && i < parts.size(); i++) parts[i].module->print(errs(), NULL);
+  if (filename != NULL && parts.empty()) {
+    Timings::Timer timer(timings, "bitcode");
+    LLVMWriteBitcodeToFile(wrap(context->module.get()), filename);
+  }
+  if (native != NULL) return emit();
+  return true;
+}
+
+void CodeGenVisitor::countInstructions(const char* blocks, const char* instructions)
+{
+  std::vector<Module*> modules;
+  if (parts.empty()) modules.push_back(context->module.get());
+  for (size_t i = 0; i < parts.size(); i++) modules.push_back(parts[i].module.get());
+  uint64_t nBlocks = 0, nInstructions = 0;
+  for (size_t i = 0; i < modules.size(); i++) {
+    for (Module::iterator f = modules[i]->begin(); f != modules[i]->end(); ++f) {
+      nBlocks += f->size();
+      nInstructions += f->getInstructionCount();
+    }
+  }
+  timings->count(blocks, nBlocks);
+  timings->count(instructions, nInstructions);
+}
+
+/* A copy of tm, for a thread of its own, as a machine caches subtargets
+ * without locking */
+static std::unique_ptr<TargetMachine> cloneMachine(const TargetMachine& tm)
+{
+  return std::unique_ptr<TargetMachine>(tm.getTarget().createTargetMachine(
+      tm.getTargetTriple().str(), tm.getTargetCPU(), tm.getTargetFeatureString(), tm.Options,
+      tm.getRelocationModel(), tm.getCodeModel(), tm.getOptLevel()));
+}
+
+/* Spreads the functions over up to threads parts, largest first onto the
+ * part with the fewest instructions so far, and optimizes the parts in
+ * parallel.  Each part is the whole module read back from bitcode into a
+ * context of its own, keeping the bodies of its own functions only; the
+ * variables are defined in the first part.  Symbols local to the module
+ * become hidden globals first, so that the parts link together.  The
+ * bitcode written to filename is this one, before optimization.  tm is
+ * NULL at -O0. */
+bool CodeGenVisitor::split(const TargetMachine* tm)
+{
+  Module& module = *context->module;
+  std::vector<Function*> functions;
+  for (Module::iterator f = module.begin(); f != module.end(); ++f) {
+    if (!f->isDeclaration()) functions.push_back(&*f);
+  }
+  for (GlobalValue& value : module.global_values()) {
+    if (!value.hasLocalLinkage()) continue;
+    // Prefixed, as the linker would take a variable named exit for libc's
+    value.setName("cmd." + value.getName());
+    value.setLinkage(GlobalValue::ExternalLinkage);
+    value.setVisibility(GlobalValue::HiddenVisibility);
+  }
+  std::stable_sort(functions.begin(), functions.end(), [](Function* a, Function* b) {
+    return a->getInstructionCount() > b->getInstructionCount();
+  });
+  size_t n = std::min<size_t>(threads, functions.size());
+  std::vector<uint64_t> load(n, 0);
+  std::vector<std::unordered_set<std::string> > owned(n);
+  for (size_t i = 0; i < functions.size(); i++) {
+    size_t lightest = std::min_element(load.begin(), load.end()) - load.begin();
+    load[lightest] += functions[i]->getInstructionCount() + 1;
+    owned[lightest].insert(functions[i]->getName().str());
+  }
+  SmallVector<char, 0> bitcode;
+  raw_svector_ostream out(bitcode);
+  WriteBitcodeToFile(module, out);
   if (filename != NULL) {
-    LLVMWriteBitcodeToFile((LLVMOpaqueModule *)context->module, filename);
+    std::error_code ec;
+    raw_fd_ostream file(filename, ec, sys::fs::OF_None);
+    if (!ec) file << out.str();
+  }
+  // The JIT or emit only needs the parts from here on
+  context->module.reset();
+  if (verbose) std::cout << "Optimizing at -O" << optLevel << " in " << n << " parts" << std::endl;
+
+  parts.resize(n);
+  std::vector<std::unique_ptr<TargetMachine> > machines;
+  for (size_t i = 0; tm != NULL && i < n; i++) machines.push_back(cloneMachine(*tm));
+  WorkStealingPool pool(n);
+  for (size_t i = 0; i < n; i++) {
+    pool.submit([this, i, &bitcode, &owned, &machines]() {
+      Part& part = parts[i];
+      part.context = std::make_unique<LLVMContext>();
+      Expected<std::unique_ptr<Module> > parsed =
+          parseBitcodeFile(MemoryBufferRef(StringRef(bitcode.data(), bitcode.size()), "main"), *part.context);
+      if (!parsed) {
+        consumeError(parsed.takeError());
+        return;
+      }
+      part.module = std::move(*parsed);
+      for (Module::iterator f = part.module->begin(); f != part.module->end(); ++f) {
+        if (!f->isDeclaration() && owned[i].count(f->getName().str()) == 0) f->deleteBody();
+      }
+      if (i > 0) {
+        for (Module::global_iterator g = part.module->global_begin(); g != part.module->global_end(); ++g) {
+          g->setInitializer(NULL);
+        }
+      }
+      if (optLevel > 0) optimize(*part.module, *machines[i]);
+    });
+  }
+  pool.run();
+  // A part whose bitcode could not be read back has no module
+  for (size_t i = 0; i < n; i++) {
+    if (parts[i].module == NULL) {
+      errs() << "ERR: Could not split the module into parts\n";
+      return false;
+    }
+  }
+  if (timings != NULL) timings->count("codegen.parts", n);
+  return true;
+}
+
+/* Places a variable's stack slot in the entry block of the function being
+ * generated.  Allocas there are what mem2reg/SROA promote to registers, and
+ * a declaration inside a loop no longer grows the stack on every iteration. */
+AllocaInst* CodeGenVisitor::createEntryBlockAlloca(Type* type, const std::string& name)
+{
+  BasicBlock& entry = function->getEntryBlock();
+  IRBuilder<> tmp(&entry, entry.begin());
+  return tmp.CreateAlloca(type, 0, name);
+}
+
+/* Returns where a variable is stored.  The program's variables live on
+ * main's stack until a procedure uses one, which moves it to a global.
+ * Procedures are only declared at the top level, so every other variable
+ * a procedure uses is its own. */
+Value* CodeGenVisitor::slotFor(int slot)
+{
+  AllocaInst* alloca = dyn_cast<AllocaInst>(slots[slot]);
+  if (alloca == NULL || alloca->getFunction() == function) return slots[slot];
+  Type* type = alloca->getAllocatedType();
+  GlobalVariable* global = new GlobalVariable(*context->module, type, false, GlobalValue::InternalLinkage,
+                                              Constant::getNullValue(type), alloca->getName());
+  alloca->replaceAllUsesWith(global);
+  alloca->eraseFromParent();
+  slots[slot] = global;
+  return global;
+}
+
+static Type* storedType(Value* slot)
+{
+  if (AllocaInst* alloca = dyn_cast<AllocaInst>(slot)) return alloca->getAllocatedType();
+  return cast<GlobalVariable>(slot)->getValueType();
+}
+
+/* Where a procedure leaves the line on which it indexed out of bounds,
+ * created on first use.  When no procedure stores to it, GlobalOpt folds
+ * the loads after calls away. */
+GlobalVariable* CodeGenVisitor::getFailedLine()
+{
+  if (failedLine == NULL) {
+    Type* i32 = Type::getInt32Ty(llvmContext);
+    failedLine = new GlobalVariable(*context->module, i32, false, GlobalValue::InternalLinkage,
+                                    ConstantInt::get(i32, 0), "bounds.line");
+  }
+  return failedLine;
+}
+
+/* Returns the address of an array's element.  An index out of bounds makes
+ * main return lineno, like a flow checkFlow() catches; a procedure leaves
+ * lineno in getFailedLine() and returns, and its callers return after it.
+ * The check is a single unsigned comparison, which also catches negative
+ * indices, and a loop whose range is known to be in bounds lets LLVM's
+ * induction variable simplification fold it away; the loop is then left
+ * with no exit but its own, as the vectorizer needs. */
+Value* CodeGenVisitor::element(int slot, Value* index, int lineno)
+{
+  Value* array = slotFor(slot);
+  ArrayType* type = cast<ArrayType>(storedType(array));
+  Value* inBounds = Builder.CreateICmpULT(index, ConstantInt::get(index->getType(), type->getNumElements()));
+  BasicBlock* fail = BasicBlock::Create(llvmContext, "bounds.fail", function);
+  BasicBlock* next = BasicBlock::Create(llvmContext, "bounds.ok", function);
+  Builder.CreateCondBr(inBounds, next, fail, MDBuilder(llvmContext).createBranchWeights(1 << 20, 1));
+  Builder.SetInsertPoint(fail);
+  Value* line = ConstantInt::get(Type::getInt32Ty(llvmContext), lineno);
+  if (function == mainFunction) {
+    Builder.CreateRet(line);
+  } else {
+    Builder.CreateStore(line, getFailedLine());
+    Builder.CreateRetVoid();
+    mayFail.insert(function);
+  }
+  Builder.SetInsertPoint(next);
+  Value* indices[] = { ConstantInt::get(index->getType(), 0), index };
+  return Builder.CreateInBoundsGEP(type, array, indices);
+}
+
+/* Runs the standard -O1..-O3 pipeline over a module.  Procedures are
+ * inlined from -O2 on; within main the function passes (SROA, mem2reg,
+ * instcombine, GVN, LICM, loop rotation/unrolling, ...) do the work.  The
+ * vectorizers pick their widths from tm's costs, without which they leave
+ * every loop scalar.  Only reads the options, so parts can be optimized on
+ * several threads, each with a tm of its own. */
+void CodeGenVisitor::optimize(Module& module, TargetMachine& tm)
+{
+  module.setDataLayout(tm.createDataLayout());
+  module.setTargetTriple(tm.getTargetTriple().str());
+  PassManagerBuilder pmb;
+  pmb.OptLevel = optLevel;
+  pmb.SizeLevel = 0;
+  pmb.LoopVectorize = optLevel > 1;
+  pmb.SLPVectorize = optLevel > 1;
+  if (optLevel > 1) pmb.Inliner = createFunctionInliningPass(optLevel, 0, false);
+  tm.adjustPassManager(pmb);
+
+  legacy::FunctionPassManager fpm(&module);
+  fpm.add(createTargetTransformInfoWrapperPass(tm.getTargetIRAnalysis()));
+  // Promote the entry-block allocas first so later passes see SSA values
+  fpm.add(createPromoteMemoryToRegisterPass());
+  pmb.populateFunctionPassManager(fpm);
+  fpm.doInitialization();
+  for (Module::iterator f = module.begin(); f != module.end(); ++f) {
+    fpm.run(*f);
+  }
+  fpm.doFinalization();
+
+  legacy::PassManager mpm;
+  mpm.add(createTargetTransformInfoWrapperPass(tm.getTargetIRAnalysis()));
+  pmb.populateModulePassManager(mpm);
+  mpm.run(module);
+}
+
+static void initializeTarget()
+{
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+}
+static std::once_flag targetInitialized;
+
+static CodeGenOpt::Level codeGenLevel(unsigned optLevel)
+{
+  static const CodeGenOpt::Level levels[] = {
+    CodeGenOpt::None, CodeGenOpt::Less, CodeGenOpt::Default, CodeGenOpt::Aggressive
+  };
+  return levels[optLevel > 3 ? 3 : optLevel];
+}
+
+/* Creates a machine for the host, as the JIT compiles for */
+std::unique_ptr<TargetMachine> CodeGenVisitor::hostMachine()
+{
+  std::call_once(targetInitialized, initializeTarget);
+  Expected<orc::JITTargetMachineBuilder> jtmb = orc::JITTargetMachineBuilder::detectHost();
+  if (!jtmb) {
+    logAllUnhandledErrors(jtmb.takeError(), errs(), "ERR: ");
+    return NULL;
+  }
+  jtmb->setCodeGenOptLevel(codeGenLevel(optLevel));
+  Expected<std::unique_ptr<TargetMachine>> tm = jtmb->createTargetMachine();
+  if (!tm) {
+    logAllUnhandledErrors(tm.takeError(), errs(), "ERR: ");
+    return NULL;
+  }
+  return std::move(*tm);
+}
+
+/* Creates the lazy ORC JIT that owns the compiled code */
+bool CodeGenVisitor::createJIT()
+{
+  std::call_once(targetInitialized, initializeTarget);
+  Expected<orc::JITTargetMachineBuilder> jtmb = orc::JITTargetMachineBuilder::detectHost();
+  if (!jtmb) {
+    logAllUnhandledErrors(jtmb.takeError(), errs(), "ERR: ");
+    return false;
+  }
+  jtmb->setCodeGenOptLevel(codeGenLevel(optLevel));
+  Expected<std::unique_ptr<orc::LLLazyJIT>> created =
+    orc::LLLazyJITBuilder().setJITTargetMachineBuilder(*jtmb).create();
+  if (!created) {
+    logAllUnhandledErrors(created.takeError(), errs(), "ERR: ");
+    return false;
+  }
+  jit = std::move(*created);
+  // Zeroing an array, or a loop LLVM recognizes as one, calls the C library
+  Expected<std::unique_ptr<orc::DynamicLibrarySearchGenerator> > process =
+    orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(jit->getDataLayout().getGlobalPrefix());
+  if (!process) {
+    logAllUnhandledErrors(process.takeError(), errs(), "ERR: ");
+    return false;
+  }
+  jit->getMainJITDylib().addGenerator(std::move(*process));
+  return true;
+}
+
+/* Compiles the whole module to a native object in memory.  Used when the
+ * object is going to the cache, where the lazy, per-function path has no
+ * single object to hand over. */
+std::unique_ptr<MemoryBuffer> CodeGenVisitor::compileToObject()
+{
+  std::unique_ptr<TargetMachine> tm = hostMachine();
+  if (tm == NULL) return NULL;
+  context->module->setDataLayout(tm->createDataLayout());
+  context->module->setTargetTriple(tm->getTargetTriple().str());
+  orc::SimpleCompiler compiler(*tm);
+  Expected<std::unique_ptr<MemoryBuffer>> object = compiler(*context->module);
+  if (!object) {
+    logAllUnhandledErrors(object.takeError(), errs(), "ERR: ");
+    return NULL;
+  }
+  return std::move(*object);
+}
+
+/* Compiles every part to an object in memory, each on a thread of its own
+ * with its own copy of tm */
+bool CodeGenVisitor::compileParts(const TargetMachine& tm)
+{
+  std::vector<std::unique_ptr<TargetMachine> > machines;
+  for (size_t i = 0; i < parts.size(); i++) {
+    machines.push_back(cloneMachine(tm));
+    parts[i].module->setDataLayout(tm.createDataLayout());
+    parts[i].module->setTargetTriple(tm.getTargetTriple().str());
+  }
+  WorkStealingPool pool(parts.size());
+  for (size_t i = 0; i < parts.size(); i++) {
+    pool.submit([this, i, &machines]() {
+      orc::SimpleCompiler compiler(*machines[i]);
+      Expected<std::unique_ptr<MemoryBuffer> > object = compiler(*parts[i].module);
+      if (!object) {
+        consumeError(object.takeError());
+        return;
+      }
+      parts[i].object = std::move(*object);
+    });
+  }
+  pool.run();
+  for (size_t i = 0; i < parts.size(); i++) {
+    if (parts[i].object == NULL) {
+      errs() << "ERR: Could not compile part " << i << " of the module\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Creates the machine that emits ahead-of-time code, for the host unless
+ * setTarget picked another architecture or CPU.  Code is position
+ * independent, as the system linker makes PIE executables by default.
+ * Only the targets linked into the compiler are available. */
+std::unique_ptr<TargetMachine> CodeGenVisitor::createTargetMachine()
+{
+  std::call_once(targetInitialized, initializeTarget);
+  Triple host(sys::getProcessTriple());
+  Triple triple = host;
+  if (!arch.empty()) {
+    Triple::ArchType type = Triple::getArchTypeForLLVMName(arch);
+    if (type == Triple::UnknownArch) {
+      errs() << "ERR: Unknown architecture " << arch << "\n";
+      return NULL;
+    }
+    triple.setArch(type);
+  }
+  std::string error;
+  const Target* target = TargetRegistry::lookupTarget(triple.str(), error);
+  if (target == NULL) {
+    errs() << "ERR: " << error << "\n";
+    return NULL;
+  }
+  std::string cpuName = cpu;
+  SubtargetFeatures features;
+  if (cpuName.empty() || cpuName == "native") {
+    cpuName = "generic";
+    if (triple.getArch() == host.getArch()) {
+      // Everything the host has, as the JIT gets from detectHost
+      cpuName = sys::getHostCPUName().str();
+      StringMap<bool> hostFeatures;
+      if (sys::getHostCPUFeatures(hostFeatures)) {
+        for (StringMap<bool>::iterator it = hostFeatures.begin(); it != hostFeatures.end(); ++it) {
+          features.AddFeature(it->first(), it->second);
+        }
+      }
+    }
+  }
+  // Checked first, LLVM only warns and falls back to a generic CPU
+  std::unique_ptr<MCSubtargetInfo> info(target->createMCSubtargetInfo(triple.str(), "", ""));
+  if (info == NULL || !info->isCPUStringValid(cpuName)) {
+    errs() << "ERR: Unknown CPU " << cpuName << " for " << triple.getArchName() << "\n";
+    return NULL;
+  }
+  std::unique_ptr<TargetMachine> tm(target->createTargetMachine(
+      triple.str(), cpuName, features.getString(), TargetOptions(),
+      Reloc::PIC_, None, codeGenLevel(optLevel)));
+  if (tm == NULL) {
+    errs() << "ERR: Could not create a target machine for " << triple.str() << "\n";
+    return NULL;
+  }
+  if (verbose) std::cout << "Target " << triple.str() << ", CPU " << cpuName << std::endl;
+  return tm;
+}
+
+static bool emitFile(TargetMachine& tm, Module& module, const std::string& fname, CodeGenFileType type)
+{
+  std::error_code ec;
+  raw_fd_ostream out(fname, ec, sys::fs::OF_None);
+  if (ec) {
+    errs() << "ERR: Could not write " << fname << ": " << ec.message() << "\n";
+    return false;
+  }
+  legacy::PassManager pm;
+  if (tm.addPassesToEmitFile(pm, out, NULL, type)) {
+    errs() << "ERR: " << tm.getTargetTriple().str() << " cannot emit " << fname << "\n";
+    return false;
+  }
+  pm.run(module);
+  return true;
+}
+
+/* Writes the module ahead of time instead of running it: an object file,
+ * or an executable linked from one, and the listings asked for next to it.
+ * All but linking happens in this process, on the module in memory, so
+ * there is no bitcode to write and read back. */
+bool CodeGenVisitor::emit()
+{
+  std::unique_ptr<TargetMachine> tm = createTargetMachine();
+  if (tm == NULL) return false;
+  bool linking = sys::path::extension(native) != ".o";
+  if (linking && tm->getTargetTriple().getArch() != Triple(sys::getProcessTriple()).getArch()) {
+    errs() << "ERR: Executables are only linked for the host, write a .o instead\n";
+    return false;
+  }
+  if (!parts.empty()) {
+    // Only ever linked, the parts are objects of their own
+    std::vector<std::string> objects;
+    bool written = true;
+    {
+      Timings::Timer timer(timings, "emit");
+      if (!compileParts(*tm)) return false;
+      for (size_t i = 0; i < parts.size() && written; i++) {
+        SmallString<128> tmp;
+        int fd;
+        std::error_code ec = sys::fs::createTemporaryFile("command", "o", fd, tmp);
+        if (ec) {
+          errs() << "ERR: Could not create a temporary object: " << ec.message() << "\n";
+          written = false;
+          break;
+        }
+        objects.push_back(tmp.str().str());
+        raw_fd_ostream out(fd, true);
+        out << parts[i].object->getBuffer();
+      }
+    }
+    bool linked = written && link(objects);
+    for (size_t i = 0; i < objects.size(); i++) sys::fs::remove(objects[i]);
+    return linked;
+  }
+  Module& module = *context->module;
+  module.setDataLayout(tm->createDataLayout());
+  module.setTargetTriple(tm->getTargetTriple().str());
+  SmallString<128> stem(native);
+  sys::path::replace_extension(stem, "");
+  std::string base = stem.str().str();
+  if (listings & LIST_IR) {
+    // Before code generation, which lowers some of the IR in place
+    std::error_code ec;
+    raw_fd_ostream out(base + ".ll", ec, sys::fs::OF_Text);
+    if (ec) {
+      errs() << "ERR: Could not write " << base << ".ll: " << ec.message() << "\n";
+      return false;
+    }
+    module.print(out, NULL);
+  }
+  std::string object = native;
+  if (linking) {
+    SmallString<128> tmp;
+    std::error_code ec = sys::fs::createTemporaryFile("command", "o", tmp);
+    if (ec) {
+      errs() << "ERR: Could not create a temporary object: " << ec.message() << "\n";
+      return false;
+    }
+    object = tmp.str().str();
+  }
+  {
+    Timings::Timer timer(timings, "emit");
+    if (!emitFile(*tm, module, object, CGFT_ObjectFile)) return false;
+    if ((listings & LIST_ASSEMBLY) &&
+        !emitFile(*tm, module, base + ".s", CGFT_AssemblyFile)) return false;
+  }
+  if (!linking) return true;
+  bool linked = link(std::vector<std::string>(1, object));
+  sys::fs::remove(object);
+  return linked;
+}
+
+/* Links an executable with the system C compiler, which knows where the C
+ * runtime's start files are.  The only process the build spawns. */
+bool CodeGenVisitor::link(const std::vector<std::string>& objects)
+{
+  Timings::Timer timer(timings, "link");
+  ErrorOr<std::string> cc = sys::findProgramByName("cc");
+  if (!cc) {
+    errs() << "ERR: No cc found to link " << native << "\n";
+    return false;
   }
+  std::vector<StringRef> args(1, *cc);
+  args.insert(args.end(), objects.begin(), objects.end());
+  args.push_back("-o");
+  args.push_back(native);
+  if (verbose) {
+    std::cout << "Linking:";
+    for (size_t i = 0; i < args.size(); i++) std::cout << " " << args[i].str();
+    std::cout << std::endl;
+  }
+  std::string error;
+  int ret = sys::ExecuteAndWait(*cc, args, None, {}, 0, 0, &error);
+  if (ret != 0) {
+    errs() << "ERR: Linking " << native << " failed" << (error.empty() ? "" : ": ") << error << "\n";
+    return false;
+  }
+  return true;
+}
+
+/* Hands the module to a lazy ORC JIT and returns a pointer to main.
+ * Functions are only compiled the first time they are called, through
+ * stubs, so large programs start running before all of their code is
+ * compiled.  With a cache the module is compiled eagerly instead and the
+ * object stored, and likewise under -T so that compiling is not charged
+ * to running.  Returns NULL if the JIT could not be set up. */
+CodeGenVisitor::EntryPoint CodeGenVisitor::getEntryPoint()
+{
+  if (jit == NULL) {
+    Timings::Timer timer(timings, "jit");
+    if (!createJIT()) return NULL;
+    if (!parts.empty()) {
+      // Compiled eagerly, as calls from main would compile lazily one by one
+      std::unique_ptr<TargetMachine> tm = hostMachine();
+      if (tm == NULL || !compileParts(*tm)) return NULL;
+      for (size_t i = 0; i < parts.size(); i++) {
+        Error err = jit->addObjectFile(std::move(parts[i].object));
+        if (err) {
+          logAllUnhandledErrors(std::move(err), errs(), "ERR: ");
+          return NULL;
+        }
+      }
+      return lookUpMain();
+    }
+    if (cache != NULL || timings != NULL) {
+      std::unique_ptr<MemoryBuffer> object = compileToObject();
+      if (object == NULL) return NULL;
+      if (cache != NULL) cache->store(cacheKey, *object);
+      return loadObject(std::move(object));
+    }
+    // The JIT takes ownership of the module
+    Error err = jit->addLazyIRModule(orc::ThreadSafeModule(std::move(context->module), tsContext));
+    if (err) {
+      logAllUnhandledErrors(std::move(err), errs(), "ERR: ");
+      return NULL;
+    }
+  }
+  return lookUpMain();
+}
+
+/* Runs a previously compiled object instead of the module */
+CodeGenVisitor::EntryPoint CodeGenVisitor::loadObject(std::unique_ptr<MemoryBuffer> object)
+{
+  if (jit == NULL && !createJIT()) return NULL;
+  Error err = jit->addObjectFile(std::move(object));
+  if (err) {
+    logAllUnhandledErrors(std::move(err), errs(), "ERR: ");
+    return NULL;
+  }
+  return lookUpMain();
+}
+
+CodeGenVisitor::EntryPoint CodeGenVisitor::lookUpMain()
+{
+  Expected<JITEvaluatedSymbol> main = jit->lookup("main");
+  if (!main) {
+    logAllUnhandledErrors(main.takeError(), errs(), "ERR: ");
+    return NULL;
+  }
+  return (EntryPoint) main->getAddress();
 }
 
 /* Executes the AST by running the main function */
-GenericValue CodeGenVisitor::runCode()
+int CodeGenVisitor::runCode()
 {
 	if (verbose) std::cout << "Running code...\n";
-  InitializeNativeTarget();
-  ExecutionEngine* ee = EngineBuilder(context->module).create();
-  assert(ee != 0);
-	std::vector<GenericValue> noargs;
-	GenericValue v = ee->runFunction(mainFunction, noargs);
+  EntryPoint entry = getEntryPoint();
+  if (entry == NULL) return -1;
+  int ret;
+  {
+    Timings::Timer timer(timings, "execute");
+    ret = entry();
+  }
 	if (verbose) std::cout << "Code was run.\n";
-  return v;
+  return ret;
+}
+
+void CodeGenVisitor::setShadows(const ShadowVisitor* shadows, Lattice* lattice)
+{
+  this->shadows = shadows;
+  this->lattice = lattice;
+  pcs.assign(1, constantTaint(Lattice::BOTTOM));
+}
+
+CodeGenVisitor::Taint CodeGenVisitor::constantTaint(Label label)
+{
+  return Taint(ConstantInt::get(Type::getInt8Ty(llvmContext), label), label);
+}
+
+/* Joins two labels, folding whatever is known at compile time.  Labels fit
+ * in a byte, as there are at most 256.  With only low and high the join is
+ * an or, else it is looked up in a table of the lattice's joins. */
+CodeGenVisitor::Taint CodeGenVisitor::join(const Taint& a, const Taint& b)
+{
+  Label bound = lattice->join(a.bound, b.bound);
+  ConstantInt* ca = dyn_cast<ConstantInt>(a.label);
+  ConstantInt* cb = dyn_cast<ConstantInt>(b.label);
+  if (ca != NULL && ca->isZero()) return Taint(b.label, bound); // Lattice::BOTTOM
+  if (cb != NULL && cb->isZero()) return Taint(a.label, bound);
+  if (ca != NULL && lattice->flowsTo(b.bound, a.bound)) return Taint(a.label, a.bound);
+  if (cb != NULL && lattice->flowsTo(a.bound, b.bound)) return Taint(b.label, b.bound);
+  if (lattice->size() == 2) return Taint(Builder.CreateOr(a.label, b.label), bound);
+  if (joinTable == NULL) {
+    size_t n = lattice->size();
+    std::vector<uint8_t> joins(n * n);
+    for (size_t x = 0; x < n; x++) {
+      for (size_t y = 0; y < n; y++) joins[x * n + y] = lattice->join(x, y);
+    }
+    Constant* table = ConstantDataArray::get(llvmContext, joins);
+    joinTable = new GlobalVariable(*context->module, table->getType(), true,
+                                   GlobalValue::PrivateLinkage, table, "label.join");
+  }
+  Type* i32 = Type::getInt32Ty(llvmContext);
+  Value* row = Builder.CreateMul(Builder.CreateZExt(a.label, i32), ConstantInt::get(i32, lattice->size()));
+  Value* index = Builder.CreateAdd(row, Builder.CreateZExt(b.label, i32));
+  Value* indices[] = { ConstantInt::get(i32, 0), index };
+  Value* entry = Builder.CreateInBoundsGEP(joinTable->getValueType(), joinTable, indices);
+  return Taint(Builder.CreateLoad(Type::getInt8Ty(llvmContext), entry), bound);
+}
+
+/* Makes main return lineno unless taint flows to the label to.  Nothing is
+ * emitted where the bound already shows that it does. */
+void CodeGenVisitor::checkFlow(const Taint& taint, Label to, int lineno)
+{
+  if (lattice->flowsTo(taint.bound, to)) return;
+  Taint target = constantTaint(to);
+  Value* flows = Builder.CreateICmpEQ(join(taint, target).label, target.label);
+  Function* function = Builder.GetInsertBlock()->getParent();
+  BasicBlock* violation = BasicBlock::Create(llvmContext, "flow.violation", function);
+  BasicBlock* next = BasicBlock::Create(llvmContext, "flow.ok", function);
+  Builder.CreateCondBr(flows, next, violation, MDBuilder(llvmContext).createBranchWeights(1 << 20, 1));
+  Builder.SetInsertPoint(violation);
+  Builder.CreateRet(ConstantInt::get(Type::getInt32Ty(llvmContext), lineno));
+  Builder.SetInsertPoint(next);
+}
+
+/* The part of branch that is not taken would have stored to the variables
+ * in the shadow visitor's list under the current context: raises their
+ * shadows to it, and checks that they may hold it, failing on the line of
+ * the store */
+void CodeGenVisitor::raise(Node* branch, int part)
+{
+  const std::vector<std::pair<int, int> >& raised = shadows->getRaised(branch, part);
+  for (std::vector<std::pair<int, int> >::const_iterator it = raised.begin(); it != raised.end(); ++it) {
+    checkFlow(pcs.back(), shadows->getDeclared(it->first), it->second);
+    AllocaInst* shadow = shadowSlots[it->first];
+    if (shadow == NULL) continue;
+    Taint current(Builder.CreateLoad(Type::getInt8Ty(llvmContext), shadow), shadows->getDeclared(it->first));
+    Builder.CreateStore(join(current, pcs.back()).label, shadow);
+  }
 }
 
 /* Returns an LLVM type based on the identifier */
-static const Type *typeOf(const NType& type) 
+static const Type *typeOf(const NType& type, LLVMContext& llvmContext)
 {
-	if (type.name.compare("int") == 0) {
-		return Type::getInt64Ty(getGlobalContext());
+	if (type.name == INT_TYPE) {
+		return Type::getInt64Ty(llvmContext);
 	}
-	else if (type.name.compare("double") == 0) {
-		return Type::getDoubleTy(getGlobalContext());
+	else if (type.name == DOUBLE_TYPE) {
+		return Type::getDoubleTy(llvmContext);
 	}
-  else if (type.name.compare("bool") == 0) {
-		return Type::getInt1Ty(getGlobalContext());
+  else if (type.name == BOOL_TYPE) {
+		return Type::getInt1Ty(llvmContext);
   }
-	return Type::getVoidTy(getGlobalContext());
+	return Type::getVoidTy(llvmContext);
 }
 
 void CodeGenVisitor::visit(NSkip* element, uint64_t flag)
@@ -111,31 +801,34 @@ void CodeGenVisitor::visit(NSkip* element, uint64_t flag)
   if (verbose) std::cout << "CodeGenVisitor " << typeid(element).name() << std::endl;
   // Generate a nop
   new BitCastInst(Constant::getNullValue(
-        Type::getInt1Ty(getGlobalContext())), 
-        Type::getInt1Ty(getGlobalContext()), "", Builder.GetInsertBlock());
+        Type::getInt1Ty(llvmContext)), 
+        Type::getInt1Ty(llvmContext), "", Builder.GetInsertBlock());
 }
 
 void CodeGenVisitor::visit(NInteger* element, uint64_t flag)
 {
   if (verbose) std::cout << "CodeGenVisitor " << typeid(element).name() << std::endl;
-  vals.push_front(ConstantInt::get(Type::getInt64Ty(getGlobalContext()), element->value, true));
+  vals.push_front(ConstantInt::get(Type::getInt64Ty(llvmContext), element->value, true));
+  if (shadows != NULL) taints.push_back(constantTaint(Lattice::BOTTOM));
 }
 
 void CodeGenVisitor::visit(NBool* element, uint64_t flag)
 {
   if (verbose) std::cout << "CodeGenVisitor " << typeid(element).name() << std::endl;
+  if (shadows != NULL) taints.push_back(constantTaint(Lattice::BOTTOM));
   if (element->value.compare("true") == 0) {
-	  vals.push_front(ConstantInt::getTrue(getGlobalContext()));
+	  vals.push_front(ConstantInt::getTrue(llvmContext));
     return;
   }
   assert (element->value.compare("false") == 0);
-	vals.push_front(ConstantInt::getFalse(getGlobalContext()));
+	vals.push_front(ConstantInt::getFalse(llvmContext));
 }
 
 void CodeGenVisitor::visit(NDouble* element, uint64_t flag)
 {
   if (verbose) std::cout << "CodeGenVisitor " << typeid(element).name() << std::endl;
-  vals.push_front(ConstantFP::get(Type::getDoubleTy(getGlobalContext()), element->value));
+  vals.push_front(ConstantFP::get(Type::getDoubleTy(llvmContext), element->value));
+  if (shadows != NULL) taints.push_back(constantTaint(Lattice::BOTTOM));
 }
 
 void CodeGenVisitor::visit(NType* element, uint64_t flag)
@@ -153,11 +846,19 @@ void CodeGenVisitor::visit(NSecurity* element, uint64_t flag)
 void CodeGenVisitor::visit(NIdentifier* element, uint64_t flag)
 {
   if (verbose) std::cout << "CodeGenVisitor " << typeid(element).name() << std::endl;
-	if (context->scope->LookUp(element->name) == NULL) {
+	if (element->slot < 0) {
     assert(0); // Caught by type-checker
 	}
-	vals.push_front(new LoadInst(context->scope->LookUp(element->name)->value, 
+  Value* slot = slotFor(element->slot);
+	vals.push_front(new LoadInst(storedType(slot), slot,
                                "", false, Builder.GetInsertBlock()));
+  if (shadows != NULL) {
+    // Variables without a shadow are as high as they were declared
+    AllocaInst* shadow = shadowSlots[element->slot];
+    Label declared = shadows->getDeclared(element->slot);
+    taints.push_back(shadow == NULL ? constantTaint(declared) :
+                     Taint(Builder.CreateLoad(Type::getInt8Ty(llvmContext), shadow), declared));
+  }
 }
 
 void CodeGenVisitor::visit(NIfExpression* element, uint64_t flag)
@@ -172,13 +873,17 @@ void CodeGenVisitor::visit(NIfExpression* element, uint64_t flag)
         if (CondV == NULL) {
           assert(0);
         }
+        if (shadows != NULL) {
+          pcs.push_back(join(pcs.back(), taints.back()));
+          taints.pop_back();
+        }
         If* myIf = new If();
         myIf->function = Builder.GetInsertBlock()->getParent();
         // Create blocks for the then and else cases.  Insert the 'then' block at the
         // end of the function.
-        myIf->thenBB = BasicBlock::Create(getGlobalContext(), "if.then", myIf->function);
-        myIf->elseBB = BasicBlock::Create(getGlobalContext(), "if.else");
-        myIf->mergeBB = BasicBlock::Create(getGlobalContext(), "if.end");
+        myIf->thenBB = BasicBlock::Create(llvmContext, "if.then", myIf->function);
+        myIf->elseBB = BasicBlock::Create(llvmContext, "if.else");
+        myIf->mergeBB = BasicBlock::Create(llvmContext, "if.end");
         Builder.CreateCondBr(CondV, myIf->thenBB, myIf->elseBB);
         ifs.push_front(myIf);
       }
@@ -187,6 +892,7 @@ void CodeGenVisitor::visit(NIfExpression* element, uint64_t flag)
       if (verbose) std::cout << "CodeGenVisitor then-enter " << typeid(element).name() << std::endl;
       // Emit then block.
       Builder.SetInsertPoint(ifs.front()->thenBB);
+      if (shadows != NULL) raise(element, 1);
       break;
     case V_FLAG_THEN | V_FLAG_EXIT:
       if (verbose) std::cout << "CodeGenVisitor then-exit " << typeid(element).name() << std::endl;
@@ -197,6 +903,7 @@ void CodeGenVisitor::visit(NIfExpression* element, uint64_t flag)
       // Emit else block.
       ifs.front()->function->getBasicBlockList().push_back(ifs.front()->elseBB);
       Builder.SetInsertPoint(ifs.front()->elseBB);
+      if (shadows != NULL) raise(element, 0);
       break;
     case V_FLAG_ELSE | V_FLAG_EXIT:
       if (verbose) std::cout << "CodeGenVisitor else-exit " << typeid(element).name() << std::endl;
@@ -212,6 +919,7 @@ void CodeGenVisitor::visit(NIfExpression* element, uint64_t flag)
         delete myIf;
       }
       ifs.pop_front();
+      if (shadows != NULL) pcs.pop_back();
       break;
     default:
       return;
@@ -240,9 +948,9 @@ void CodeGenVisitor::visit(NWhileExpression* element, uint64_t flag)
         //  Note that initially there will be an unconditional branch to while.cond
         //  to see if the loop need to be executed at least once,
         //  or if the loop is to be skipped without executing at all
-        whiles.front()->condBB = BasicBlock::Create(getGlobalContext(), "while.cond", whiles.front()->function);
-        whiles.front()->bodyBB = BasicBlock::Create(getGlobalContext(), "while.body");
-        whiles.front()->endBB = BasicBlock::Create(getGlobalContext(), "while.end");
+        whiles.front()->condBB = BasicBlock::Create(llvmContext, "while.cond", whiles.front()->function);
+        whiles.front()->bodyBB = BasicBlock::Create(llvmContext, "while.body");
+        whiles.front()->endBB = BasicBlock::Create(llvmContext, "while.end");
         Builder.CreateBr(whiles.front()->condBB);
         Builder.SetInsertPoint(whiles.front()->condBB);
       }
@@ -260,6 +968,10 @@ void CodeGenVisitor::visit(NWhileExpression* element, uint64_t flag)
         if (CondV == NULL) {
           assert(0);
         }
+        if (shadows != NULL) {
+          pcs.push_back(join(pcs.back(), taints.back()));
+          taints.pop_back();
+        }
         Builder.CreateCondBr(CondV, whiles.front()->bodyBB, whiles.front()->endBB);
         whiles.front()->function->getBasicBlockList().push_back(whiles.front()->bodyBB);
         Builder.SetInsertPoint(whiles.front()->bodyBB);
@@ -275,6 +987,11 @@ void CodeGenVisitor::visit(NWhileExpression* element, uint64_t flag)
       if (verbose) std::cout << "CodeGenVisitor exit " << typeid(element).name() << std::endl;
       whiles.front()->function->getBasicBlockList().push_back(whiles.front()->endBB);
       Builder.SetInsertPoint(whiles.front()->endBB);
+      if (shadows != NULL) {
+        // Leaving the loop is not taking its body once more
+        raise(element, 0);
+        pcs.pop_back();
+      }
       {
         While* myWhile = whiles.front();
         delete myWhile;
@@ -297,20 +1014,26 @@ void CodeGenVisitor::visit(NBinaryOperator* element, uint64_t flag)
   vals.pop_front(); 
   Value* lhsv = vals.front();
   vals.pop_front(); 
+  if (shadows != NULL) {
+    Taint rhs = taints.back();
+    taints.pop_back();
+    taints.back() = join(taints.back(), rhs);
+  }
 
+  bool isDouble = lhsv->getType() == Type::getDoubleTy(llvmContext);
 	switch (element->op) {
-    // Arith instructions
-		case TPLUS: 	binstr = Instruction::Add; goto math;
-		case TMINUS: 	binstr = Instruction::Sub; goto math;
-		case TMUL: 		binstr = Instruction::Mul; goto math;
-		case TDIV: 		binstr = Instruction::SDiv; goto math;
+    // Arith instructions, doubles need the floating point ones
+		case TPLUS: 	binstr = isDouble ? Instruction::FAdd : Instruction::Add; goto math;
+		case TMINUS: 	binstr = isDouble ? Instruction::FSub : Instruction::Sub; goto math;
+		case TMUL: 		binstr = isDouble ? Instruction::FMul : Instruction::Mul; goto math;
+		case TDIV: 		binstr = isDouble ? Instruction::FDiv : Instruction::SDiv; goto math;
   }
   
   // For now, we assume that if the type checker passed,
   // both lhs and rhs have the exact same value.
   // So we don't promote the int 1 to a float 1.0,
   // though we probably should
-  if (lhsv->getType() == Type::getDoubleTy(getGlobalContext())) {
+  if (isDouble) {
     // Comparision instructions, doubles
     oinstr = Instruction::FCmp; 
 	  switch (element->op) {
@@ -346,17 +1069,52 @@ math:
 void CodeGenVisitor::visit(NAssignment* element, uint64_t flag)
 {
   if (verbose) std::cout << "CodeGenVisitor " << typeid(element).name() << std::endl;
-	if (context->scope->LookUp(element->lhs.name) == NULL) {
+	if (element->lhs.slot < 0) {
     assert(0); // Caught by type-checker
 	}
   Value* rhsv = vals.front();
   vals.pop_front();
+  if (shadows != NULL) {
+    Taint stored = join(taints.back(), pcs.back());
+    taints.pop_back();
+    checkFlow(stored, shadows->getDeclared(element->lhs.slot), element->lineno);
+    if (element->lhs.slot == initializing) {
+      initializing = -1; // The declaration set the shadow
+    } else if (shadowSlots[element->lhs.slot] != NULL) {
+      Builder.CreateStore(stored.label, shadowSlots[element->lhs.slot]);
+    }
+  }
   // No need to add StoreInst to vals
   new StoreInst(rhsv,
-                context->scope->LookUp(element->lhs.name)->value, 
+                slotFor(element->lhs.slot), 
                 false, Builder.GetInsertBlock());
 }
 
+void CodeGenVisitor::visit(NElement* element, uint64_t flag)
+{
+  if (verbose) std::cout << "CodeGenVisitor " << typeid(element).name() << " " << element->id.name.str() << std::endl;
+  assert(element->id.slot >= 0); // Caught by type-checker
+  // Programs with arrays are not tracked, see ShadowVisitor
+  assert(shadows == NULL);
+  Value* index = vals.front();
+  vals.pop_front();
+  Value* address = this->element(element->id.slot, index, element->lineno);
+  Type* type = cast<ArrayType>(storedType(slots[element->id.slot]))->getElementType();
+  vals.push_front(Builder.CreateLoad(type, address));
+}
+
+void CodeGenVisitor::visit(NElementAssignment* element, uint64_t flag)
+{
+  if (verbose) std::cout << "CodeGenVisitor " << typeid(element).name() << " " << element->id.name.str() << std::endl;
+  assert(element->id.slot >= 0); // Caught by type-checker
+  assert(shadows == NULL);
+  Value* rhsv = vals.front();
+  vals.pop_front();
+  Value* index = vals.front();
+  vals.pop_front();
+  Builder.CreateStore(rhsv, this->element(element->id.slot, index, element->lineno));
+}
+
 void CodeGenVisitor::visit(NBlock* element, uint64_t flag)
 {
   //static int size_on_entering = 0;
@@ -367,13 +1125,11 @@ void CodeGenVisitor::visit(NBlock* element, uint64_t flag)
       if (verbose) std::cout << "CodeGenVisitor entering " << typeid(element).name() << std::endl;
       //size_on_entering = vals.size();
       //std::cout << "Size on entering: " << size_on_entering << std::endl;;
-      context->scope->InitializeScope();
       break;
     case V_FLAG_EXIT:
       if (verbose) std::cout << "CodeGenVisitor leaving " << typeid(element).name() << std::endl;
       //size_on_leaving = vals.size();
       //std::cout << "Size on leaving: " << size_on_leaving << std::endl;;
-      context->scope->FinalizeScope();
       break;
     default:
       assert(0);
@@ -388,9 +1144,108 @@ void CodeGenVisitor::visit(NExpressionStatement* element, uint64_t flag)
 void CodeGenVisitor::visit(NVariableDeclaration* element, uint64_t flag)
 {
   if (verbose) std::cout << "CodeGenVisitor " << typeid(element).name() << std::endl;
-	AllocaInst *alloc = new AllocaInst( (llvm::Type *) typeOf(element->type), 
-                                       element->id.name.c_str(), Builder.GetInsertBlock());
-  Symbol* sym = new Symbol(alloc, new SType());
-  context->scope->Insert(element->id.name, sym);
+  if (element->size > 0) {
+    // Arrays start out zeroed.  Main's are globals, so their size is not
+    // bounded by the stack; a procedure may recurse, so its own are not.
+    Type* type = ArrayType::get((Type*) typeOf(element->type, llvmContext), element->size);
+    Value* array;
+    if (function == mainFunction) {
+      array = new GlobalVariable(*context->module, type, false, GlobalValue::InternalLinkage,
+                                 Constant::getNullValue(type), element->id.name.str());
+    } else {
+      array = createEntryBlockAlloca(type, element->id.name.str());
+    }
+    if (element->id.slot >= (int) slots.size()) slots.resize(element->id.slot + 1, NULL);
+    slots[element->id.slot] = array;
+    Builder.CreateMemSet(array, Builder.getInt8(0), ConstantExpr::getSizeOf(type), MaybeAlign());
+    return;
+  }
+	AllocaInst *alloc = createEntryBlockAlloca((llvm::Type *) typeOf(element->type, llvmContext),
+                                             element->id.name.str());
+  if (element->id.slot >= (int) slots.size()) slots.resize(element->id.slot + 1, NULL);
+  slots[element->id.slot] = alloc;
+  if (shadows != NULL) {
+    if (element->id.slot >= (int) shadowSlots.size()) shadowSlots.resize(element->id.slot + 1, NULL);
+    Label declared = shadows->getDeclared(element->id.slot);
+    if (shadows->isShadowed(element->id.slot)) {
+      // Holds data as sensitive as it was declared, until a store says otherwise
+      shadowSlots[element->id.slot] = createEntryBlockAlloca(Type::getInt8Ty(llvmContext),
+                                                            element->id.name.str() + ".label");
+      Builder.CreateStore(constantTaint(declared).label, shadowSlots[element->id.slot]);
+    }
+    if (element->assignmentExpr != NULL) initializing = element->id.slot;
+  }
   // No need to add alloc to vals
 }
+
+void CodeGenVisitor::visit(NProcedure* element, uint64_t flag)
+{
+  switch (flag)
+  {
+    case V_FLAG_ENTER:
+      {
+        if (verbose) std::cout << "CodeGenVisitor entering " << typeid(element).name() << " " << element->id.name.str() << std::endl;
+        std::vector<Type*> params;
+        for (VariableList::iterator it = element->params.begin(); it != element->params.end(); ++it) {
+          params.push_back((Type*) typeOf((*it)->type, llvmContext));
+        }
+        FunctionType* ftype = FunctionType::get(Type::getVoidTy(llvmContext), params, false);
+        // Created before the body, which may call it
+        function = Function::Create(ftype, GlobalValue::InternalLinkage, element->id.name.str(), context->module.get());
+        if (element->index >= (int) procedures.size()) procedures.resize(element->index + 1, NULL);
+        procedures[element->index] = function;
+        resume = Builder.GetInsertBlock();
+        Builder.SetInsertPoint(BasicBlock::Create(llvmContext, "entry", function));
+      }
+      break;
+    case V_FLAG_THEN | V_FLAG_ENTER:
+      {
+        // The parameters were declared, each with its own slot
+        Function::arg_iterator arg = function->arg_begin();
+        for (VariableList::iterator it = element->params.begin(); it != element->params.end(); ++it, ++arg) {
+          Builder.CreateStore(&*arg, slots[(*it)->id.slot]);
+        }
+      }
+      break;
+    case V_FLAG_EXIT:
+      if (verbose) std::cout << "CodeGenVisitor leaving " << typeid(element).name() << " " << element->id.name.str() << std::endl;
+      Builder.CreateRetVoid();
+      verifyFunction(*function);
+      function = mainFunction;
+      Builder.SetInsertPoint(resume);
+      break;
+    default:
+      break;
+  }
+}
+
+void CodeGenVisitor::visit(NCall* element, uint64_t flag)
+{
+  if (verbose) std::cout << "CodeGenVisitor " << typeid(element).name() << " " << element->id.name.str() << std::endl;
+  assert(element->procedure >= 0); // Caught by type-checker
+  // The last argument is at the front
+  std::vector<Value*> args(element->args.size());
+  for (size_t i = args.size(); i-- > 0; ) {
+    args[i] = vals.front();
+    vals.pop_front();
+  }
+  Function* callee = procedures[element->procedure];
+  Builder.CreateCall(callee, args);
+  // A call has no value, like an assignment.  A procedure calling itself
+  // is not finished yet, so may still index out of bounds.
+  if (callee != function && mayFail.count(callee) == 0) return;
+  Type* i32 = Type::getInt32Ty(llvmContext);
+  Value* line = Builder.CreateLoad(i32, getFailedLine());
+  BasicBlock* fail = BasicBlock::Create(llvmContext, "call.fail", function);
+  BasicBlock* next = BasicBlock::Create(llvmContext, "call.ok", function);
+  Builder.CreateCondBr(Builder.CreateICmpEQ(line, ConstantInt::get(i32, 0)), next, fail,
+                       MDBuilder(llvmContext).createBranchWeights(1 << 20, 1));
+  Builder.SetInsertPoint(fail);
+  if (function == mainFunction) {
+    Builder.CreateRet(line);
+  } else {
+    Builder.CreateRetVoid();
+    mayFail.insert(function);
+  }
+  Builder.SetInsertPoint(next);
+}
@@ -23,12 +23,31 @@
 #include "node.h"
 #include "visitor.h"
 #include "scope.h"
+#include "codeCache.h"
+#include "timings.h"
+#include "lattice.h"
+#include "shadowVis.h"
+#include <list>
+#include <unordered_set>
+#include <vector>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/IRBuilder.h>
-#include <llvm/ExecutionEngine/GenericValue.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/Target/TargetMachine.h>
+#include <memory>
+#include <string>
 
 class CodeGenVisitor : public Visitor {
+public:
+  typedef int (*EntryPoint)();
+  // Listings written next to an ahead-of-time output
+  enum Listing {
+    LIST_IR = 1,       // .ll
+    LIST_ASSEMBLY = 2, // .s
+  };
+
 private:
   class If {
   public:
@@ -44,22 +63,83 @@ private:
     llvm::BasicBlock *bodyBB = NULL;
     llvm::BasicBlock *endBB = NULL;
   };
+  // A label at run time, as an i8, and the highest it can be
+  class Taint {
+  public:
+    llvm::Value* label;
+    Label bound;
+    Taint(llvm::Value* label, Label bound) : label(label), bound(bound) { }
+  };
+  // A share of the module's functions, optimized and compiled on a thread
+  // of its own, in a context of its own
+  class Part {
+  public:
+    std::unique_ptr<llvm::LLVMContext> context;
+    std::unique_ptr<llvm::Module> module;
+    std::unique_ptr<llvm::MemoryBuffer> object;
+  };
 
-  char* filename;
+  const char* filename = NULL;
+  const char* native = NULL;  // Object or executable to emit, NULL to not
+  unsigned listings = 0;
+  std::string arch;           // Empty for the host's
+  std::string cpu;            // Empty or "native" for the host's
   bool verbose = false;
+  unsigned optLevel = 0;
+  unsigned threads = 1;
+  llvm::orc::ThreadSafeContext tsContext;
+  llvm::LLVMContext& llvmContext;
+  llvm::IRBuilder<> Builder;
+  std::unique_ptr<llvm::orc::LLLazyJIT> jit;
+  CodeCache* cache = NULL;
+  std::string cacheKey;
+  Timings* timings = NULL;
   llvm::Function *mainFunction;
-  //llvm::IRBuilder<> *Builder = NULL;
+  llvm::Function *function;          // Being generated, main or a procedure
+  llvm::BasicBlock *resume = NULL;   // Where main goes on after a procedure
   std::list<llvm::Value*> vals;
+  std::vector<llvm::Value*> slots;   // Indexed by NIdentifier::slot, allocas or globals
+  std::vector<llvm::Function*> procedures; // Indexed by NProcedure::index
+  std::vector<Part> parts;           // Empty unless compiled in parallel
+  std::unordered_set<llvm::Function*> mayFail; // Procedures that can index out of bounds
+  llvm::GlobalVariable* failedLine = NULL;      // Where they did, or 0
   std::list<If*> ifs;
   std::list<While*> whiles;
+  // Run-time flow tracking, NULL when the type checker proved the program
+  const ShadowVisitor* shadows = NULL;
+  Lattice* lattice = NULL;
+  std::vector<Taint> taints;        // Labels of the values in vals
+  std::vector<Taint> pcs;           // Labels of the enclosing contexts
+  std::vector<llvm::AllocaInst*> shadowSlots; // Indexed by NIdentifier::slot
+  llvm::GlobalVariable* joinTable = NULL;
+  int initializing = -1;            // Slot whose initializer comes next
 
   class CodeGenContext {
   public:
-    Scope* scope; 
-    llvm::Module* module;
-    CodeGenContext(Scope* scope, llvm::Module* module) : scope(scope), module(module) { }
+    std::unique_ptr<llvm::Module> module; // NULL once handed to the JIT
+    CodeGenContext(std::unique_ptr<llvm::Module> module) : module(std::move(module)) { }
   };
 
+  EntryPoint lookUpMain();
+  llvm::AllocaInst* createEntryBlockAlloca(llvm::Type* type, const std::string& name);
+  llvm::Value* slotFor(int slot);
+  llvm::Value* element(int slot, llvm::Value* index, int lineno);
+  llvm::GlobalVariable* getFailedLine();
+  std::unique_ptr<llvm::TargetMachine> hostMachine();
+  void optimize(llvm::Module& module, llvm::TargetMachine& tm);
+  bool split(const llvm::TargetMachine* tm);
+  bool createJIT();
+  std::unique_ptr<llvm::MemoryBuffer> compileToObject();
+  bool compileParts(const llvm::TargetMachine& tm);
+  std::unique_ptr<llvm::TargetMachine> createTargetMachine();
+  bool emit();
+  bool link(const std::vector<std::string>& objects);
+  void countInstructions(const char* blocks, const char* instructions);
+  Taint constantTaint(Label label);
+  Taint join(const Taint& a, const Taint& b);
+  void checkFlow(const Taint& taint, Label to, int lineno);
+  void raise(Node* branch, int part);
+
 public:
   virtual void visit(NSkip* nSkip, uint64_t flag);
   virtual void visit(NInteger* nInteger, uint64_t flag);
@@ -75,20 +155,34 @@ public:
   virtual void visit(NBlock* nBlock, uint64_t flag);
   virtual void visit(NExpressionStatement* nExpressionStatement, uint64_t flag);
   virtual void visit(NVariableDeclaration* nVariableDeclaration, uint64_t flag);
+  virtual void visit(NProcedure* nProcedure, uint64_t flag);
+  virtual void visit(NCall* nCall, uint64_t flag);
+  virtual void visit(NElement* nElement, uint64_t flag);
+  virtual void visit(NElementAssignment* nElementAssignment, uint64_t flag);
 
-  CodeGenContext* context;
-  CodeGenVisitor() { };
-  ~CodeGenVisitor() {
-    if (context != NULL) {
-      if (context->scope != NULL) delete context->scope;
-      if (context->module != NULL) delete context->module;
-      delete context;
-    }
-  };
+  CodeGenContext* context = NULL;
+  CodeGenVisitor(llvm::orc::ThreadSafeContext tsContext)
+    : tsContext(tsContext), llvmContext(*tsContext.getContext()), Builder(llvmContext) { };
+  ~CodeGenVisitor() { delete context; };
   void init();
-  void setFileName(char* filename) {this->filename = filename; };
-  void generateCode();
-  llvm::GenericValue runCode();
+  void setFileName(const char* filename) {this->filename = filename; };
+  void setOptLevel(unsigned level) { optLevel = level; };
+  // Optimizes and compiles the procedures on up to this many threads.  Not
+  // with a cache or for a .o, which are one object each.
+  void setThreads(unsigned threads) { this->threads = threads; };
+  bool generateCode();
+  // Compiles to a .o, or links an executable for any other name, instead
+  // of handing the module to the JIT
+  void setNative(const char* native, unsigned listings) { this->native = native; this->listings = listings; };
+  void setTarget(const char* arch, const char* cpu) { this->arch = arch ? arch : ""; this->cpu = cpu ? cpu : ""; };
+  // Tracks labels at run time as planned by shadows, and makes main return
+  // the line of the first store that breaks the policy
+  void setShadows(const ShadowVisitor* shadows, Lattice* lattice);
+  void setCache(CodeCache* cache, const std::string& key) { this->cache = cache; cacheKey = key; };
+  void setTimings(Timings* timings) { this->timings = timings; };
+  EntryPoint getEntryPoint();
+  EntryPoint loadObject(std::unique_ptr<llvm::MemoryBuffer> object);
+  int runCode();
   void setVerbose(bool v) { verbose = v; };
   bool getVerbose() { return verbose; };
 };
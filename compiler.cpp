@@ -0,0 +1,363 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#include "compiler.h"
+#include "parserState.h"
+#include "lexer.h"
+#include "resolveVis.h"
+#include "typecheckVis.h"
+#include "simplifyVis.h"
+#include "blockHashVis.h"
+#include "codegenVis.h"
+#include "bytecodeVis.h"
+#include "shadowVis.h"
+#include "parser.hpp"
+#include "tokens.hpp"
+#include <stdio.h>
+#include <algorithm>
+#include <memory>
+
+/* Sets up the code generator straight from a cached object.  On a hit the
+ * front end and LLVM codegen are skipped altogether, and no bitcode is
+ * written. */
+bool Compilation::loadCached(const std::string& key)
+{
+  std::unique_ptr<llvm::MemoryBuffer> object = options.cache->load(key);
+  if (object == NULL) return false;
+  if (options.verbose) printf("Cache hit %s\n", key.c_str());
+  codeGenVis = new CodeGenVisitor(llvmContext);
+  codeGenVis->setVerbose(options.verbose);
+  codeGenVis->setOptLevel(options.optLevel);
+  codeGenVis->setTimings(timer());
+  if (codeGenVis->loadObject(std::move(object)) != NULL) return true;
+  delete codeGenVis;
+  codeGenVis = NULL;
+  return false;
+}
+
+Compilation::Status Compilation::compile(const char* source, size_t size)
+{
+  std::string cacheKey;
+  if (options.cache != NULL && options.geningcode && !options.bytecode && options.native == NULL) {
+    Timings::Timer timer(this->timer(), "cache");
+    cacheKey = options.cache->key(source, size, options);
+    if (loadCached(cacheKey)) return OK;
+  }
+  LineIndex lines(source, size);
+  if (options.streaming) return stream(source, size, lines, cacheKey);
+  ParserState state(&arena, &lattice);
+  state.lines = &lines;
+  {
+    Timings::Timer timer(this->timer(), "parse");
+    if (parse(state, source, size)) return PARSE_ERROR;
+  }
+  programBlock = state.programBlock;
+  if (timer() != NULL) {
+    timings.count("source.bytes", size);
+    timings.count("ast.nodes", arena.getNodeCount());
+  }
+  if (options.verbose) {
+    printf("AST: %zu nodes, %zu bytes used, %zu bytes reserved in %zu chunks\n",
+           arena.getNodeCount(), arena.getBytesUsed(),
+           arena.getBytesReserved(), arena.getChunkCount());
+    printf("Names: %zu interned, %zu bytes\n",
+           Interner::get().size(), Interner::get().getBytes());
+  }
+  {
+    Timings::Timer timer(this->timer(), "lattice");
+    std::string err;
+    if (!lattice.seal(err)) {
+      fprintf(stderr, "ERR: %s\n", err.c_str());
+      return PARSE_ERROR;
+    }
+    if (options.verbose) printf("Security lattice: %zu labels\n", lattice.size());
+  }
+  if (options.flattening) {
+    Timings::Timer timer(this->timer(), "flatten");
+    flat.build(programBlock, arena.getNodeCount());
+    flatCurrent = true;
+    if (this->timer() != NULL) timings.count("flat.events", flat.size());
+    if (options.verbose) printf("Flattened: %zu events, %zu bytes\n", flat.size(), flat.getBytes());
+  }
+  {
+    // Bind identifiers to slots once, for both the type checker and codegen
+    Timings::Timer timer(this->timer(), "resolve");
+    ResolveVisitor resolveVis;
+    resolveVis.setVerbose(options.verbose);
+    // The flat passes trace nothing, verbose runs walk to name the nodes
+    if (flatCurrent && !options.verbose) {
+      resolveVis.resolve(flat);
+    } else {
+      walk(resolveVis);
+    }
+    slotCount = resolveVis.getSlotCount();
+    if (options.verbose) {
+      printf("Resolved %d variable slots, %d unresolved uses\n",
+             resolveVis.getSlotCount(), resolveVis.getUnresolvedCount());
+    }
+    if (resolveVis.getProcedureCount() > 0 && options.geningcode && (options.bytecode || options.tracking)) {
+      // The VM has no calls, and the shadow visitor does not follow labels
+      // through parameters
+      fprintf(stderr, "ERR: Procedures are not supported with -x vm or -D\n");
+      return EMIT_ERROR;
+    }
+    if (resolveVis.getArrayCount() > 0 && options.geningcode && (options.bytecode || options.tracking)) {
+      // Neither the VM nor the shadow visitor have memory besides slots
+      fprintf(stderr, "ERR: Arrays are not supported with -x vm or -D\n");
+      return EMIT_ERROR;
+    }
+  }
+  if (options.typechecking) {
+    Timings::Timer timer(this->timer(), "typecheck");
+    TypeCheckerVisitor typeCheckVis(&lattice, *llvmContext.getContext());
+    typeCheckVis.setVerbose(options.verbose);
+    typeCheckVis.setDeferring(options.tracking);
+    BlockHashVisitor hashVis;
+    if (options.memo != NULL) {
+      walk(hashVis);
+      typeCheckVis.setMemo(options.memo, &hashVis);
+    }
+    if (options.filename != NULL) typeCheckVis.setSource(options.filename, &lines); // For printing error messages
+    if (flatCurrent && !options.verbose) {
+      typeCheckVis.check(flat);
+    } else {
+      walk(typeCheckVis);
+    }
+    blocksChecked = typeCheckVis.getBlocksChecked();
+    blocksReused = typeCheckVis.getBlocksReused();
+    if (!typeCheckVis.getPassed()) return TYPE_ERROR;
+    if (options.verbose) printf("Type-checking passed, peak type stack depth %zu\n", typeCheckVis.getPeakDepth());
+    if (options.verbose && options.tracking) printf("Deferred %d flows to run time\n", typeCheckVis.getDeferred());
+  }
+  if (options.simplifying) {
+    // After type checking, so that pruned code still had its flows checked
+    Timings::Timer timer(this->timer(), "simplify");
+    SimplifyVisitor simplifyVis(arena);
+    simplifyVis.setVerbose(options.verbose);
+    walk(simplifyVis);
+    // Any change rebuilt nodes the flat form still points to the old ones of
+    flatCurrent = flatCurrent && simplifyVis.getFoldedCount() == 0 &&
+        simplifyVis.getPrunedCount() == 0 && simplifyVis.getDroppedCount() == 0;
+    if (options.verbose) {
+      printf("Simplified: %d constants folded, %d branches pruned, %d statements dropped\n",
+             simplifyVis.getFoldedCount(), simplifyVis.getPrunedCount(), simplifyVis.getDroppedCount());
+    }
+  }
+  if (options.geningcode && options.bytecode) {
+    {
+      Timings::Timer timer(this->timer(), "bytecode");
+      BytecodeVisitor bytecodeVis(bytecode, slotCount);
+      bytecodeVis.setVerbose(options.verbose);
+      walk(bytecodeVis);
+      bytecodeVis.finish();
+    }
+    if (timer() != NULL) timings.count("bytecode.instructions", bytecode.code.size());
+  } else if (options.geningcode) {
+    codeGenVis = new CodeGenVisitor(llvmContext);
+    codeGenVis->setVerbose(options.verbose);
+    codeGenVis->setTimings(timer());
+    // After simplification, which rebuilds the nodes it plans for
+    std::unique_ptr<ShadowVisitor> shadowVis;
+    if (options.tracking) {
+      Timings::Timer timer(this->timer(), "shadow");
+      shadowVis.reset(new ShadowVisitor(&lattice, slotCount));
+      shadowVis->setVerbose(options.verbose);
+      walk(*shadowVis);
+      shadowVis->finish();
+      codeGenVis->setShadows(shadowVis.get(), &lattice);
+      if (this->timer() != NULL) {
+        timings.count("taint.checks", shadowVis->getCheckCount());
+        timings.count("taint.shadows", shadowVis->getShadowCount());
+      }
+      if (options.verbose) {
+        printf("Tracking: %d checks, %d of %d variables shadowed\n",
+               shadowVis->getCheckCount(), shadowVis->getShadowCount(), slotCount);
+      }
+    }
+    {
+      Timings::Timer timer(this->timer(), "codegen");
+      codeGenVis->init();
+      codeGenVis->setFileName(options.output);
+      codeGenVis->setOptLevel(options.optLevel);
+      codeGenVis->setThreads(options.threads);
+      if (options.cache != NULL) codeGenVis->setCache(options.cache, cacheKey);
+      codeGenVis->setNative(options.native, options.listings);
+      codeGenVis->setTarget(options.arch, options.cpu);
+      walk(*codeGenVis);
+    }
+    // Times its optimization, bitcode writing and emission as phases of their own
+    if (!codeGenVis->generateCode()) return EMIT_ERROR;
+  }
+  return OK;
+}
+
+/* Runs a pass over the flat form while it matches the tree, else over the tree */
+void Compilation::walk(Visitor& visitor)
+{
+  if (flatCurrent) {
+    flat.replay(visitor);
+  } else {
+    programBlock->accept(visitor);
+  }
+}
+
+int Compilation::parse(ParserState& state, const char* source, size_t size)
+{
+  if (options.handLexer) {
+    // Scans the caller's buffer in place, flex would copy it first
+    Lexer lexer(source, size, &lattice);
+    state.lexer = &lexer;
+    int ret = yyparse(&state, NULL);
+    state.lexer = NULL;
+    return ret;
+  }
+  yyscan_t scanner;
+  yylex_init_extra(&state, &scanner);
+  YY_BUFFER_STATE buffer = yy_scan_bytes(source, size, scanner);
+  int ret = yyparse(&state, scanner);
+  yy_delete_buffer(buffer, scanner);
+  yylex_destroy(scanner);
+  return ret;
+}
+
+// Checks and generates code for every top-level statement as soon as the
+// parser completes it, then frees its nodes, so the AST never holds more
+// than one top-level statement.  The visitors enter the program scope once
+// and keep their declarations and slots from one statement to the next.
+Compilation::Status Compilation::stream(const char* source, size_t size,
+                                        LineIndex& lines, const std::string& cacheKey)
+{
+  Arena statementArena;
+  ParserState state(&statementArena, &lattice);
+  state.lines = &lines;
+  // Stands for the top-level scope, its statements are never kept
+  programBlock = arena.make<NBlock>();
+  std::unique_ptr<ResolveVisitor> resolveVis;
+  std::unique_ptr<TypeCheckerVisitor> typeCheckVis;
+  bool failed = false;
+  size_t nodes = 0, peakNodes = 0;
+  state.stream = [&](NStatement* statement) -> bool {
+    if (resolveVis == NULL) {
+      // Every label is declared before the first statement
+      std::string err;
+      if (!lattice.seal(err)) {
+        fprintf(stderr, "ERR: %s\n", err.c_str());
+        return false;
+      }
+      if (options.verbose) printf("Security lattice: %zu labels\n", lattice.size());
+      resolveVis.reset(new ResolveVisitor());
+      resolveVis->visit(programBlock, V_FLAG_ENTER);
+      if (options.typechecking) {
+        typeCheckVis.reset(new TypeCheckerVisitor(&lattice, *llvmContext.getContext()));
+        typeCheckVis->setVerbose(options.verbose);
+        if (options.filename != NULL) typeCheckVis->setSource(options.filename, &lines);
+        typeCheckVis->visit(programBlock, V_FLAG_ENTER);
+      }
+      if (options.geningcode) {
+        codeGenVis = new CodeGenVisitor(llvmContext);
+        codeGenVis->setVerbose(options.verbose);
+        codeGenVis->setTimings(timer());
+        codeGenVis->init();
+        codeGenVis->setFileName(options.output);
+        codeGenVis->setOptLevel(options.optLevel);
+        codeGenVis->setThreads(options.threads);
+        if (options.cache != NULL) codeGenVis->setCache(options.cache, cacheKey);
+        codeGenVis->setNative(options.native, options.listings);
+        codeGenVis->setTarget(options.arch, options.cpu);
+        codeGenVis->visit(programBlock, V_FLAG_ENTER);
+      }
+    }
+    nodes += statementArena.getNodeCount();
+    peakNodes = std::max(peakNodes, statementArena.getNodeCount());
+    {
+      Timings::Timer timer(this->timer(), "resolve");
+      statement->accept(*resolveVis);
+    }
+    if (typeCheckVis != NULL) {
+      // Keeps going after an error, to report the ones further down too
+      Timings::Timer timer(this->timer(), "typecheck");
+      statement->accept(*typeCheckVis);
+      failed = !typeCheckVis->getPassed();
+    }
+    if (codeGenVis != NULL && !failed) {
+      // Simplification may drop the statement or splice in a block's body
+      NBlock* wrapper = statementArena.make<NBlock>();
+      wrapper->statements.push_back(statement);
+      if (options.simplifying) {
+        Timings::Timer timer(this->timer(), "simplify");
+        SimplifyVisitor simplifyVis(statementArena);
+        simplifyVis.setVerbose(options.verbose);
+        wrapper->accept(simplifyVis);
+      }
+      Timings::Timer timer(this->timer(), "codegen");
+      for (NStatement* s : wrapper->statements) s->accept(*codeGenVis);
+    }
+    statementArena.reset();
+    return true;
+  };
+  int ret;
+  {
+    Timings::Timer timer(this->timer(), "parse");
+    ret = parse(state, source, size);
+  }
+  if (resolveVis != NULL) {
+    resolveVis->visit(programBlock, V_FLAG_EXIT);
+    slotCount = resolveVis->getSlotCount();
+    if (typeCheckVis != NULL) typeCheckVis->visit(programBlock, V_FLAG_EXIT);
+    if (codeGenVis != NULL) codeGenVis->visit(programBlock, V_FLAG_EXIT);
+  }
+  if (ret) return PARSE_ERROR;
+  if (timer() != NULL) {
+    timings.count("source.bytes", size);
+    timings.count("ast.nodes", nodes);
+    timings.count("ast.peak_nodes", peakNodes);
+  }
+  if (options.verbose) {
+    printf("AST: %zu nodes streamed, at most %zu at once\n", nodes, peakNodes);
+    printf("Resolved %d variable slots\n", slotCount);
+  }
+  if (failed) return TYPE_ERROR;
+  // Times its optimization and bitcode writing as phases of their own
+  if (codeGenVis != NULL && !codeGenVis->generateCode()) return EMIT_ERROR;
+  return OK;
+}
+
+CodeGenVisitor::EntryPoint Compilation::getEntryPoint()
+{
+  if (codeGenVis == NULL) return NULL;
+  return codeGenVis->getEntryPoint();
+}
+
+int Compilation::run()
+{
+  if (options.bytecode) {
+    if (options.verbose) printf("Running bytecode...\n");
+    VM vm(bytecode);
+    int ret;
+    {
+      Timings::Timer timer(this->timer(), "execute");
+      ret = vm.run();
+    }
+    if (options.verbose) vm.dumpVariables(std::cout);
+    return ret;
+  }
+  assert(codeGenVis != NULL);
+  return codeGenVis->runCode();
+}
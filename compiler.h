@@ -0,0 +1,117 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __COMPILER_H_
+#define __COMPILER_H_
+#include "node.h"
+#include "arena.h"
+#include "lattice.h"
+#include "codegenVis.h"
+#include "codeCache.h"
+#include "vm.h"
+#include "checkCache.h"
+#include "timings.h"
+#include "flatAst.h"
+#include <string>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+
+class ParserState;
+class LineIndex;
+
+class CompileOptions {
+public:
+  bool typechecking = true;
+  bool simplifying = true;   // Fold constants and prune dead branches
+  bool geningcode = true;
+  bool verbose = false;
+  bool bytecode = false;     // Run on the VM instead of the LLVM JIT
+  bool handLexer = false;    // Scan with Lexer instead of the flex scanner
+  bool streaming = false;    // Check and generate each top-level statement as it is parsed
+  bool flattening = false;   // Run the passes over a FlatAst rather than the tree
+  bool tracking = false;     // Check at run time the flows the type checker cannot prove
+  unsigned optLevel = 0;     // 0 to 3, as in -O0..-O3
+  unsigned threads = 1;      // Optimizing and compiling procedures in parallel
+  char* filename = NULL;     // Only used to label error messages
+  const char* output = NULL; // Bitcode file to write, NULL to stay in memory
+  const char* native = NULL; // Object (.o) or executable to write, NULL to not
+  unsigned listings = 0;     // CodeGenVisitor::Listing flags, written next to native
+  const char* arch = NULL;   // Architecture of native, NULL for the host's
+  const char* cpu = NULL;    // CPU of native, NULL for the host's
+  CodeCache* cache = NULL;   // Native objects of earlier runs, NULL for none
+  CheckCache* memo = NULL;   // Blocks that passed earlier type checks, NULL for none
+  Timings::Format timing = Timings::OFF; // How -T prints, OFF to not measure at all
+};
+
+// One compilation of one source buffer.  All the state, from the scanner
+// to the LLVMContext, belongs to the Compilation object, so different
+// threads can each run their own at the same time.
+class Compilation {
+public:
+  enum Status {
+    OK = 0,
+    PARSE_ERROR,
+    TYPE_ERROR,
+    EMIT_ERROR,
+  };
+
+private:
+  CompileOptions options;
+  llvm::orc::ThreadSafeContext llvmContext; // Shared with the JIT
+  Arena arena;
+  Lattice lattice;
+  NBlock* programBlock = NULL;
+  FlatAst flat;
+  bool flatCurrent = false;  // flat still describes programBlock
+  CodeGenVisitor* codeGenVis = NULL;
+  Bytecode bytecode;
+  int slotCount = 0;
+  int blocksChecked = 0;
+  int blocksReused = 0;
+  Timings timings;
+
+  Timings* timer() { return options.timing == Timings::OFF ? NULL : &timings; };
+  bool loadCached(const std::string& key);
+  void walk(Visitor& visitor);
+  int parse(ParserState& state, const char* source, size_t size);
+  Status stream(const char* source, size_t size, LineIndex& lines, const std::string& cacheKey);
+
+public:
+  Compilation(const CompileOptions& options)
+    : options(options), llvmContext(std::make_unique<llvm::LLVMContext>()) { }
+  ~Compilation() { delete codeGenVis; }
+  // The source must stay valid until compile returns
+  Status compile(const char* source, size_t size);
+  Status compile(const std::string& source) { return compile(source.data(), source.size()); };
+  NBlock* getProgram() { return programBlock; };
+  // Blocks type checked and blocks whose earlier verdict was reused
+  int getBlocksChecked() { return blocksChecked; };
+  int getBlocksReused() { return blocksReused; };
+  // Phases measured so far, empty unless options.timing is set
+  const Timings& getTimings() { return timings; };
+  // NULL unless LLVM code generation ran
+  CodeGenVisitor::EntryPoint getEntryPoint();
+  // Returns what main returned: the line of the flow that broke the
+  // policy with tracking, else of an index out of bounds, or 0
+  int run();
+  // What stopped the program when run() returned a line
+  const char* getFailure() { return options.tracking ? "Information flow violation" : "Index out of bounds"; };
+};
+#endif // __COMPILER_H_
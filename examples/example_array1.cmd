@@ -0,0 +1,17 @@
+int squares[1000];
+double halves[1000];
+int i = 0;
+// Every index is below 1000, so the bounds checks fold away at -O2 and
+// both loops are vectorized
+while i < 1000 {
+  squares[i] = i * i;
+  i = i + 1;
+}
+int total = 0;
+i = 0;
+while i < 1000 {
+  total = total + squares[i];
+  i = i + 1;
+}
+high int secret[4];
+secret[total / 100000000] = total;
@@ -0,0 +1,22 @@
+int total = 0;
+// Adds n, n - 1, ..., 1 to total
+proc sum(int n) {
+  if n > 0 {
+    total = total + n;
+    call sum(n - 1);
+  } else {
+    skip;
+  }
+}
+high int secret = 5;
+high int copy = 0;
+// Only writes high variables, so it may be called from any context
+high proc keep(high int x) {
+  copy = x;
+}
+call sum(10);
+if secret > 0 {
+  call keep(secret);
+} else {
+  skip;
+}
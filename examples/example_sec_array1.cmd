@@ -0,0 +1,4 @@
+high int secret = 2;
+int seen[4];
+// This must fail because which element changes reveals secret
+seen[secret] = 1;
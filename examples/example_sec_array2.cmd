@@ -0,0 +1,5 @@
+high int secret[4];
+int low = 0;
+secret[1] = 5;
+// This must fail because every element of secret is high
+low = secret[1];
@@ -0,0 +1,10 @@
+label alice;
+label bob;
+// staff flows to both alice and bob
+label staff < alice, bob;
+staff int s = 1;
+alice int a = s;
+bob int b = s;
+a = a + s;
+// The join of alice and bob is high
+high int h = a + b;
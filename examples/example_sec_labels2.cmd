@@ -0,0 +1,10 @@
+label alice;
+label bob;
+alice int a = 1;
+bob int b = 0;
+if a > 0 {
+  // This must fail because alice does not flow to bob
+  b = 1;
+} else {
+  skip;
+}
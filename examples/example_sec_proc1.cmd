@@ -0,0 +1,11 @@
+int count = 0;
+high int secret = 1;
+proc bump() {
+  count = count + 1;
+}
+if secret > 0 {
+  // This must fail because bump writes low variables, and we are in a high context
+  call bump();
+} else {
+  skip;
+}
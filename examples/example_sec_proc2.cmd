@@ -0,0 +1,7 @@
+int shown = 0;
+high int secret = 1;
+proc show(int x) {
+  shown = x;
+}
+// This must fail because x is low, and secret is high
+call show(secret);
@@ -0,0 +1,11 @@
+high int a = 10;
+int b = 0;
+// Rejected by the type checker, but with -D a only holds low data here
+a = 1;
+b = a + 1;
+if a > 1 {
+  skip;
+} else {
+  // Runs in a low context, so b may be assigned
+  b = 2;
+}
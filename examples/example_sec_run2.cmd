@@ -0,0 +1,9 @@
+high int a = 10;
+int b = 0;
+if a > 1 {
+  skip;
+} else {
+  // Not taken, but not taking it leaks a just the same, so with -D the
+  // program stops and reports this store
+  b = 2;
+}
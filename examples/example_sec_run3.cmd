@@ -0,0 +1,9 @@
+high int h = 1;
+bool b = false;
+if h > 0 {
+  // This must fail on types, even with -D, which only leaves the flow to
+  // run time
+  b = 5;
+} else {
+  skip;
+}
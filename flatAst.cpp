@@ -0,0 +1,172 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#include "flatAst.h"
+#include "staticVisitor.h"
+#include <string.h>
+
+static const Name INT_TYPE("int");
+static const Name DOUBLE_TYPE("double");
+static const Name BOOL_TYPE("bool");
+
+static FlatAst::Type typeOf(Name name)
+{
+  if (name == INT_TYPE) return FlatAst::T_INT;
+  if (name == DOUBLE_TYPE) return FlatAst::T_DOUBLE;
+  if (name == BOOL_TYPE) return FlatAst::T_BOOL;
+  return FlatAst::T_VOID;
+}
+
+// Records the events of a traversal, without going through the Visitor
+// vtable.  Declaration initializers get an assignment of their own that
+// outlives the traversal.
+class FlatAst::Builder : public StaticVisitor<FlatAst::Builder> {
+private:
+  FlatAst& flat;
+  std::vector<size_t> open; // ENTER events of the blocks being built
+  NVariableDeclaration* declaration = NULL;
+
+public:
+  Builder(FlatAst& flat) : flat(flat) { }
+
+  void visit(NSkip* element, uint64_t flag) {
+    flat.add(flag, element, 0, T_VOID);
+  };
+  void visit(NInteger* element, uint64_t flag) {
+    flat.add(flag, element, flat.constants.size(), T_INT);
+    flat.constants.push_back((uint64_t) element->value);
+  };
+  void visit(NBool* element, uint64_t flag) {
+    flat.add(flag, element, element->value.compare("true") == 0, T_BOOL);
+  };
+  void visit(NDouble* element, uint64_t flag) {
+    uint64_t bits;
+    memcpy(&bits, &element->value, sizeof(bits));
+    flat.add(flag, element, flat.constants.size(), T_DOUBLE);
+    flat.constants.push_back(bits);
+  };
+  void visit(NType* element, uint64_t flag) {
+    flat.add(flag, element, element->name.getId(), typeOf(element->name));
+  };
+  void visit(NSecurity* element, uint64_t flag) {
+    flat.add(flag, element, element->name.getId());
+  };
+  void visit(NIdentifier* element, uint64_t flag) {
+    flat.add(flag, element, element->name.getId());
+  };
+  void visit(NIfExpression* element, uint64_t flag) {
+    flat.add(flag, element, 0);
+  };
+  void visit(NWhileExpression* element, uint64_t flag) {
+    flat.add(flag, element, 0);
+  };
+  void visit(NBinaryOperator* element, uint64_t flag) {
+    flat.add(flag, element, element->op);
+  };
+  void visit(NAssignment* element, uint64_t flag) {
+    if (declaration != NULL && &element->lhs == &declaration->id) {
+      // The walker's copy is gone once the declaration is done
+      flat.assignments.emplace_back(element->lhs, element->rhs);
+      flat.assignments.back().lineno = element->lineno;
+      element = &flat.assignments.back();
+      declaration = NULL;
+    }
+    flat.add(flag, element, element->lhs.name.getId());
+  };
+  void visit(NBlock* element, uint64_t flag) {
+    if (flag == V_FLAG_ENTER) {
+      open.push_back(flat.size());
+      flat.add(flag, element, 0);
+      return;
+    }
+    flat.operands[open.back()] = flat.size();
+    open.pop_back();
+    flat.add(flag, element, 0);
+  };
+  void visit(NExpressionStatement* element, uint64_t flag) {
+    flat.add(flag, element, 0);
+  };
+  void visit(NVariableDeclaration* element, uint64_t flag) {
+    if (element->assignmentExpr != NULL) declaration = element;
+    flat.add(flag, element, element->id.name.getId());
+  };
+  void visit(NProcedure* element, uint64_t flag) {
+    flat.add(flag, element, element->id.name.getId());
+  };
+  void visit(NCall* element, uint64_t flag) {
+    flat.add(flag, element, element->id.name.getId());
+  };
+  void visit(NElement* element, uint64_t flag) {
+    flat.add(flag, element, element->id.name.getId());
+  };
+  void visit(NElementAssignment* element, uint64_t flag) {
+    flat.add(flag, element, element->id.name.getId());
+  };
+};
+
+void FlatAst::add(uint64_t flag, Node* node, int32_t operand, Type type)
+{
+  kinds.push_back(node->kind);
+  flags.push_back(flag == (uint64_t) V_FLAG_NONE ? NO_FLAG : (uint8_t) flag);
+  operands.push_back(operand);
+  lines.push_back(node->lineno);
+  types.push_back(type);
+  slots.push_back(-1);
+  nodes.push_back(node);
+}
+
+void FlatAst::build(NBlock* root, size_t nodes)
+{
+  // Blocks, branches and loops have several events each.  Pages that are
+  // reserved but never written cost nothing, growing would copy them all.
+  size_t events = nodes * 2;
+  kinds.reserve(events);
+  flags.reserve(events);
+  operands.reserve(events);
+  lines.reserve(events);
+  types.reserve(events);
+  slots.reserve(events);
+  this->nodes.reserve(events);
+  Builder builder(*this);
+  builder.walk(root);
+}
+
+/* Gives the visitor every event, skipping the blocks it asks to skip */
+void FlatAst::replay(Visitor& visitor)
+{
+  size_t n = kinds.size();
+  for (size_t i = 0; i < n; i++) {
+    uint64_t flag = getFlag(i);
+    if (kinds[i] == N_BLOCK && flag == V_FLAG_ENTER &&
+        visitor.skip((NBlock*) nodes[i])) {
+      i = operands[i]; // Its EXIT
+      continue;
+    }
+    nodes[i]->dispatch(visitor, flag);
+  }
+}
+
+size_t FlatAst::getBytes() const
+{
+  return kinds.capacity() + flags.capacity() + types.capacity() +
+         (operands.capacity() + lines.capacity() + slots.capacity()) * sizeof(int32_t) +
+         nodes.capacity() * sizeof(Node*) + constants.capacity() * sizeof(uint64_t) +
+         assignments.size() * sizeof(NAssignment);
+}
@@ -0,0 +1,75 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __FLAT_AST_H_
+#define __FLAT_AST_H_
+#include "node.h"
+#include "visitor.h"
+#include <deque>
+#include <stdint.h>
+#include <vector>
+
+// The AST as the sequence of visitor events a traversal produces, built
+// once after parsing and stored in parallel arrays: what each event is,
+// its operand, line, type and slot, and the node it is about.  The
+// ResolveVisitor and the TypeCheckerVisitor read the arrays directly, and
+// only go to the nodes of declarations, procedures and calls; replay gives
+// any other Visitor the events accept would, in the same order.
+// The pointer tree stays the primary form; this is a view of it, and goes
+// stale once a pass such as the SimplifyVisitor rebuilds nodes.
+class FlatAst {
+public:
+  enum Type { T_NONE, T_VOID, T_INT, T_DOUBLE, T_BOOL };
+
+  // One entry per event, in post-order
+  std::vector<uint8_t> kinds;    // NodeKind
+  std::vector<uint8_t> flags;    // V_FLAG_*, NO_FLAG for V_FLAG_NONE
+  std::vector<int32_t> operands; // See below
+  std::vector<int32_t> lines;
+  std::vector<uint8_t> types;    // Type of the value of skips, literals and types
+  std::vector<int32_t> slots;    // See below, -1 until resolved
+  std::vector<Node*> nodes;
+  // Operands are, by kind: the Name id of identifiers, types, labels,
+  // declared variables, procedures, calls and arrays of elements; the token
+  // of binary operators; 0 or 1 for bools;
+  // the index into constants of integers and doubles; and, for the ENTER
+  // event of a block, the index of its EXIT event.  ResolveVisitor::resolve
+  // fills in the slots of identifiers, declared variables, assignments and
+  // arrays of elements, and the index of procedures and calls.
+  std::vector<uint64_t> constants; // Bits of integer and double literals
+
+private:
+  static const uint8_t NO_FLAG = 0xff;
+  // Declaration initializers, visited as assignments that are not in the tree
+  std::deque<NAssignment> assignments;
+
+  class Builder;
+  void add(uint64_t flag, Node* node, int32_t operand, Type type = T_NONE);
+
+public:
+  // nodes is how many nodes the tree has, to size the arrays up front
+  void build(NBlock* root, size_t nodes);
+  void replay(Visitor& visitor);
+  // The flag of event i, as visit gets it
+  uint64_t getFlag(size_t i) const { return flags[i] == NO_FLAG ? (uint64_t) V_FLAG_NONE : flags[i]; };
+  size_t size() const { return kinds.size(); };
+  size_t getBytes() const;
+};
+#endif // __FLAT_AST_H_
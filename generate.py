@@ -0,0 +1,283 @@
+#!/usr/bin/python
+# Writes random programs in the command language, for benchmarks.  The same
+# seed and sizes always give the same program.  Programs are well typed
+# unless errors are asked for, and every loop is bounded, so they can also
+# be run.
+# Usage: generate.py [-s seed] [-n statements] [-d depth] [-v vars]
+#                    [-l labels] [-H high] [-e errors] [-N levels]
+#                    [-p procedures] [-o fname]
+import argparse
+import random
+import sys
+
+LOW = "low"
+HIGH = "high"
+NEST_WINDOW = 4     # Scopes whose variables nest reads
+NEST_INDENT = 20    # Deepest indentation nest writes
+GLOBALS = 8         # Variables declared before the procedures
+
+class Generator:
+  """ Emits statements one at a time, keeping track of the variables in
+  scope and of the security context, so that every assignment it writes is
+  allowed by the type checker.  Labels form a flat lattice: low flows to
+  every label, every label flows to high, and the labels in between are
+  unrelated to each other. """
+
+  def __init__(self, seed, statements, depth, nvars, nlabels, high, errors, procedures=0):
+    self.rand = random.Random(seed)
+    self.statements = statements
+    self.depth = depth
+    self.labels = ["l%d" % i for i in range(nlabels)]
+    self.high = high
+    self.errors = errors
+    self.procedures = procedures
+    self.lines = []
+    self.scopes = [[]]      # Variables declared in each open block, outermost first
+    self.nvars = nvars
+    self.count = 0          # Statements written so far
+    self.names = 0          # Every variable gets a fresh name
+
+  @staticmethod
+  def flowsTo(a, b):
+    return a == LOW or b == HIGH or a == b
+
+  @staticmethod
+  def join(a, b):
+    if Generator.flowsTo(a, b): return b
+    if Generator.flowsTo(b, a): return a
+    return HIGH
+
+  def emit(self, indent, text):
+    self.lines.append("  " * indent + text)
+
+  def visible(self):
+    return [v for scope in self.scopes for v in scope]
+
+  def pickLabel(self):
+    r = self.rand.random()
+    if r < self.high: return HIGH
+    if self.labels and r < self.high + (1 - self.high) / 2:
+      return self.rand.choice(self.labels)
+    return LOW
+
+  def declare(self, indent, typ, sec, init):
+    name = "v%d" % self.names
+    self.names += 1
+    prefix = "" if sec == LOW else sec + " "
+    self.emit(indent, "%s%s %s = %s;" % (prefix, typ, name, init))
+    self.scopes[-1].append((name, typ, sec))
+    self.count += 1
+    return name
+
+  def constant(self, typ):
+    if typ == "int": return str(self.rand.randint(0, 99))
+    if typ == "double": return "%d.5" % self.rand.randint(0, 99)
+    return self.rand.choice(["true", "false"])
+
+  def operand(self, typ, sec, variable=False):
+    """ A variable of type typ whose label flows to sec, or a constant.
+    Returns the text and its label. """
+    choices = [v for v in self.visible() if v[1] == typ and self.flowsTo(v[2], sec)]
+    if choices and (variable or self.rand.random() < 0.8):
+      name, typ, label = self.rand.choice(choices)
+      return name, label
+    return self.constant(typ), LOW
+
+  def expression(self, typ, sec):
+    """ An expression of type typ that may be stored in a variable labeled
+    sec.  Returns the text and its label. """
+    if typ == "bool":
+      nums = [v[1] for v in self.visible() if v[1] != "bool" and self.flowsTo(v[2], sec)]
+      num = self.rand.choice(nums or ["int", "double"])
+      op = self.rand.choice(["<", "<=", ">", ">=", "==", "!="])
+      # Guards read a variable, else simplification would prune the branch
+      left, lsec = self.operand(num, sec, True)
+      right, rsec = self.operand(num, sec)
+      return "%s %s %s" % (left, op, right), self.join(lsec, rsec)
+    # No division, so that running a program cannot trap
+    expr, label = self.operand(typ, sec)
+    for i in range(self.rand.randint(0, 2)):
+      term, tsec = self.operand(typ, sec)
+      expr += " %s %s" % (self.rand.choice(["+", "-"]), term)
+      label = self.join(label, tsec)
+    return expr, label
+
+  def assignment(self, indent, pc):
+    targets = [v for v in self.visible() if self.flowsTo(pc, v[2]) and not v[0].startswith("c")]
+    if not targets:
+      self.declare(indent, "int", pc, self.constant("int"))
+      return
+    name, typ, sec = self.rand.choice(targets)
+    self.emit(indent, "%s = %s;" % (name, self.expression(typ, sec)[0]))
+    self.count += 1
+
+  def error(self, indent):
+    """ One statement the type checker must reject """
+    kind = self.rand.choice(["explicit", "implicit", "mismatch", "undeclared"])
+    if kind == "implicit":
+      # Assigns low from a high context
+      low = self.declare(indent, "int", LOW, "0")
+      secret = self.declare(indent, "int", HIGH, self.constant("int"))
+      self.emit(indent, "if %s > 0 {" % secret)
+      self.emit(indent + 1, "%s = 1;" % low)
+      self.emit(indent, "} else {")
+      self.emit(indent + 1, "skip;")
+      self.emit(indent, "}")
+    elif kind == "explicit":
+      low = self.declare(indent, "int", LOW, "0")
+      secret = self.declare(indent, "int", HIGH, self.constant("int"))
+      self.emit(indent, "%s = %s;" % (low, secret))
+    elif kind == "mismatch":
+      self.emit(indent, "int v%d = true;" % self.names)
+      self.names += 1
+    else:
+      self.emit(indent, "undeclared%d = 1;" % self.count)
+    self.count += 1
+
+  def block(self, indent, pc, depth):
+    """ Writes statements until the budget runs out or, for nested blocks,
+    a random point, and returns """
+    if depth > 0: self.scopes.append([])
+    while self.count < self.statements:
+      r = self.rand.random()
+      if depth < self.depth and r < 0.15:
+        self.conditional(indent, pc, depth + 1)
+      elif depth < self.depth and r < 0.25:
+        self.loop(indent, pc, depth + 1)
+      elif len(self.visible()) < self.nvars and r < 0.45:
+        typ = self.rand.choice(["int", "int", "double", "bool"])
+        sec = self.join(pc, self.pickLabel())
+        self.declare(indent, typ, sec, self.expression(typ, sec)[0])
+      else:
+        self.assignment(indent, pc)
+      if depth > 0 and self.rand.random() < 1.0 / (4 + 4 * (self.depth - depth)):
+        break
+    if depth > 0: self.scopes.pop()
+
+  def conditional(self, indent, pc, depth):
+    if not [v for v in self.visible() if v[1] != "bool"]:
+      self.declare(indent, "int", pc, self.constant("int"))
+    guard, sec = self.expression("bool", HIGH)
+    sec = self.join(pc, sec)
+    self.emit(indent, "if %s {" % guard)
+    self.count += 1
+    self.block(indent + 1, sec, depth)
+    self.emit(indent, "} else {")
+    self.block(indent + 1, sec, depth)
+    self.emit(indent, "}")
+
+  def loop(self, indent, pc, depth):
+    # Counters are never assigned elsewhere, so every loop ends
+    counter = "c%d" % self.names
+    self.names += 1
+    prefix = "" if pc == LOW else pc + " "
+    self.emit(indent, "%sint %s = 0;" % (prefix, counter))
+    self.scopes[-1].append((counter, "int", pc))
+    self.emit(indent, "while %s < %d {" % (counter, self.rand.randint(1, 3)))
+    self.count += 2
+    self.block(indent + 1, pc, depth)
+    self.emit(indent + 1, "%s = %s + 1;" % (counter, counter))
+    self.emit(indent, "}")
+
+  def nest(self, levels):
+    """ A chain of if and while statements nested levels deep, for
+    stressing traversals.  Written without recursion, unlike block, so
+    any depth works.  Each while body runs once.  Operands come from the
+    innermost few scopes and indentation stops growing, so the time and
+    the output stay linear in levels. """
+    self.declare(0, "int", LOW, "0")
+    stack = self.scopes
+    closers = []
+    for level in range(levels):
+      indent = min(level, NEST_INDENT)
+      self.scopes = stack[-NEST_WINDOW:]
+      pc = LOW if not closers else closers[-1][1]
+      if self.rand.random() < 0.5:
+        guard, sec = self.expression("bool", HIGH)
+        sec = self.join(pc, sec)
+        self.emit(indent, "if %s {" % guard)
+        closers.append(("} else {\n%sskip;\n%s}" % ("  " * (indent + 1), "  " * indent), sec))
+      else:
+        # Named like loop's counters, so assignments leave them alone
+        counter = "c%d" % self.names
+        self.names += 1
+        prefix = "" if pc == LOW else pc + " "
+        self.emit(indent, "%sint %s = 0;" % (prefix, counter))
+        self.scopes[-1].append((counter, "int", pc))
+        self.emit(indent, "while %s < 1 {" % counter)
+        closers.append(("  %s = %s + 1;\n%s}" % (counter, counter, "  " * indent), pc))
+      stack.append([])
+      self.scopes = stack[-NEST_WINDOW:]
+      self.declare(indent + 1, "int", closers[-1][1], self.expression("int", closers[-1][1])[0])
+    for level in range(levels - 1, -1, -1):
+      indent = min(level, NEST_INDENT)
+      self.scopes = stack[-NEST_WINDOW:]
+      self.assignment(indent + 1, closers[level][1])
+      stack.pop()
+      self.emit(indent, closers.pop()[0])
+    self.scopes = stack
+    return "\n".join(self.lines) + "\n"
+
+  def procedure(self, index):
+    """ A low procedure of two int parameters, with its share of the
+    statements, which may also assign the variables declared before it """
+    self.emit(0, "proc p%d(int a%d, int b%d) {" % (index, index, index))
+    self.scopes.append([("a%d" % index, "int", LOW), ("b%d" % index, "int", LOW)])
+    self.block(1, LOW, 0)
+    self.scopes.pop()
+    self.emit(0, "}")
+
+  def generate(self):
+    for label in self.labels:
+      self.emit(0, "label %s;" % label)
+    if self.procedures > 0:
+      # The statements are spread over the procedures, and main calls each
+      # once; the errors go between them
+      for i in range(GLOBALS):
+        self.declare(0, "int", LOW, self.constant("int"))
+      total = self.statements
+      for i in range(self.procedures):
+        self.statements = total * (i + 1) // self.procedures
+        self.procedure(i)
+        if i * self.errors // self.procedures != (i + 1) * self.errors // self.procedures:
+          self.error(0)
+      for i in range(self.procedures):
+        self.emit(0, "call p%d(%s, %s);" % (i, self.constant("int"), self.constant("int")))
+      return "\n".join(self.lines) + "\n"
+    # Spread the errors evenly through the program
+    total = self.statements
+    for i in range(self.errors + 1):
+      self.statements = total * (i + 1) // (self.errors + 1)
+      self.block(0, LOW, 0)
+      if i < self.errors:
+        self.error(0)
+    return "\n".join(self.lines) + "\n"
+
+def generate(seed=0, statements=1000, depth=4, nvars=50, nlabels=0, high=0.2, errors=0, nested=0, procedures=0):
+  generator = Generator(seed, statements, depth, nvars, nlabels, high, errors, procedures)
+  if nested > 0: return generator.nest(nested)
+  return generator.generate()
+
+def main(argv):
+  parser = argparse.ArgumentParser(description="Generates a random program.")
+  parser.add_argument("-s", "--seed", type=int, default=0)
+  parser.add_argument("-n", "--statements", type=int, default=1000)
+  parser.add_argument("-d", "--depth", type=int, default=4, help="deepest nesting of if and while")
+  parser.add_argument("-v", "--vars", type=int, default=50, help="most variables in scope at once")
+  parser.add_argument("-l", "--labels", type=int, default=0, help="labels declared besides low and high")
+  parser.add_argument("-H", "--high", type=float, default=0.2, help="share of variables declared high")
+  parser.add_argument("-e", "--errors", type=int, default=0, help="type errors to plant")
+  parser.add_argument("-N", "--nested", type=int, default=0, help="only write if and while statements nested this deep")
+  parser.add_argument("-p", "--procedures", type=int, default=0, help="spread the statements over this many procedures")
+  parser.add_argument("-o", "--output", default=None)
+  args = parser.parse_args(argv[1:])
+  text = generate(args.seed, args.statements, args.depth, args.vars, args.labels, args.high, args.errors, args.nested, args.procedures)
+  if args.output is None:
+    sys.stdout.write(text)
+  else:
+    with open(args.output, "w") as out:
+      out.write(text)
+  return 0
+
+if __name__ == "__main__":
+  sys.exit(main(sys.argv))
@@ -0,0 +1,120 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __INTERN_H_
+#define __INTERN_H_
+#include <stdint.h>
+#include <string.h>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Keeps one copy of every identifier, type name and security label seen by
+// the lexer.  Each distinct string is handed out as a small integer id, with
+// id 0 reserved for the empty string.  There is one interner per process,
+// shared by all compilations, so every access takes the lock.
+class Interner {
+private:
+  std::mutex lock;
+  std::deque<std::string> strings; // deque keeps references stable
+  std::vector<uint32_t> buckets;   // open addressing, holds id + 1 or 0
+  size_t bytes = 0;
+
+  static uint32_t hash(const char* s, size_t len) {
+    uint32_t h = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+      h ^= (unsigned char) s[i];
+      h *= 16777619u;
+    }
+    return h;
+  }
+  void grow() {
+    std::vector<uint32_t> old;
+    old.swap(buckets);
+    buckets.assign(old.empty() ? 256 : old.size() * 2, 0);
+    for (std::vector<uint32_t>::iterator it = old.begin(); it != old.end(); ++it) {
+      if (*it == 0) continue;
+      const std::string& str = strings[*it - 1];
+      size_t mask = buckets.size() - 1;
+      size_t i = hash(str.data(), str.size()) & mask;
+      while (buckets[i] != 0) i = (i + 1) & mask;
+      buckets[i] = *it;
+    }
+  }
+
+public:
+  Interner() { insert("", 0); }
+  static Interner& get() {
+    static Interner instance;
+    return instance;
+  }
+  uint32_t intern(const char* s, size_t len) {
+    std::lock_guard<std::mutex> guard(lock);
+    return insert(s, len);
+  }
+  const std::string& lookup(uint32_t id) {
+    std::lock_guard<std::mutex> guard(lock);
+    return strings[id];
+  }
+  size_t size() {
+    std::lock_guard<std::mutex> guard(lock);
+    return strings.size();
+  }
+  size_t getBytes() {
+    std::lock_guard<std::mutex> guard(lock);
+    return bytes;
+  }
+
+private:
+  uint32_t insert(const char* s, size_t len) {
+    if ((strings.size() + 1) * 2 > buckets.size()) grow();
+    size_t mask = buckets.size() - 1;
+    size_t i = hash(s, len) & mask;
+    while (buckets[i] != 0) {
+      const std::string& str = strings[buckets[i] - 1];
+      if (str.size() == len && memcmp(str.data(), s, len) == 0) return buckets[i] - 1;
+      i = (i + 1) & mask;
+    }
+    strings.push_back(std::string(s, len));
+    bytes += len;
+    buckets[i] = strings.size();
+    return strings.size() - 1;
+  }
+};
+
+// Handle to an interned string.  Copies, comparisons and map keys all work
+// on the id, never on the characters.
+class Name {
+private:
+  uint32_t id;
+
+public:
+  Name() : id(0) { }
+  explicit Name(uint32_t id) : id(id) { }
+  explicit Name(const std::string& s) : id(Interner::get().intern(s.data(), s.size())) { }
+  uint32_t getId() const { return id; }
+  bool empty() const { return id == 0; }
+  const std::string& str() const { return Interner::get().lookup(id); }
+  bool operator==(const Name& other) const { return id == other.id; }
+  bool operator!=(const Name& other) const { return id != other.id; }
+  bool operator<(const Name& other) const { return id < other.id; }
+};
+#endif // __INTERN_H_
@@ -0,0 +1,137 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __LATTICE_H_
+#define __LATTICE_H_
+#include "intern.h"
+#include <stdint.h>
+#include <bitset>
+#include <string>
+#include <vector>
+
+typedef uint16_t Label;
+
+// Security lattice.  "low" is the bottom and "high" the top element, and
+// programs may declare more labels in between:
+//
+//   label alice;                // low < alice < high
+//   label staff < alice, bob;   // staff flows to alice and to bob
+//
+// A label can only be declared below labels that already exist, so the
+// order is built up incrementally.  Every label keeps the set of labels it
+// flows to as a bitset, which makes flowsTo a single bit test.  Joins are
+// precomputed into a table by seal(), once all labels are known.
+class Lattice {
+public:
+  enum {
+    BOTTOM = 0,
+    TOP = 1,
+    MAX_LABELS = 256,
+  };
+
+private:
+  std::vector<Name> names;
+  std::vector<int> labels; // Indexed by name id, -1 if not a label
+  std::vector<std::bitset<MAX_LABELS> > up;
+  std::vector<Label> joins;
+
+  void add(Name name) {
+    uint32_t id = name.getId();
+    if (id >= labels.size()) labels.resize(id + 1, -1);
+    labels[id] = names.size();
+    names.push_back(name);
+    up.push_back(std::bitset<MAX_LABELS>());
+    up.back().set(labels[id]);
+    up.back().set(TOP);
+    up[BOTTOM].set(labels[id]);
+  }
+
+public:
+  Lattice() {
+    add(Name("low"));
+    add(Name("high"));
+  }
+  // Declares name as flowing to each label in below_of (and to high)
+  bool declare(Name name, const std::vector<Name>& below_of, std::string& err) {
+    if (lookUp(name) >= 0) {
+      err = "Label redeclaration " + name.str();
+      return false;
+    }
+    if (names.size() >= MAX_LABELS) {
+      err = "Too many security labels";
+      return false;
+    }
+    for (std::vector<Name>::const_iterator it = below_of.begin(); it != below_of.end(); ++it) {
+      if (lookUp(*it) < 0) {
+        err = "Undeclared label " + it->str();
+        return false;
+      }
+    }
+    add(name);
+    Label label = names.size() - 1;
+    for (std::vector<Name>::const_iterator it = below_of.begin(); it != below_of.end(); ++it) {
+      up[label] |= up[lookUp(*it)];
+    }
+    joins.clear();
+    return true;
+  }
+  // Precomputes the join table, fails if two labels have no least upper bound
+  bool seal(std::string& err) {
+    size_t n = names.size();
+    joins.assign(n * n, BOTTOM);
+    for (size_t a = 0; a < n; a++) {
+      for (size_t b = a; b < n; b++) {
+        // The join is the upper bound whose own up-set is exactly the
+        // common upper bounds of a and b
+        std::bitset<MAX_LABELS> common = up[a] & up[b];
+        size_t count = common.count();
+        int lub = -1;
+        for (size_t c = 0; c < n; c++) {
+          if (common.test(c) && up[c].count() == count) {
+            lub = c;
+            break;
+          }
+        }
+        if (lub < 0) {
+          err = "Labels " + names[a].str() + " and " + names[b].str() + " have no least upper bound";
+          joins.clear();
+          return false;
+        }
+        joins[a * n + b] = lub;
+        joins[b * n + a] = lub;
+      }
+    }
+    return true;
+  }
+  bool isSealed() { return joins.size() == names.size() * names.size(); }
+  // Returns the label named name, or -1 if there is none
+  int lookUp(Name name) {
+    uint32_t id = name.getId();
+    if (id >= labels.size()) return -1;
+    return labels[id];
+  }
+  // True for labels declared by the program, which the lexer returns as T_SEC
+  bool isUserLabel(Name name) { return lookUp(name) > TOP; }
+  bool flowsTo(Label from, Label to) { return up[from].test(to); }
+  Label join(Label a, Label b) { return joins[a * names.size() + b]; }
+  Name getName(Label label) { return names[label]; }
+  size_t size() { return names.size(); }
+};
+#endif // __LATTICE_H_
@@ -0,0 +1,239 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#include "lexer.h"
+#include "node.h"
+#include "parserState.h"
+#include "parser.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static inline bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\n'; }
+static inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+static inline bool isIdentStart(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+static inline bool isIdentChar(char c) { return isIdentStart(c) || isDigit(c); }
+
+/* Skips blanks and comments, counting newlines.  A comment only ends at a
+ * newline, as in tokens.l; "//" at the very end of the input is two
+ * divisions. */
+void Lexer::skipBlanks()
+{
+  for (;;) {
+#if defined(__SSE2__)
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (pos + 16 <= size) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(data + pos));
+      __m128i nl = _mm_cmpeq_epi8(v, newline);
+      unsigned blank = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space),
+                                                                   _mm_cmpeq_epi8(v, tab)), nl));
+      unsigned lines = _mm_movemask_epi8(nl);
+      if (blank == 0xFFFF) {
+        line += __builtin_popcount(lines);
+        pos += 16;
+        continue;
+      }
+      unsigned n = __builtin_ctz(~blank);
+      line += __builtin_popcount(lines & ((1u << n) - 1));
+      pos += n;
+      break;
+    }
+#endif
+    while (pos < size && isBlank(data[pos])) {
+      if (data[pos] == '\n') line++;
+      pos++;
+    }
+    if (pos + 1 < size && data[pos] == '/' && data[pos + 1] == '/') {
+      // memchr is vectorized by the C library
+      const char* end = (const char*) memchr(data + pos + 2, '\n', size - pos - 2);
+      if (end == NULL) return;
+      pos = end - data + 1;
+      line++;
+      continue;
+    }
+    return;
+  }
+}
+
+/* End of the identifier characters starting at from */
+size_t Lexer::identifierEnd(size_t from) const
+{
+  size_t i = from;
+#if defined(__SSE2__)
+  // Signed compares are fine, bytes above 127 are negative and never match
+  const __m128i lowerA = _mm_set1_epi8('a' - 1), lowerZ = _mm_set1_epi8('z' + 1);
+  const __m128i digit0 = _mm_set1_epi8('0' - 1), digit9 = _mm_set1_epi8('9' + 1);
+  const __m128i caseBit = _mm_set1_epi8(0x20), underscore = _mm_set1_epi8('_');
+  while (i + 16 <= size) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+    __m128i lower = _mm_or_si128(v, caseBit);
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, lowerA), _mm_cmplt_epi8(lower, lowerZ));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, digit0), _mm_cmplt_epi8(v, digit9));
+    __m128i ident = _mm_or_si128(_mm_or_si128(alpha, digit), _mm_cmpeq_epi8(v, underscore));
+    unsigned mask = _mm_movemask_epi8(ident);
+    if (mask != 0xFFFF) return i + __builtin_ctz(~mask);
+    i += 16;
+  }
+#endif
+  while (i < size && isIdentChar(data[i])) i++;
+  return i;
+}
+
+uint32_t Lexer::intern(const char* s, size_t len)
+{
+  uint32_t h = 2166136261u; // FNV-1a
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char) s[i];
+    h *= 16777619u;
+  }
+  CachedName& cached = names[h & (NAME_CACHE_SIZE - 1)];
+  if (cached.length == len && memcmp(cached.text, s, len) == 0) return cached.id;
+  cached.text = s;
+  cached.length = len;
+  cached.id = Interner::get().intern(s, len);
+  return cached.id;
+}
+
+/* Token of a reserved word, or 0 */
+int Lexer::keyword(const char* s, size_t len) const
+{
+  switch (len) {
+    case 2:
+      if (memcmp(s, "if", 2) == 0) return TIF;
+      break;
+    case 3:
+      if (memcmp(s, "int", 3) == 0) return T_TYPE;
+      break;
+    case 4:
+      if (memcmp(s, "bool", 4) == 0) return T_TYPE;
+      if (memcmp(s, "true", 4) == 0) return T_VAL_BOOL;
+      if (memcmp(s, "high", 4) == 0) return T_SEC;
+      if (memcmp(s, "skip", 4) == 0) return TSKIP;
+      if (memcmp(s, "else", 4) == 0) return TELSE;
+      if (memcmp(s, "proc", 4) == 0) return TPROC;
+      if (memcmp(s, "call", 4) == 0) return TCALL;
+      break;
+    case 5:
+      if (memcmp(s, "false", 5) == 0) return T_VAL_BOOL;
+      if (memcmp(s, "while", 5) == 0) return TWHILE;
+      if (memcmp(s, "label", 5) == 0) return TLABEL;
+      break;
+    case 6:
+      if (memcmp(s, "double", 6) == 0) return T_TYPE;
+      break;
+  }
+  return 0;
+}
+
+/* Returns the next token.  An unknown character ends the input, like the
+ * catch-all rule of tokens.l, and is returned with kind -1. */
+Lexer::Token Lexer::scan()
+{
+  skipBlanks();
+  Token token;
+  token.offset = pos;
+  if (pos >= size) return token;
+  const char c = data[pos];
+  char n = pos + 1 < size ? data[pos + 1] : '\0';
+  if (isIdentStart(c)) {
+    pos = identifierEnd(pos + 1);
+    token.length = pos - token.offset;
+    token.kind = keyword(data + token.offset, token.length);
+    if (token.kind == 0 || token.kind == T_TYPE || token.kind == T_SEC) {
+      token.name = intern(data + token.offset, token.length);
+    }
+    if (token.kind == 0) {
+      // Labels declared by the program act as keywords
+      token.kind = lattice->isUserLabel(Name(token.name)) ? T_SEC : T_IDENTIFIER;
+    }
+    return token;
+  }
+  if (isDigit(c)) {
+    while (pos < size && isDigit(data[pos])) pos++;
+    token.kind = T_VAL_INTEGER;
+    if (pos < size && data[pos] == '.') {
+      pos++;
+      while (pos < size && isDigit(data[pos])) pos++;
+      token.kind = T_VAL_DOUBLE;
+    }
+    token.length = pos - token.offset;
+    return token;
+  }
+  token.length = 1;
+  switch (c) {
+    case '=': if (n == '=') { token.kind = TCEQ; token.length = 2; } else token.kind = TEQUAL; break;
+    case '<': if (n == '=') { token.kind = TCLE; token.length = 2; } else token.kind = TCLT; break;
+    case '>': if (n == '=') { token.kind = TCGE; token.length = 2; } else token.kind = TCGT; break;
+    case '!': if (n == '=') { token.kind = TCNE; token.length = 2; } else token.kind = -1; break;
+    case '(': token.kind = TLPAREN; break;
+    case ')': token.kind = TRPAREN; break;
+    case '{': token.kind = TLBRACE; break;
+    case '}': token.kind = TRBRACE; break;
+    case '[': token.kind = TLBRACKET; break;
+    case ']': token.kind = TRBRACKET; break;
+    case '.': token.kind = TDOT; break;
+    case ',': token.kind = TCOMMA; break;
+    case '+': token.kind = TPLUS; break;
+    case '-': token.kind = TMINUS; break;
+    case '*': token.kind = TMUL; break;
+    case '/': token.kind = TDIV; break;
+    case ';': token.kind = TSC; break;
+    default: token.kind = -1; break;
+  }
+  if (token.kind == -1) {
+    pos = size;
+    return token;
+  }
+  pos += token.length;
+  return token;
+}
+
+int Lexer::next(YYSTYPE* lval)
+{
+  Token token = scan();
+  last = token;
+  const char* text = data + token.offset;
+  switch (token.kind) {
+    case -1:
+      printf("Unknown token!\n");
+      return 0;
+    case T_TYPE:
+    case T_SEC:
+    case T_IDENTIFIER:
+      lval->name = token.name;
+      break;
+    case T_VAL_INTEGER:
+    case T_VAL_DOUBLE:
+    case T_VAL_BOOL:
+      lval->string = new std::string(text, token.length);
+      break;
+    default:
+      lval->token = token.kind;
+      break;
+  }
+  return token.kind;
+}
@@ -0,0 +1,81 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __LEXER_H_
+#define __LEXER_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "lattice.h"
+
+union YYSTYPE;
+
+// Hand-written scanner, an alternative to the flex one in tokens.l that
+// yields exactly the same tokens.  It works in place on a buffer that must
+// outlive it, usually a MappedFile, and hands out tokens as spans into that
+// buffer; only literals are copied, because the grammar wants strings.
+// Runs of blanks, comments and identifiers are scanned 16 bytes at a time
+// where SSE2 is available.
+class Lexer {
+public:
+  class Token {
+  public:
+    int kind = 0;       // Parser token number, 0 at the end of the input
+    size_t offset = 0;  // Span of the token in the buffer
+    size_t length = 0;
+    uint32_t name = 0;  // Interned text of types, labels and identifiers
+  };
+
+private:
+  // Names this lexer already interned, so that repeated identifiers skip
+  // the interner and its lock.  Entries point into the buffer.
+  class CachedName {
+  public:
+    const char* text = NULL;
+    size_t length = 0;
+    uint32_t id = 0;
+  };
+  static const size_t NAME_CACHE_SIZE = 4096;
+
+  const char* data;
+  size_t size;
+  size_t pos = 0;
+  int line = 1;
+  Token last;           // Most recent token, for error messages
+  Lattice* lattice;     // Tells declared labels from identifiers
+  std::vector<CachedName> names;
+
+  void skipBlanks();
+  size_t identifierEnd(size_t from) const;
+  int keyword(const char* s, size_t len) const;
+  uint32_t intern(const char* s, size_t len);
+
+public:
+  Lexer(const char* data, size_t size, Lattice* lattice)
+    : data(data), size(size), lattice(lattice), names(NAME_CACHE_SIZE) { }
+  // Next token, without filling in a semantic value
+  Token scan();
+  // Next token for the bison parser, as yylex would return it
+  int next(YYSTYPE* lval);
+  // Same as yylineno: one plus the newlines up to the end of the last token
+  int getLine() const { return line; };
+  const Token& getLastToken() const { return last; };
+};
+#endif // __LEXER_H_
@@ -0,0 +1,89 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __LINE_INDEX_H_
+#define __LINE_INDEX_H_
+#include <stddef.h>
+#include <string.h>
+#include <algorithm>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Finds source lines for diagnostics without copying the source.  The
+// offsets of line starts are only collected the first time a line is
+// asked for, so compilations without errors never pay for it.  After that
+// a line is found in constant time and an offset in logarithmic time.  The
+// buffer is not owned and must outlive the index.
+class LineIndex {
+private:
+  const char* data = NULL;
+  size_t size = 0;
+  std::vector<size_t> starts;   // Offset of each line, empty until needed
+
+  void build() {
+    starts.push_back(0);
+    const char* end = data + size;
+    // memchr is vectorized by the C library
+    for (const char* p = data; (p = (const char*) memchr(p, '\n', end - p)) != NULL; ) {
+      starts.push_back(++p - data);
+    }
+  }
+
+public:
+  LineIndex() { }
+  LineIndex(const char* data, size_t size) : data(data), size(size) { }
+  const char* getData() const { return data; };
+  size_t getSize() const { return size; };
+  size_t lineCount() {
+    if (starts.empty()) build();
+    return starts.size();
+  }
+  // Text of line lineno, counting from 1, without its newline.  Lines out
+  // of range are empty.
+  std::string line(int lineno) {
+    if (lineno < 1 || (size_t) lineno > lineCount()) return std::string();
+    size_t begin = starts[lineno - 1];
+    size_t end = (size_t) lineno < starts.size() ? starts[lineno] - 1 : size;
+    return std::string(data + begin, end - begin);
+  }
+  // Line and column, both from 1, of a byte offset into the buffer
+  void locate(size_t offset, int& lineno, int& column) {
+    if (starts.empty()) build();
+    size_t index = std::upper_bound(starts.begin(), starts.end(), offset) - starts.begin();
+    lineno = index;
+    column = offset - starts[index - 1] + 1;
+  }
+  // Prints the line, and under it a marker from column for length
+  // characters when column is known
+  void print(std::ostream& out, int lineno, int column = 0, size_t length = 1) {
+    std::string text = line(lineno);
+    out << text << std::endl;
+    if (column < 1) return;
+    std::string marker;
+    for (int i = 1; i < column && (size_t) i <= text.size(); i++) {
+      marker += text[i - 1] == '\t' ? '\t' : ' ';
+    }
+    marker += '^';
+    if (length > 1) marker += std::string(length - 1, '~');
+    out << marker << std::endl;
+  }
+};
+#endif // __LINE_INDEX_H_
@@ -19,32 +19,110 @@
 // IN THE SOFTWARE.
 //
 #include <iostream>
-#include <stdio.h> // fopen
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
 #include <unistd.h> // getopt
+#include <getopt.h> // getopt_long_only
 #include <libgen.h> // basename
-#include "node.h"
-#include "visitor.h"
-#include "typecheckVis.h"
-#include "codegenVis.h"
+#include <string.h>
+#include <sys/stat.h>
+#include "compiler.h"
+#include "batch.h"
+#include "codeCache.h"
+#include "checkCache.h"
+#include "mappedFile.h"
+#include <chrono>
+#include <memory>
+#include <thread>
 
 #define DEBUG 0
 #define DPRNT(fmt, ...) do { if (DEBUG) fprintf(stderr, fmt, __VA_ARGS__); } while (0)
 
 using namespace std;
 
-extern int yyparse();
-extern FILE* yyin;
-extern NBlock* programBlock;
+void printCacheStats(CodeCache* cache) {
+    printf("Cache: %u hits, %u misses, %u evicted\n",
+           cache->getHits(), cache->getMisses(), cache->getEvictions());
+}
+
+/* Checks and compiles the file again every time it is saved, without
+ * running it.  Blocks that did not change, and whose surroundings did not
+ * either, keep their earlier verdict instead of being checked again; with
+ * a cache, a program compiled before is loaded instead of generated.  Runs
+ * until interrupted. */
+int watch(CompileOptions options, char* filename) {
+    CheckCache memo;
+    options.memo = &memo;
+    struct stat last;
+    memset(&last, 0, sizeof(last));
+    for (;;) {
+      struct stat st;
+      if (stat(filename, &st) != 0 ||
+          (st.st_mtime == last.st_mtime && st.st_size == last.st_size && st.st_ino == last.st_ino)) {
+        usleep(100000);
+        continue;
+      }
+      last = st;
+      std::ifstream input(filename);
+      if (!input) continue;
+      std::stringstream buffer;
+      buffer << input.rdbuf();
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      unsigned hits = options.cache != NULL ? options.cache->getHits() : 0;
+      Compilation compilation(options);
+      Compilation::Status status = compilation.compile(buffer.str());
+      // The JIT only makes native code when asked for it, as by running
+      if (status == Compilation::OK && options.geningcode && !options.bytecode &&
+          options.native == NULL && compilation.getEntryPoint() == NULL) {
+        status = Compilation::EMIT_ERROR;
+      }
+      double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+      if (options.cache != NULL && options.cache->getHits() > hits) {
+        printf("%s: passed in %.1f ms, reused the cached code\n", filename, ms);
+      } else {
+        int reused = compilation.getBlocksReused();
+        printf("%s: %s in %.1f ms, reused the type checks of %d of %d blocks\n", filename,
+               status == Compilation::OK ? "passed" : "failed", ms,
+               reused, reused + compilation.getBlocksChecked());
+      }
+      compilation.getTimings().print(stderr, filename, options.timing);
+      fflush(stdout);
+    }
+    return 0;
+}
 
 void usage(int argc, char** argv) {
     printf("%s:\n", basename(argv[0]));
     printf("  A compiler for the command language.\n");
+    printf("  Usage: %s [options] [-f fname]\n", basename(argv[0]));
+    printf("         %s [options] [-b manifest] [fname ...]\n", basename(argv[0]));
+    printf("    -b [fname] : Batch mode, compile every file listed in the manifest.\n");
+    printf("    -c [dir]   : Cache native code in dir, reused by later runs of the same program.\n");
+    printf("    -C         : Empty the cache given with -c first.\n");
+    printf("    -D         : Track labels at run time, stopping at the first flow that breaks the policy,\n");
+    printf("                 instead of rejecting the flows the type checker cannot prove safe.\n");
+    printf("    -E [ll,s]  : With -o, also write the IR (ll) and/or the assembly (s) next to it.\n");
+    printf("    -F         : Flatten the AST into arrays once parsed, and run the passes over those.\n");
     printf("    -f [fname] : Input file.\n");
     printf("    -g [0,1]   : Turn code generation off (0) or on (1). Defaults to on.\n");
     printf("    -h         : Print usage.\n");
+    printf("    -j [n]     : Threads used in batch mode, or to optimize and compile the procedures\n");
+    printf("                 of a single program. Defaults to one per core.\n");
+    printf("    -l [lexer] : Scan with the flex scanner (flex) or the hand-written one (fast). Defaults to flex.\n");
+    printf("    -march [arch]: Architecture of the code written with -o, as in llc. Defaults to the host's.\n");
+    printf("    -mcpu [cpu]: CPU of the code written with -o, as in llc. Defaults to the host's (native).\n");
+    printf("    -o [fname] : Write an object file (fname.o) or an executable instead of running.\n");
+    printf("    -O [0-3]   : Optimization level. Defaults to 0.\n");
     printf("    -r [0,1]   : Turn running of the compiled code off (0) or on (1). Defaults to on.\n");
+    printf("    -S         : Stream, check and compile each top-level statement as soon as it is parsed.\n");
+    printf("    -s [0,1]   : Turn constant folding and dead branch pruning off (0) or on (1). Defaults to on.\n");
     printf("    -t [0,1]   : Turn type checking off (0) or on (1). Defaults to on.\n");
+    printf("    -T [fmt]   : Print the time spent in each phase to stderr, as a table or as json lines.\n");
     printf("    -v [0,1]   : Turn verbosity off (0) or on (1). Defaults to off.\n");
+    printf("    -w         : Watch the input file and check and compile it again on every change, reusing the\n");
+    printf("                 type checks of unchanged blocks. Code is generated for the whole program again.\n");
+    printf("    -x [jit,vm]: Run on the LLVM JIT or on the bytecode VM, which starts faster. Defaults to jit.\n");
 }
 
 int main(int argc, char **argv)
@@ -53,15 +131,96 @@ int main(int argc, char **argv)
     bool geningcode = true;
     bool verbose = false;
     bool running = true;
+    unsigned optLevel = 0;
     char* filename = NULL;
+    char* manifest = NULL;
+    char* cacheDir = NULL;
+    bool clearing = false;
+    bool bytecode = false;
+    bool simplifying = true;
+    bool watching = false;
+    bool handLexer = false;
+    bool streaming = false;
+    bool flattening = false;
+    bool tracking = false;
+    char* native = NULL;
+    unsigned listings = 0;
+    char* arch = NULL;
+    char* cpu = NULL;
+    Timings::Format timing = Timings::OFF;
+    unsigned jobs = std::thread::hardware_concurrency();
+    enum { OPT_MARCH = 256, OPT_MCPU };
+    static const struct option longOptions[] = {
+      { "march", required_argument, NULL, OPT_MARCH },
+      { "mcpu", required_argument, NULL, OPT_MCPU },
+      { NULL, 0, NULL, 0 },
+    };
     int c;
     opterr = 0;
-    while ((c = getopt (argc, argv, "f:g:hr:t:v:")) != -1)
+    while ((c = getopt_long_only (argc, argv, "b:c:CDE:Ff:g:hj:l:o:O:r:Ss:t:T:v:wx:", longOptions, NULL)) != -1)
        switch (c)
        {
+       case OPT_MARCH:
+         arch = optarg;
+         break;
+       case OPT_MCPU:
+         cpu = optarg;
+         break;
+       case 'E':
+         for (char* kind = strtok(optarg, ","); kind != NULL; kind = strtok(NULL, ",")) {
+           if (strcmp(kind, "ll")==0) {
+             listings |= CodeGenVisitor::LIST_IR;
+           } else if (strcmp(kind, "s")==0) {
+             listings |= CodeGenVisitor::LIST_ASSEMBLY;
+           } else {
+             fprintf(stderr, "ERR: Options to -E are ll, s or both, separated by a comma\n" );
+             return 1;
+           }
+         }
+         break;
+       case 'o':
+         native = optarg;
+         break;
+       case 'b':
+         manifest = optarg;
+         break;
+       case 'c':
+         cacheDir = optarg;
+         break;
+       case 'C':
+         clearing = true;
+         break;
+       case 'D':
+         tracking = true;
+         break;
        case 'f':
          filename = optarg;
          break;
+       case 'j':
+         jobs = atoi(optarg);
+         if (jobs == 0) {
+           fprintf(stderr, "ERR: Option to -j must be a positive number of threads\n" );
+           return 1;
+         }
+         break;
+       case 'l':
+         if (strcmp(optarg, "flex")==0) {
+           handLexer = false;
+         } else if (strcmp(optarg, "fast")==0) {
+           handLexer = true;
+         } else {
+           fprintf(stderr, "ERR: Options to -l are either flex or fast\n" );
+           return 1;
+         }
+         break;
+       case 'O':
+         if (optarg[0] >= '0' && optarg[0] <= '3' && optarg[1] == '\0') {
+           optLevel = optarg[0] - '0';
+         } else {
+           fprintf(stderr, "ERR: Options to -O are 0, 1, 2 or 3\n" );
+           return 1;
+         }
+         break;
        case 'g':
          if (strncmp(optarg, "0", 1)==0) {
            geningcode = false;
@@ -82,6 +241,22 @@ int main(int argc, char **argv)
            return 1;
          }
          break;
+       case 'S':
+         streaming = true;
+         break;
+       case 'F':
+         flattening = true;
+         break;
+       case 's':
+         if (strncmp(optarg, "0", 1)==0) {
+           simplifying = false;
+         } else if (strncmp(optarg, "1", 1)==0) {
+           simplifying = true;
+         } else {
+           fprintf(stderr, "ERR: Options to -s are either 0 for no simplification or 1 for simplification\n" );
+           return 1;
+         }
+         break;
        case 't':
          if (strncmp(optarg, "0", 1)==0) {
            typechecking = false;
@@ -92,6 +267,16 @@ int main(int argc, char **argv)
            return 1;
          }
          break;
+       case 'T':
+         if (strcmp(optarg, "table")==0) {
+           timing = Timings::TABLE;
+         } else if (strcmp(optarg, "json")==0) {
+           timing = Timings::JSON;
+         } else {
+           fprintf(stderr, "ERR: Options to -T are either table or json\n" );
+           return 1;
+         }
+         break;
        case 'h':
          usage(argc, argv);
          return 1;
@@ -105,48 +290,130 @@ int main(int argc, char **argv)
            return 1;
          }
          break;
+       case 'w':
+         watching = true;
+         break;
+       case 'x':
+         if (strcmp(optarg, "jit")==0) {
+           bytecode = false;
+         } else if (strcmp(optarg, "vm")==0) {
+           bytecode = true;
+         } else {
+           fprintf(stderr, "ERR: Options to -x are either jit or vm\n" );
+           return 1;
+         }
+         break;
        default:
          fprintf(stderr, "Invalid command line options\n\n" );
          usage(argc, argv);
          return 1;
        }
-    if (filename != NULL) {
-      FILE* fhandle = fopen(filename, "r");
-      if (fhandle == NULL) {
-        fprintf(stderr, "ERR: Could not open file %s\n", filename);
+    if (native != NULL) {
+      // The program is written out to be run later, maybe on another machine
+      running = false;
+      geningcode = true;
+      if (bytecode || manifest != NULL || optind < argc) {
+        fprintf(stderr, "ERR: -o writes one program compiled by LLVM, not with -x vm or batch mode\n");
         return 1;
       }
-      DPRNT( "%s\n", filename);
-      yyin = fhandle;
+    } else if (listings != 0 || arch != NULL || cpu != NULL) {
+      fprintf(stderr, "ERR: -E, -march and -mcpu only apply to code written with -o\n");
+      return 1;
     }
     if (running) {
       geningcode = true; // Running forces code generation
     }
-    if (int ret = yyparse()) return ret;
-    DPRNT("programBlock: %p\n", programBlock);
-    if (typechecking) {
-      TypeCheckerVisitor typeCheckVis;
-      typeCheckVis.setVerbose(verbose);
-      if (filename != NULL) typeCheckVis.setFileName(filename); // For printing error messages
-      programBlock->accept(typeCheckVis);
-      if (!typeCheckVis.getPassed()) {
-        printf("Type checker failed\n");
+    CompileOptions options;
+    options.typechecking = typechecking;
+    options.geningcode = geningcode;
+    options.verbose = verbose;
+    options.optLevel = optLevel;
+    options.bytecode = bytecode;
+    options.simplifying = simplifying;
+    options.timing = timing;
+    options.handLexer = handLexer;
+    options.streaming = streaming;
+    options.flattening = flattening;
+    options.tracking = tracking;
+    options.native = native;
+    options.listings = listings;
+    options.arch = arch;
+    options.cpu = cpu;
+    if (streaming && (bytecode || watching)) {
+      // The VM sizes its registers from the slot count of the whole program,
+      // and watch mode reuses type checks of blocks kept from the last run
+      fprintf(stderr, "ERR: Streaming with -S does not combine with -x vm or -w\n");
+      return 1;
+    }
+    if (tracking && (bytecode || streaming || watching)) {
+      // Only the LLVM code generator emits the checks, and it needs the
+      // whole program to decide which variables to track
+      fprintf(stderr, "ERR: Tracking with -D does not combine with -x vm, -S or -w\n");
+      return 1;
+    }
+    std::unique_ptr<CodeCache> cache;
+    if (cacheDir != NULL) {
+      cache.reset(new CodeCache(cacheDir));
+      if (!cache->open()) {
+        fprintf(stderr, "ERR: Could not create cache directory %s\n", cacheDir);
+        return 1;
+      }
+      if (clearing) cache->clear();
+      // Only native code is cached, so it is of no use without running,
+      // except to watch mode, which compiles without running
+      if (running || watching) options.cache = cache.get();
+    }
+    if (watching) {
+      if (filename == NULL) {
+        fprintf(stderr, "ERR: Watch mode needs an input file given with -f\n");
         return 1;
-      } else {
-        if (verbose) printf("Type-checking passed\n");
       }
+      // Errors quote the file's lines, and name it
+      options.filename = filename;
+      return watch(options, filename);
+    }
+    if (manifest != NULL || optind < argc) {
+      BatchCompiler batch(options, running, jobs);
+      if (manifest != NULL && !batch.addManifest(manifest)) return 1;
+      for (int i = optind; i < argc; i++) batch.add(argv[i]);
+      if (filename != NULL) batch.add(filename);
+      int failed = batch.run();
+      if (verbose && cache) printCacheStats(cache.get());
+      return failed == 0 ? 0 : 1;
+    }
+    // Batch mode already keeps every core busy with a file each
+    options.threads = jobs;
+    MappedFile input;
+    std::string source;
+    if (filename != NULL) {
+      if (!input.open(filename)) {
+        fprintf(stderr, "ERR: Could not open file %s\n", filename);
+        return 1;
+      }
+      DPRNT( "%s\n", filename);
+    } else {
+      std::stringstream buffer;
+      buffer << std::cin.rdbuf();
+      source = buffer.str();
     }
-    if (geningcode) {
-      CodeGenVisitor codeGenVis;
-      codeGenVis.init();
-      if (filename != NULL) codeGenVis.setFileName("tmp.bc");
-      codeGenVis.setVerbose(verbose);
-      programBlock->accept(codeGenVis);
-      codeGenVis.generateCode();
-      if (running) {
-        codeGenVis.runCode();
+    options.filename = filename;
+    if (filename != NULL && native == NULL) options.output = "tmp.bc";
+    Compilation compilation(options);
+    Compilation::Status status = filename != NULL ?
+        compilation.compile(input.data(), input.size()) : compilation.compile(source);
+    if (status == Compilation::TYPE_ERROR) printf("Type checker failed\n");
+    bool violated = false;
+    if (status == Compilation::OK && running) {
+      DPRNT("programBlock: %p\n", compilation.getProgram());
+      int line = compilation.run();
+      if (line > 0) {
+        fprintf(stderr, "ERR: %s line %d: %s\n", filename != NULL ? filename : "-", line, compilation.getFailure());
+        violated = true;
       }
     }
+    compilation.getTimings().print(stderr, filename != NULL ? filename : "-", timing);
+    if (status != Compilation::OK || violated) return 1;
+    if (verbose && cache) printCacheStats(cache.get());
     
     return 0;
 }
@@ -0,0 +1,75 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __MAPPED_FILE_H_
+#define __MAPPED_FILE_H_
+#include <fcntl.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+// Read-only view of a whole input file.  Regular files are mapped, so the
+// source is never copied; anything that cannot be mapped, like a pipe, is
+// read into memory instead.
+class MappedFile {
+private:
+  const char* mapping = NULL;
+  size_t length = 0;
+  std::string buffer;   // Used when the file could not be mapped
+
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+
+public:
+  MappedFile() { }
+  ~MappedFile() {
+    if (mapping != NULL) munmap((void*) mapping, length);
+  }
+  // Returns false if the file could not be read
+  bool open(const char* filename) {
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr != MAP_FAILED) {
+        madvise(addr, st.st_size, MADV_SEQUENTIAL);
+        mapping = (const char*) addr;
+        length = st.st_size;
+        close(fd);
+        return true;
+      }
+    }
+    close(fd);
+    std::ifstream input(filename);
+    if (!input) return false;
+    std::stringstream contents;
+    contents << input.rdbuf();
+    buffer = contents.str();
+    return true;
+  }
+  const char* data() const { return mapping != NULL ? mapping : buffer.data(); };
+  size_t size() const { return mapping != NULL ? length : buffer.size(); };
+};
+#endif // __MAPPED_FILE_H_
@@ -20,8 +20,10 @@
 //
 #ifndef __NODE_H_
 #define __NODE_H_
+#include "intern.h"
 #include "scope.h"
 #include "visitor.h"
+#include <deque>
 #include <iostream>
 #include <vector>
 #include <llvm/IR/Value.h>
@@ -36,80 +38,104 @@ typedef std::vector<NExpression*> ExpressionList;
 typedef std::vector<NVariableDeclaration*> VariableList;
 
 class Visitor;
+class WorkStack;
+
+// What a node is, for code that switches on it instead of calling a
+// virtual function, such as StaticVisitor and FlatAst
+enum NodeKind : uint8_t {
+    N_BLOCK, N_SKIP, N_INTEGER, N_BOOL, N_DOUBLE, N_TYPE, N_SECURITY,
+    N_IDENTIFIER, N_IF, N_WHILE, N_BINARY, N_ASSIGNMENT,
+    N_EXPRESSION_STATEMENT, N_DECLARATION, N_PROCEDURE, N_CALL, N_ELEMENT,
+    N_ELEMENT_ASSIGNMENT,
+};
 
 class Node {
 public:
     int lineno;
+    const NodeKind kind;
+    Node(NodeKind kind) : kind(kind) { }
     virtual ~Node() {}
-    virtual void accept(class Visitor &visitor) { }
+    // Walks the subtree rooted here, see Walker
+    void accept(Visitor &visitor);
+    // Gives the visitor the events that start this node's traversal, and
+    // schedules its children and remaining events on the work stack
+    virtual void expand(Visitor &visitor, WorkStack &work) { }
+    // Calls the visitor's visit for this node's type
+    virtual void dispatch(Visitor &visitor, uint64_t flag) { }
 };
 
 class NExpression : public Node {
+public:
+    NExpression(NodeKind kind) : Node(kind) { }
 };
 
 class NStatement : public Node {
+public:
+    NStatement(NodeKind kind) : Node(kind) { }
 };
 
 class NBlock : public NExpression {
 public:
     StatementList statements;
-    NBlock() { }
-    virtual void accept(Visitor &visitor) {
-      visitor.visit(this, V_FLAG_ENTER);
-      StatementList::const_iterator it;
-	    for (it = statements.begin(); it != statements.end(); it++) {
-		    (**it).accept(visitor);
-	    }
-      visitor.visit(this, V_FLAG_EXIT);
-    };
+    NBlock() : NExpression(N_BLOCK) { }
+    virtual void expand(Visitor &visitor, WorkStack &work);
+    virtual void dispatch(Visitor &visitor, uint64_t flag) { visitor.visit(this, flag); };
 };
 
 class NSkip : public NExpression {
 public:
-    NSkip () { }
-    virtual void accept(Visitor &visitor) { visitor.visit(this, V_FLAG_NONE); };
+    NSkip () : NExpression(N_SKIP) { }
+    virtual void expand(Visitor &visitor, WorkStack &work) { visitor.visit(this, V_FLAG_NONE); };
+    virtual void dispatch(Visitor &visitor, uint64_t flag) { visitor.visit(this, flag); };
 };
 
 class NInteger : public NExpression {
 public:
     long long value;
-    NInteger(long long value) : value(value) { }
-    virtual void accept(Visitor &visitor) { visitor.visit(this, V_FLAG_NONE); };
+    NInteger(long long value) : NExpression(N_INTEGER), value(value) { }
+    virtual void expand(Visitor &visitor, WorkStack &work) { visitor.visit(this, V_FLAG_NONE); };
+    virtual void dispatch(Visitor &visitor, uint64_t flag) { visitor.visit(this, flag); };
 };
 
 class NBool : public NExpression {
 public:
     std::string value;
-    NBool(std::string value) : value(value) { }
-    virtual void accept(Visitor &visitor) { visitor.visit(this, V_FLAG_NONE); };
+    NBool(std::string value) : NExpression(N_BOOL), value(value) { }
+    virtual void expand(Visitor &visitor, WorkStack &work) { visitor.visit(this, V_FLAG_NONE); };
+    virtual void dispatch(Visitor &visitor, uint64_t flag) { visitor.visit(this, flag); };
 };
 
 class NDouble : public NExpression {
 public:
     double value;
-    NDouble(double value) : value(value) { }
-    virtual void accept(Visitor &visitor) { visitor.visit(this, V_FLAG_NONE); };
+    NDouble(double value) : NExpression(N_DOUBLE), value(value) { }
+    virtual void expand(Visitor &visitor, WorkStack &work) { visitor.visit(this, V_FLAG_NONE); };
+    virtual void dispatch(Visitor &visitor, uint64_t flag) { visitor.visit(this, flag); };
 };
 
 class NType : public NExpression {
 public:
-    std::string name;
-    NType(const std::string& name) : name(name) { }
-    virtual void accept(Visitor &visitor) { visitor.visit(this, V_FLAG_NONE); };
+    Name name;
+    NType(Name name) : NExpression(N_TYPE), name(name) { }
+    virtual void expand(Visitor &visitor, WorkStack &work) { visitor.visit(this, V_FLAG_NONE); };
+    virtual void dispatch(Visitor &visitor, uint64_t flag) { visitor.visit(this, flag); };
 };
 
 class NSecurity : public NExpression {
 public:
-    std::string name;
-    NSecurity(const std::string& name) : name(name) { }
-    virtual void accept(Visitor &visitor) { visitor.visit(this, V_FLAG_NONE); };
+    Name name;
+    NSecurity(Name name) : NExpression(N_SECURITY), name(name) { }
+    virtual void expand(Visitor &visitor, WorkStack &work) { visitor.visit(this, V_FLAG_NONE); };
+    virtual void dispatch(Visitor &visitor, uint64_t flag) { visitor.visit(this, flag); };
 };
 
 class NIdentifier : public NExpression {
 public:
-    std::string name;
-    NIdentifier(const std::string& name) : name(name) { }
-    virtual void accept(Visitor &visitor) { visitor.visit(this, V_FLAG_NONE); };
+    Name name;
+    int slot = -1; // Set by the ResolveVisitor, -1 if undeclared
+    NIdentifier(Name name) : NExpression(N_IDENTIFIER), name(name) { }
+    virtual void expand(Visitor &visitor, WorkStack &work) { visitor.visit(this, V_FLAG_NONE); };
+    virtual void dispatch(Visitor &visitor, uint64_t flag) { visitor.visit(this, flag); };
 };
 
 class NIfExpression : public NExpression {
@@ -118,24 +144,9 @@ public:
     NBlock & ithen;
     NBlock & ielse;
     NIfExpression(NExpression& iguard, NBlock& ithen, NBlock& ielse) :
-        iguard(iguard), ithen(ithen), ielse(ielse) { }
-    virtual void accept(Visitor &visitor) {
-      visitor.visit(this, V_FLAG_ENTER);
-
-      visitor.visit(this, V_FLAG_GUARD | V_FLAG_ENTER);
-      iguard.accept(visitor);
-      visitor.visit(this, V_FLAG_GUARD | V_FLAG_EXIT);
-
-      visitor.visit(this, V_FLAG_THEN | V_FLAG_ENTER);
-      ithen.accept(visitor);
-      visitor.visit(this, V_FLAG_THEN | V_FLAG_EXIT);
-
-      visitor.visit(this, V_FLAG_ELSE | V_FLAG_ENTER);
-      ielse.accept(visitor);
-      visitor.visit(this, V_FLAG_ELSE | V_FLAG_EXIT);
-
-      visitor.visit(this, V_FLAG_EXIT);
-    };
+        NExpression(N_IF), iguard(iguard), ithen(ithen), ielse(ielse) { }
+    virtual void expand(Visitor &visitor, WorkStack &work);
+    virtual void dispatch(Visitor &visitor, uint64_t flag) { visitor.visit(this, flag); };
 };
 
 class NWhileExpression : public NExpression {
@@ -143,20 +154,9 @@ public:
     NExpression& iguard;
     NBlock & ithen;
     NWhileExpression(NExpression& iguard, NBlock& ithen) :
-        iguard(iguard), ithen(ithen) { }
-    virtual void accept(Visitor &visitor) {
-      visitor.visit(this, V_FLAG_ENTER);
-
-      visitor.visit(this, V_FLAG_GUARD | V_FLAG_ENTER);
-      iguard.accept(visitor);
-      visitor.visit(this, V_FLAG_GUARD | V_FLAG_EXIT);
-
-      visitor.visit(this, V_FLAG_THEN | V_FLAG_ENTER);
-      ithen.accept(visitor);
-      visitor.visit(this, V_FLAG_THEN | V_FLAG_EXIT);
-
-      visitor.visit(this, V_FLAG_EXIT);
-    };
+        NExpression(N_WHILE), iguard(iguard), ithen(ithen) { }
+    virtual void expand(Visitor &visitor, WorkStack &work);
+    virtual void dispatch(Visitor &visitor, uint64_t flag) { visitor.visit(this, flag); };
 };
 
 class NBinaryOperator : public NExpression {
@@ -165,12 +165,9 @@ public:
     NExpression& lhs;
     NExpression& rhs;
     NBinaryOperator(NExpression& lhs, int op, NExpression& rhs) :
-        lhs(lhs), rhs(rhs), op(op) { }
-    virtual void accept(Visitor &visitor) {
-      lhs.accept(visitor);
-      rhs.accept(visitor);
-      visitor.visit(this, V_FLAG_NONE);
-    };
+        NExpression(N_BINARY), lhs(lhs), rhs(rhs), op(op) { }
+    virtual void expand(Visitor &visitor, WorkStack &work);
+    virtual void dispatch(Visitor &visitor, uint64_t flag) { visitor.visit(this, flag); };
 };
 
 class NAssignment : public NExpression {
@@ -178,22 +175,18 @@ public:
     NIdentifier& lhs;
     NExpression& rhs;
     NAssignment(NIdentifier& lhs, NExpression& rhs) : 
-        lhs(lhs), rhs(rhs) { }
-    virtual void accept(Visitor &visitor) {
-      rhs.accept(visitor);
-      visitor.visit(this, V_FLAG_NONE);
-    };
+        NExpression(N_ASSIGNMENT), lhs(lhs), rhs(rhs) { }
+    virtual void expand(Visitor &visitor, WorkStack &work);
+    virtual void dispatch(Visitor &visitor, uint64_t flag) { visitor.visit(this, flag); };
 };
 
 class NExpressionStatement : public NStatement {
 public:
     NExpression& expression;
     NExpressionStatement(NExpression& expression) : 
-        expression(expression) { }
-    virtual void accept(Visitor &visitor) {
-      expression.accept(visitor);
-      visitor.visit(this, V_FLAG_NONE);
-    };
+        NStatement(N_EXPRESSION_STATEMENT), expression(expression) { }
+    virtual void expand(Visitor &visitor, WorkStack &work);
+    virtual void dispatch(Visitor &visitor, uint64_t flag) { visitor.visit(this, flag); };
 };
 
 class NVariableDeclaration : public NStatement {
@@ -201,20 +194,225 @@ public:
     const NType& type;
     NSecurity& security;
     NIdentifier& id;
-    NExpression *assignmentExpr;
+    NExpression *assignmentExpr = NULL;
+    int64_t size = 0;        // Elements of an array, 0 for any other variable
+    bool redeclared = false; // Set by the ResolveVisitor
     NVariableDeclaration(const NType& type, NIdentifier& id, NSecurity& sec) :
-        type(type), id(id), security(sec) { }
+        NStatement(N_DECLARATION), type(type), id(id), security(sec) { }
     NVariableDeclaration(const NType& type, NIdentifier& id, NExpression *assignmentExpr, NSecurity& sec) :
-        type(type), id(id), assignmentExpr(assignmentExpr), security(sec) { }
-    virtual void accept(Visitor &visitor) {
-      ((NType&)type).accept(visitor);
-      security.accept(visitor);
-      visitor.visit(this, V_FLAG_NONE); // Must declare the variable before assign
-	    if (assignmentExpr != NULL) {
-		    NAssignment assign(id, *assignmentExpr);
-        assign.lineno = lineno;
-        assign.accept(visitor);
+        NStatement(N_DECLARATION), type(type), id(id), assignmentExpr(assignmentExpr), security(sec) { }
+    virtual void expand(Visitor &visitor, WorkStack &work);
+    virtual void dispatch(Visitor &visitor, uint64_t flag) { visitor.visit(this, flag); };
+};
+
+// A procedure, declared at the top level.  Its body may use its parameters,
+// its own variables, and the top-level variables declared before it.  The
+// body runs in a context as high as pc, so it may only be called from
+// contexts that flow to pc.
+class NProcedure : public NStatement {
+public:
+    NSecurity& pc;
+    NIdentifier& id;
+    VariableList params;
+    NBlock& body;
+    int index = -1;          // Set by the ResolveVisitor, in order of declaration
+    bool redeclared = false; // Set by the ResolveVisitor
+    NProcedure(NSecurity& pc, NIdentifier& id, NBlock& body) :
+        NStatement(N_PROCEDURE), pc(pc), id(id), body(body) { }
+    virtual void expand(Visitor &visitor, WorkStack &work);
+    virtual void dispatch(Visitor &visitor, uint64_t flag) { visitor.visit(this, flag); };
+};
+
+class NCall : public NExpression {
+public:
+    NIdentifier& id;
+    ExpressionList args;
+    int procedure = -1; // NProcedure::index, set by the ResolveVisitor, -1 if undeclared
+    NCall(NIdentifier& id) : NExpression(N_CALL), id(id) { }
+    virtual void expand(Visitor &visitor, WorkStack &work);
+    virtual void dispatch(Visitor &visitor, uint64_t flag) { visitor.visit(this, flag); };
+};
+
+// An element of an array.  Every element carries the array's label, and
+// reading one also reveals the index.
+class NElement : public NExpression {
+public:
+    NIdentifier& id;
+    NExpression& index;
+    NElement(NIdentifier& id, NExpression& index) :
+        NExpression(N_ELEMENT), id(id), index(index) { }
+    virtual void expand(Visitor &visitor, WorkStack &work);
+    virtual void dispatch(Visitor &visitor, uint64_t flag) { visitor.visit(this, flag); };
+};
+
+class NElementAssignment : public NExpression {
+public:
+    NIdentifier& id;
+    NExpression& index;
+    NExpression& rhs;
+    NElementAssignment(NIdentifier& id, NExpression& index, NExpression& rhs) :
+        NExpression(N_ELEMENT_ASSIGNMENT), id(id), index(index), rhs(rhs) { }
+    virtual void expand(Visitor &visitor, WorkStack &work);
+    virtual void dispatch(Visitor &visitor, uint64_t flag) { visitor.visit(this, flag); };
+};
+
+// Work left in a traversal: events still to be given to the visitor, and
+// nodes whose subtrees are still to be expanded, last to be done on top.
+class WorkStack {
+public:
+    class Step {
+    public:
+      Node* node;    // NULL to drop the newest of assignments
+      uint64_t flag;
+      bool expand;   // Expand node rather than visit it with flag
+    };
+    std::vector<Step> steps;
+    // Initializers of the declarations being walked, visited as assignments
+    std::deque<NAssignment> assignments;
+
+    void visit(Node* node, uint64_t flag) { steps.push_back(Step{node, flag, false}); };
+    void accept(Node* node) { steps.push_back(Step{node, 0, true}); };
+};
+
+// Walks a tree with a heap-allocated work stack instead of recursing on the
+// C++ stack, so nesting depth is only bounded by memory.  Visitors see the
+// same events in the same order as a recursive, post-order traversal: each
+// node's expand gives the events that open it right away, and pushes its
+// children and closing events in reverse.
+class Walker {
+private:
+    WorkStack work;
+
+public:
+    void walk(Node* root, Visitor &visitor) {
+      work.accept(root);
+      while (!work.steps.empty()) {
+        WorkStack::Step step = work.steps.back();
+        work.steps.pop_back();
+        if (step.node == NULL) {
+          work.assignments.pop_back();
+        } else if (step.expand) {
+          step.node->expand(visitor, work);
+        } else {
+          step.node->dispatch(visitor, step.flag);
+        }
       }
     };
 };
+
+inline void Node::accept(Visitor &visitor)
+{
+    Walker walker;
+    walker.walk(this, visitor);
+}
+
+inline void NBlock::expand(Visitor &visitor, WorkStack &work)
+{
+    if (visitor.skip(this)) return;
+    visitor.visit(this, V_FLAG_ENTER);
+    work.visit(this, V_FLAG_EXIT);
+    for (StatementList::reverse_iterator it = statements.rbegin(); it != statements.rend(); ++it) {
+      work.accept(*it);
+    }
+}
+
+inline void NIfExpression::expand(Visitor &visitor, WorkStack &work)
+{
+    visitor.visit(this, V_FLAG_ENTER);
+    visitor.visit(this, V_FLAG_GUARD | V_FLAG_ENTER);
+    work.visit(this, V_FLAG_EXIT);
+    work.visit(this, V_FLAG_ELSE | V_FLAG_EXIT);
+    work.accept(&ielse);
+    work.visit(this, V_FLAG_ELSE | V_FLAG_ENTER);
+    work.visit(this, V_FLAG_THEN | V_FLAG_EXIT);
+    work.accept(&ithen);
+    work.visit(this, V_FLAG_THEN | V_FLAG_ENTER);
+    work.visit(this, V_FLAG_GUARD | V_FLAG_EXIT);
+    work.accept(&iguard);
+}
+
+inline void NWhileExpression::expand(Visitor &visitor, WorkStack &work)
+{
+    visitor.visit(this, V_FLAG_ENTER);
+    visitor.visit(this, V_FLAG_GUARD | V_FLAG_ENTER);
+    work.visit(this, V_FLAG_EXIT);
+    work.visit(this, V_FLAG_THEN | V_FLAG_EXIT);
+    work.accept(&ithen);
+    work.visit(this, V_FLAG_THEN | V_FLAG_ENTER);
+    work.visit(this, V_FLAG_GUARD | V_FLAG_EXIT);
+    work.accept(&iguard);
+}
+
+inline void NBinaryOperator::expand(Visitor &visitor, WorkStack &work)
+{
+    work.visit(this, V_FLAG_NONE);
+    work.accept(&rhs);
+    work.accept(&lhs);
+}
+
+inline void NAssignment::expand(Visitor &visitor, WorkStack &work)
+{
+    work.visit(this, V_FLAG_NONE);
+    work.accept(&rhs);
+}
+
+inline void NExpressionStatement::expand(Visitor &visitor, WorkStack &work)
+{
+    work.visit(this, V_FLAG_NONE);
+    work.accept(&expression);
+}
+
+inline void NVariableDeclaration::expand(Visitor &visitor, WorkStack &work)
+{
+    ((NType&)type).expand(visitor, work);
+    security.expand(visitor, work);
+    visitor.visit(this, V_FLAG_NONE); // Must declare the variable before assign
+    if (assignmentExpr != NULL) {
+      // Lives until its events are done, as the visitors may look at it
+      work.assignments.emplace_back(id, *assignmentExpr);
+      work.assignments.back().lineno = lineno;
+      work.visit(NULL, 0);
+      work.accept(&work.assignments.back());
+    }
+}
+
+// The parameters are declared before the body, which is visited like the
+// body of a while
+inline void NProcedure::expand(Visitor &visitor, WorkStack &work)
+{
+    visitor.visit(this, V_FLAG_ENTER);
+    work.visit(this, V_FLAG_EXIT);
+    work.visit(this, V_FLAG_THEN | V_FLAG_EXIT);
+    work.accept(&body);
+    work.visit(this, V_FLAG_THEN | V_FLAG_ENTER);
+    for (VariableList::reverse_iterator it = params.rbegin(); it != params.rend(); ++it) {
+      work.accept(*it);
+    }
+    work.accept(&pc);
+}
+
+inline void NCall::expand(Visitor &visitor, WorkStack &work)
+{
+    // The procedure's name is not visited, as with the left hand side of
+    // an assignment
+    work.visit(this, V_FLAG_NONE);
+    for (ExpressionList::reverse_iterator it = args.rbegin(); it != args.rend(); ++it) {
+      work.accept(*it);
+    }
+}
+
+// The array's name is not visited, as with the left hand side of an
+// assignment
+inline void NElement::expand(Visitor &visitor, WorkStack &work)
+{
+    work.visit(this, V_FLAG_NONE);
+    work.accept(&index);
+}
+
+inline void NElementAssignment::expand(Visitor &visitor, WorkStack &work)
+{
+    work.visit(this, V_FLAG_NONE);
+    work.accept(&rhs);
+    work.accept(&index);
+}
 #endif // __NODE_H_
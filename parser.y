@@ -18,20 +18,73 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
 // IN THE SOFTWARE.
 */
-%{
+%code requires {
+    #include "parserState.h"
+    typedef void* yyscan_t;
+}
+
+%code {
     #include "node.h"
-    NBlock *programBlock; /* the top level root node of our final AST */
+    #include "parserState.h"
+    #include "lexer.h"
+    #include <errno.h>
+    #include <stdarg.h>
+    #include <stdlib.h>
 
-    extern int yylex();
-    extern int yylineno;
-    void yyerror(const char *s, ...) {
+    /* The parse stack lives on the heap and grows on demand, so deeply
+       nested blocks only need a higher cap than the default 10000 */
+    #define YYMAXDEPTH 100000000
+    extern int yylex(YYSTYPE* lvalp, yyscan_t scanner);
+    extern int yyget_lineno(yyscan_t scanner);
+    /* Reads from whichever scanner the compilation chose */
+    static int yylex(YYSTYPE* lvalp, ParserState* state, yyscan_t scanner) {
+      if (state->lexer != NULL) return state->lexer->next(lvalp);
+      return yylex(lvalp, scanner);
+    }
+    static int lineno(ParserState* state, yyscan_t scanner) {
+      if (state->lexer != NULL) return state->lexer->getLine();
+      return yyget_lineno(scanner);
+    }
+    void yyerror(ParserState* state, yyscan_t scanner, const char *s, ...) {
       va_list ap;
       va_start(ap, s);
-      fprintf(stderr, "ERR: line %d\n", yylineno);
+      int line = lineno(state, scanner);
+      fprintf(stderr, "ERR: line %d\n", line);
       vfprintf(stderr, s, ap);
       fprintf(stderr, "\n");
+      va_end(ap);
+      if (state->lines != NULL) {
+        // Only the hand-written scanner knows where its tokens start
+        int column = 0, tokenLine = 0;
+        size_t length = 1;
+        if (state->lexer != NULL) {
+          state->lines->locate(state->lexer->getLastToken().offset, tokenLine, column);
+          length = state->lexer->getLastToken().length;
+          if (tokenLine != line) column = 0;
+        }
+        state->lines->print(std::cerr, line, column, length ? length : 1);
+      }
+    }
+    /* The number of elements the digits give array id, or 0 once an error
+       is reported, as there are none or too many to count */
+    static int64_t arraySize(ParserState* state, yyscan_t scanner, std::string* digits, const NIdentifier& id) {
+      errno = 0;
+      long long size = strtoll(digits->c_str(), NULL, 10);
+      bool overflow = errno == ERANGE;
+      delete digits;
+      if (overflow) {
+        yyerror(state, scanner, "Array %s is too large", id.name.str().c_str());
+        return 0;
+      }
+      if (size <= 0) yyerror(state, scanner, "Array %s has no elements", id.name.str().c_str());
+      return size > 0 ? size : 0;
     }
-%}
+}
+
+/* Reentrant parser, all state lives in ParserState and the scanner */
+%define api.pure full
+%parse-param { ParserState* state } { yyscan_t scanner }
+%lex-param { ParserState* state } { yyscan_t scanner }
 
 /* Represents the many different ways we can access our data */
 %union {
@@ -45,7 +98,9 @@
     NVariableDeclaration *var_decl;
     std::vector<NVariableDeclaration*> *varvec;
     std::vector<NExpression*> *exprvec;
+    std::vector<Name> *namevec;
     std::string *string;
+    uint32_t name;
     int token;
 }
 
@@ -53,11 +108,12 @@
    match our tokens.l lex file. We also define the node type
    they represent.
  */
-%token <string> T_TYPE T_SEC T_IDENTIFIER T_VAL_INTEGER T_VAL_DOUBLE T_VAL_BOOL
+%token <name> T_TYPE T_SEC T_IDENTIFIER
+%token <string> T_VAL_INTEGER T_VAL_DOUBLE T_VAL_BOOL
 %token <token> TCEQ TCNE TCLT TCLE TCGT TCGE TEQUAL
-%token <token> TLPAREN TRPAREN TLBRACE TRBRACE TCOMMA TDOT
+%token <token> TLPAREN TRPAREN TLBRACE TRBRACE TLBRACKET TRBRACKET TCOMMA TDOT
 %token <token> TPLUS TMINUS TMUL TDIV TSC
-%token <token> TIF TTHEN TELSE TSKIP TWHILE
+%token <token> TIF TTHEN TELSE TSKIP TWHILE TLABEL TPROC TCALL
 
 /* Define the type of node our nonterminal symbols represent.
    The types refer to the %union declaration above. Ex: when
@@ -69,7 +125,11 @@
 %type <ident> ident
 %type <expr> numeric boolean expr 
 %type <block> program stmts block
-%type <stmt> stmt var_decl
+%type <stmt> stmt var_decl proc_decl
+%type <var_decl> param
+%type <varvec> params param_list
+%type <exprvec> args arg_list
+%type <namevec> secs
 
 /* Operator precedence */
 %nonassoc TTHEN
@@ -83,61 +143,157 @@
 
 %%
 
-program : stmts { programBlock = $1; }
+program : label_decls stmts { state->programBlock = $2; }
         ;
+
+label_decls : /*blank*/
+            | label_decls label_decl
+            ;
+
+label_decl : TLABEL T_IDENTIFIER TSC {
+               std::string err;
+               if (!state->lattice->declare(Name($2), std::vector<Name>(), err)) { yyerror(state, scanner, "%s", err.c_str()); YYABORT; }
+             }
+           | TLABEL T_IDENTIFIER TCLT secs TSC {
+               std::string err;
+               bool ok = state->lattice->declare(Name($2), *$4, err);
+               delete $4;
+               if (!ok) { yyerror(state, scanner, "%s", err.c_str()); YYABORT; }
+             }
+           | TLABEL T_SEC { yyerror(state, scanner, "Label redeclaration %s", Name($2).str().c_str()); YYABORT; }
+           ;
+
+secs : T_SEC { $$ = new std::vector<Name>(); $$->push_back(Name($1)); }
+     | secs TCOMMA T_SEC { $1->push_back(Name($3)); }
+     ;
         
-stmts : stmt { $$ = new NBlock(); $$->statements.push_back($<stmt>1); }
-      | stmts stmt { $1->statements.push_back($<stmt>2); }
+stmts : stmt {
+          if (state->stream) {
+            $$ = NULL;
+            if (!state->stream($<stmt>1)) YYABORT;
+          } else {
+            $$ = state->arena->make<NBlock>();
+            $$->statements.push_back($<stmt>1);
+          }
+        }
+      | stmts stmt {
+          if (state->stream) {
+            if (!state->stream($<stmt>2)) YYABORT;
+          } else {
+            $1->statements.push_back($<stmt>2);
+          }
+        }
       ;
 
 stmt : var_decl
-     | expr { $$ = new NExpressionStatement(*$1); }
+     | proc_decl
+     | expr { $$ = state->arena->make<NExpressionStatement>(*$1); }
      ;
 
-block : /*blank*/ { $$ = new NBlock(); }
+/* No procedures in a block: only the program's own variables outlive a call */
+block : /*blank*/ { $$ = state->arena->make<NBlock>(); }
       | block var_decl { $$->statements.push_back($<stmt>2); }
       | block expr { $$->statements.push_back($<stmt>2); }
       ;
 
-var_decl : type ident TSC { $$ = new NVariableDeclaration(*$1, *$2, *(new NSecurity(""))); $$->lineno = yylineno; }
-         | type ident TEQUAL expr TSC{ $$ = new NVariableDeclaration(*$1, *$2, $4, *(new NSecurity(""))); $$->lineno = yylineno; }
-         | sec type ident TSC { $$ = new NVariableDeclaration(*$2, *$3, *$1); $$->lineno = yylineno; }
-         | sec type ident TEQUAL expr TSC{ $$ = new NVariableDeclaration(*$2, *$3, $5, *$1); $$->lineno = yylineno; }
+var_decl : type ident TSC { $$ = state->arena->make<NVariableDeclaration>(*$1, *$2, *state->arena->make<NSecurity>(Name())); $$->lineno = lineno(state, scanner); }
+         | type ident TEQUAL expr TSC{ $$ = state->arena->make<NVariableDeclaration>(*$1, *$2, $4, *state->arena->make<NSecurity>(Name())); $$->lineno = lineno(state, scanner); }
+         | sec type ident TSC { $$ = state->arena->make<NVariableDeclaration>(*$2, *$3, *$1); $$->lineno = lineno(state, scanner); }
+         | sec type ident TEQUAL expr TSC{ $$ = state->arena->make<NVariableDeclaration>(*$2, *$3, $5, *$1); $$->lineno = lineno(state, scanner); }
+         | type ident TLBRACKET T_VAL_INTEGER TRBRACKET TSC {
+             NVariableDeclaration* decl = state->arena->make<NVariableDeclaration>(*$1, *$2, *state->arena->make<NSecurity>(Name()));
+             decl->size = arraySize(state, scanner, $4, *$2);
+             if (decl->size == 0) YYABORT;
+             decl->lineno = lineno(state, scanner);
+             $$ = decl;
+           }
+         | sec type ident TLBRACKET T_VAL_INTEGER TRBRACKET TSC {
+             NVariableDeclaration* decl = state->arena->make<NVariableDeclaration>(*$2, *$3, *$1);
+             decl->size = arraySize(state, scanner, $5, *$3);
+             if (decl->size == 0) YYABORT;
+             decl->lineno = lineno(state, scanner);
+             $$ = decl;
+           }
          ;
 
-type : T_TYPE { $$ = new NType(*$1); delete $1; $$->lineno = yylineno; }
+proc_decl : TPROC ident TLPAREN params TRPAREN TLBRACE block TRBRACE {
+              NProcedure* proc = state->arena->make<NProcedure>(*state->arena->make<NSecurity>(Name()), *$2, *$7);
+              proc->params.swap(*$4);
+              delete $4;
+              proc->lineno = $2->lineno;
+              $$ = proc;
+            }
+          | sec TPROC ident TLPAREN params TRPAREN TLBRACE block TRBRACE {
+              NProcedure* proc = state->arena->make<NProcedure>(*$1, *$3, *$8);
+              proc->params.swap(*$5);
+              delete $5;
+              proc->lineno = $3->lineno;
+              $$ = proc;
+            }
+          ;
+
+params : /*blank*/ { $$ = new VariableList(); }
+       | param_list
+       ;
+
+param_list : param { $$ = new VariableList(); $$->push_back($1); }
+           | param_list TCOMMA param { $1->push_back($3); }
+           ;
+
+param : type ident { $$ = state->arena->make<NVariableDeclaration>(*$1, *$2, *state->arena->make<NSecurity>(Name())); $$->lineno = lineno(state, scanner); }
+      | sec type ident { $$ = state->arena->make<NVariableDeclaration>(*$2, *$3, *$1); $$->lineno = lineno(state, scanner); }
+      ;
+
+type : T_TYPE { $$ = state->arena->make<NType>(Name($1)); $$->lineno = lineno(state, scanner); }
      ;
 
-sec : T_SEC { $$ = new NSecurity(*$1); delete $1; $$->lineno = yylineno; }
+sec : T_SEC { $$ = state->arena->make<NSecurity>(Name($1)); $$->lineno = lineno(state, scanner); }
     ;
  
-expr : ident TEQUAL expr TSC { $$ = new NAssignment(*$<ident>1, *$3); $$->lineno = yylineno; }
-     | TSKIP TSC { $$ = new NSkip(); $$->lineno = yylineno; }
-     | ident { $<ident>$ = $1; $$->lineno = yylineno; }
-     | TIF expr TLBRACE block TRBRACE TELSE TLBRACE block TRBRACE { $$ = new NIfExpression(*$2, *$4, *$8); }
-     | TWHILE expr TLBRACE block TRBRACE { $$ = new NWhileExpression(*$2, *$4); }
+expr : ident TEQUAL expr TSC { $$ = state->arena->make<NAssignment>(*$<ident>1, *$3); $$->lineno = lineno(state, scanner); }
+     | TSKIP TSC { $$ = state->arena->make<NSkip>(); $$->lineno = lineno(state, scanner); }
+     | ident { $<ident>$ = $1; $$->lineno = lineno(state, scanner); }
+     | ident TLBRACKET expr TRBRACKET TEQUAL expr TSC { $$ = state->arena->make<NElementAssignment>(*$1, *$3, *$6); $$->lineno = lineno(state, scanner); }
+     | ident TLBRACKET expr TRBRACKET { $$ = state->arena->make<NElement>(*$1, *$3); $$->lineno = lineno(state, scanner); }
+     | TIF expr TLBRACE block TRBRACE TELSE TLBRACE block TRBRACE { $$ = state->arena->make<NIfExpression>(*$2, *$4, *$8); }
+     | TWHILE expr TLBRACE block TRBRACE { $$ = state->arena->make<NWhileExpression>(*$2, *$4); }
      | numeric
      | boolean 
-     | expr TPLUS expr { $$ = new NBinaryOperator(*$1, $2, *$3); $$->lineno = yylineno; }
-     | expr TMINUS expr { $$ = new NBinaryOperator(*$1, $2, *$3); $$->lineno = yylineno; }
-     | expr TMUL expr { $$ = new NBinaryOperator(*$1, $2, *$3); $$->lineno = yylineno; }
-     | expr TDIV expr { $$ = new NBinaryOperator(*$1, $2, *$3); $$->lineno = yylineno; }
-     | expr TCEQ expr { $$ = new NBinaryOperator(*$1, $2, *$3); $$->lineno = yylineno; }
-     | expr TCNE expr { $$ = new NBinaryOperator(*$1, $2, *$3); $$->lineno = yylineno; }
-     | expr TCLT expr { $$ = new NBinaryOperator(*$1, $2, *$3); $$->lineno = yylineno; }
-     | expr TCLE expr { $$ = new NBinaryOperator(*$1, $2, *$3); $$->lineno = yylineno; }
-     | expr TCGT expr { $$ = new NBinaryOperator(*$1, $2, *$3); $$->lineno = yylineno; }
-     | expr TCGE expr { $$ = new NBinaryOperator(*$1, $2, *$3); $$->lineno = yylineno; }
+     | expr TPLUS expr { $$ = state->arena->make<NBinaryOperator>(*$1, $2, *$3); $$->lineno = lineno(state, scanner); }
+     | expr TMINUS expr { $$ = state->arena->make<NBinaryOperator>(*$1, $2, *$3); $$->lineno = lineno(state, scanner); }
+     | expr TMUL expr { $$ = state->arena->make<NBinaryOperator>(*$1, $2, *$3); $$->lineno = lineno(state, scanner); }
+     | expr TDIV expr { $$ = state->arena->make<NBinaryOperator>(*$1, $2, *$3); $$->lineno = lineno(state, scanner); }
+     | expr TCEQ expr { $$ = state->arena->make<NBinaryOperator>(*$1, $2, *$3); $$->lineno = lineno(state, scanner); }
+     | expr TCNE expr { $$ = state->arena->make<NBinaryOperator>(*$1, $2, *$3); $$->lineno = lineno(state, scanner); }
+     | expr TCLT expr { $$ = state->arena->make<NBinaryOperator>(*$1, $2, *$3); $$->lineno = lineno(state, scanner); }
+     | expr TCLE expr { $$ = state->arena->make<NBinaryOperator>(*$1, $2, *$3); $$->lineno = lineno(state, scanner); }
+     | expr TCGT expr { $$ = state->arena->make<NBinaryOperator>(*$1, $2, *$3); $$->lineno = lineno(state, scanner); }
+     | expr TCGE expr { $$ = state->arena->make<NBinaryOperator>(*$1, $2, *$3); $$->lineno = lineno(state, scanner); }
      | TLPAREN expr TRPAREN { $$ = $2; }
+     | TCALL ident TLPAREN args TRPAREN TSC {
+         NCall* call = state->arena->make<NCall>(*$2);
+         call->args.swap(*$4);
+         delete $4;
+         call->lineno = lineno(state, scanner);
+         $$ = call;
+       }
+     ;
+
+args : /*blank*/ { $$ = new ExpressionList(); }
+     | arg_list
      ;
 
-ident : T_IDENTIFIER { $$ = new NIdentifier(*$1); delete $1; $$->lineno = yylineno; }
+arg_list : expr { $$ = new ExpressionList(); $$->push_back($1); }
+         | arg_list TCOMMA expr { $1->push_back($3); }
+         ;
+
+ident : T_IDENTIFIER { $$ = state->arena->make<NIdentifier>(Name($1)); $$->lineno = lineno(state, scanner); }
       ;
 
-numeric : T_VAL_INTEGER { $$ = new NInteger(atol($1->c_str())); delete $1; $$->lineno = yylineno; }
-        | T_VAL_DOUBLE { $$ = new NDouble(atof($1->c_str())); delete $1; $$->lineno = yylineno; }
+numeric : T_VAL_INTEGER { $$ = state->arena->make<NInteger>(atol($1->c_str())); delete $1; $$->lineno = lineno(state, scanner); }
+        | T_VAL_DOUBLE { $$ = state->arena->make<NDouble>(atof($1->c_str())); delete $1; $$->lineno = lineno(state, scanner); }
         ;
 
-boolean : T_VAL_BOOL { $$ = new NBool($1->c_str()); delete $1; $$->lineno = yylineno; }
+boolean : T_VAL_BOOL { $$ = state->arena->make<NBool>($1->c_str()); delete $1; $$->lineno = lineno(state, scanner); }
         ;
 %%
@@ -0,0 +1,47 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __PARSER_STATE_H_
+#define __PARSER_STATE_H_
+#include "node.h"
+#include "arena.h"
+#include "lattice.h"
+#include "lineIndex.h"
+#include <functional>
+
+class Lexer;
+
+// Everything the parser and the scanner share for one compilation.
+// It is handed to yyparse as a parameter and to the scanner as its extra
+// data, so several compilations can run at the same time.
+class ParserState {
+public:
+  NBlock* programBlock = NULL; // The top level root node of the AST
+  Arena* arena;                // Owns every node the grammar actions create
+  Lattice* lattice;            // Filled in by the label declarations
+  Lexer* lexer = NULL;         // Hand-written scanner, NULL to use flex
+  LineIndex* lines = NULL;     // Source lines quoted in syntax errors
+  // When set, gets every top-level statement as soon as it is parsed,
+  // instead of it being added to programBlock.  Returning false stops the
+  // parse.
+  std::function<bool(NStatement*)> stream;
+  ParserState(Arena* arena, Lattice* lattice) : arena(arena), lattice(lattice) { }
+};
+#endif // __PARSER_STATE_H_
@@ -0,0 +1,170 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#include "node.h"
+#include "scope.h"
+#include "resolveVis.h"
+#include <iostream>
+
+ResolveVisitor::ResolveVisitor()
+{
+  scope.InitializeScope();
+}
+
+ResolveVisitor::~ResolveVisitor()
+{
+  assert(scope.depth() == 1);
+  scope.FinalizeScope();
+}
+
+/* The slot of the variable name stands for, or -1 */
+int ResolveVisitor::use(Name name)
+{
+  int slot = scope.LookUp(name);
+  if (slot < 0) unresolved++;
+  return slot;
+}
+
+void ResolveVisitor::visit(NIdentifier* element, uint64_t flag)
+{
+  element->slot = use(element->name);
+  if (verbose) std::cout << "ResolveVisitor " << element->name.str() << " -> " << element->slot << std::endl;
+}
+
+void ResolveVisitor::visit(NAssignment* element, uint64_t flag)
+{
+  // The left hand side is not visited by NAssignment::accept
+  visit(&element->lhs, flag);
+}
+
+void ResolveVisitor::visit(NVariableDeclaration* element, uint64_t flag)
+{
+  // The language does not allow shadowing a variable from an enclosing scope.
+  // The type checker reports it, we still bind a fresh slot.
+  element->redeclared = scope.LookUp(element->id.name) >= 0;
+  element->id.slot = slots++;
+  if (element->size != 0) arrays++;
+  scope.Insert(element->id.name, element->id.slot);
+  if (verbose) std::cout << "ResolveVisitor declaring " << element->id.name.str() << " -> " << element->id.slot << std::endl;
+}
+
+void ResolveVisitor::visit(NProcedure* element, uint64_t flag)
+{
+  switch (flag)
+  {
+    case V_FLAG_ENTER:
+      {
+        // Bound before the body, so that it may call itself.  A redeclaration
+        // keeps the first one, the type checker reports it.
+        std::pair<std::unordered_map<uint32_t, int>::iterator, bool> inserted =
+            procedures.insert(std::make_pair(element->id.name.getId(), (int) procedures.size()));
+        element->redeclared = !inserted.second;
+        element->index = inserted.first->second;
+        if (verbose) std::cout << "ResolveVisitor procedure " << element->id.name.str() << " -> " << element->index << std::endl;
+        // The parameters
+        scope.InitializeScope();
+      }
+      break;
+    case V_FLAG_EXIT:
+      scope.FinalizeScope();
+      break;
+    default:
+      break;
+  }
+}
+
+void ResolveVisitor::visit(NCall* element, uint64_t flag)
+{
+  std::unordered_map<uint32_t, int>::iterator it = procedures.find(element->id.name.getId());
+  element->procedure = it == procedures.end() ? -1 : it->second;
+  if (element->procedure < 0) unresolved++;
+  if (verbose) std::cout << "ResolveVisitor calling " << element->id.name.str() << std::endl;
+}
+
+void ResolveVisitor::visit(NElement* element, uint64_t flag)
+{
+  // The array is not visited by NElement::accept
+  visit(&element->id, flag);
+}
+
+void ResolveVisitor::visit(NElementAssignment* element, uint64_t flag)
+{
+  visit(&element->id, flag);
+}
+
+void ResolveVisitor::visit(NBlock* element, uint64_t flag)
+{
+  switch (flag)
+  {
+    case V_FLAG_ENTER:
+      scope.InitializeScope();
+      break;
+    case V_FLAG_EXIT:
+      scope.FinalizeScope();
+      break;
+    default:
+      assert(0);
+  }
+}
+
+/* Reads names from the operands instead of the nodes, and only visits the
+ * declarations, procedures and calls, whose nodes hold more than a name */
+void ResolveVisitor::resolve(FlatAst& flat)
+{
+  size_t n = flat.size();
+  for (size_t i = 0; i < n; i++) {
+    Node* node = flat.nodes[i];
+    switch (flat.kinds[i]) {
+      case N_IDENTIFIER:
+        flat.slots[i] = ((NIdentifier*) node)->slot = use(Name(flat.operands[i]));
+        break;
+      case N_ASSIGNMENT:
+        flat.slots[i] = ((NAssignment*) node)->lhs.slot = use(Name(flat.operands[i]));
+        break;
+      case N_ELEMENT:
+        flat.slots[i] = ((NElement*) node)->id.slot = use(Name(flat.operands[i]));
+        break;
+      case N_ELEMENT_ASSIGNMENT:
+        flat.slots[i] = ((NElementAssignment*) node)->id.slot = use(Name(flat.operands[i]));
+        break;
+      case N_DECLARATION:
+        visit((NVariableDeclaration*) node, flat.getFlag(i));
+        flat.slots[i] = ((NVariableDeclaration*) node)->id.slot;
+        break;
+      case N_PROCEDURE:
+        visit((NProcedure*) node, flat.getFlag(i));
+        flat.slots[i] = ((NProcedure*) node)->index;
+        break;
+      case N_CALL:
+        visit((NCall*) node, flat.getFlag(i));
+        flat.slots[i] = ((NCall*) node)->procedure;
+        break;
+      case N_BLOCK:
+        if (flat.getFlag(i) == V_FLAG_ENTER) {
+          scope.InitializeScope();
+        } else {
+          scope.FinalizeScope();
+        }
+        break;
+      default:
+        break;
+    }
+  }
+}
@@ -0,0 +1,76 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __RESOLVE_VISITOR_H_
+#define __RESOLVE_VISITOR_H_
+#include "node.h"
+#include "flatAst.h"
+#include "scope.h"
+#include "visitor.h"
+#include <unordered_map>
+
+// Binds every identifier use to its declaration before the other passes run.
+// Each declaration gets a dense slot index, which the type checker and the
+// code generator use to index their per-variable arrays directly.
+class ResolveVisitor : public Visitor {
+private:
+  bool verbose = false;
+  Scope scope;
+  int slots = 0;
+  int unresolved = 0;
+  int arrays = 0;
+  // Indices of the procedures by Name id, in a namespace of their own.
+  // Indices outlive the nodes, which streaming frees.
+  std::unordered_map<uint32_t, int> procedures;
+
+  int use(Name name);
+
+public:
+  virtual void visit(NSkip* nSkip, uint64_t flag) { };
+  virtual void visit(NInteger* nInteger, uint64_t flag) { };
+  virtual void visit(NBool* nBool, uint64_t flag) { };
+  virtual void visit(NDouble* nDouble, uint64_t flag) { };
+  virtual void visit(NType* nType, uint64_t flag) { };
+  virtual void visit(NSecurity* nSecurity, uint64_t flag) { };
+  virtual void visit(NIdentifier* nIdentifier, uint64_t flag);
+  virtual void visit(NIfExpression* nIfExpression, uint64_t flag) { };
+  virtual void visit(NWhileExpression* nWhileExpression, uint64_t flag) { };
+  virtual void visit(NBinaryOperator* nBinaryOperator, uint64_t flag) { };
+  virtual void visit(NAssignment* nAssignment, uint64_t flag);
+  virtual void visit(NBlock* nBlock, uint64_t flag);
+  virtual void visit(NExpressionStatement* nExpressionStatement, uint64_t flag) { };
+  virtual void visit(NVariableDeclaration* nVariableDeclaration, uint64_t flag);
+  virtual void visit(NProcedure* nProcedure, uint64_t flag);
+  virtual void visit(NCall* nCall, uint64_t flag);
+  virtual void visit(NElement* nElement, uint64_t flag);
+  virtual void visit(NElementAssignment* nElementAssignment, uint64_t flag);
+
+  ResolveVisitor();
+  ~ResolveVisitor();
+  // Binds the flat form's names, in its slots as well as in its nodes
+  void resolve(FlatAst& flat);
+  void setVerbose(bool v) { verbose = v; };
+  bool getVerbose() { return verbose; };
+  int getSlotCount() { return slots; };
+  int getUnresolvedCount() { return unresolved; };
+  int getProcedureCount() { return procedures.size(); };
+  int getArrayCount() { return arrays; };
+};
+#endif // __RESOLVE_VISITOR_H_
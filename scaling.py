@@ -0,0 +1,145 @@
+#!/usr/bin/python
+# Measures how each compiler phase scales with the program.  Sweeps the
+# size, the nesting depth, the number of variables, the number of security
+# labels and the number of type errors of generated programs, times every
+# phase with -T json, and fits time ~ nodes^k on a log-log scale.  A phase
+# whose exponent k is above the threshold grows faster than the AST and is
+# flagged.  The nesting sweep stresses depth alone, thousands of levels
+# deep, and a crash there usually means something recursed too deeply.
+# Usage: scaling.py [-q] [-r repeat] [-t threshold] [sweeps...]
+import argparse
+import json
+import math
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+import generate
+
+# Name, parameter values, and generator arguments for each value.  Every
+# sweep grows the program with its parameter, so a linear compiler shows
+# k close to 1 everywhere.
+SWEEPS = [
+  ("size", [1000, 2000, 4000, 8000, 16000, 32000],
+   lambda n: dict(statements=n)),
+  ("depth", [1, 2, 4, 8, 16, 32, 64],
+   lambda d: dict(statements=500 * d, depth=d)),
+  ("vars", [16, 64, 256, 1024, 4096],
+   lambda v: dict(statements=8 * v, nvars=v)),
+  ("labels", [1, 4, 16, 64, 254],
+   lambda l: dict(statements=100 * l, nlabels=l, high=0.1)),
+  ("errors", [1000, 2000, 4000, 8000, 16000],
+   lambda n: dict(statements=n, errors=n // 50)),
+  ("nesting", [1000, 4000, 16000, 64000, 256000],
+   lambda d: dict(nested=d)),
+]
+QUICK = 2           # Points per sweep dropped from the top with -q
+NOISE_MS = 1.0      # Phases that never take longer than this are not fitted
+
+def measure(command, fname, workdir, repeat, codegen):
+  """ Runs the compiler on fname and returns the fastest time of each phase
+  and the counters, or None if it crashed """
+  best = {}
+  counters = {}
+  args = [command, "-T", "json", "-r", "0", "-g", "1" if codegen else "0", "-f", fname]
+  for i in range(repeat):
+    # Type errors fail the run but are still timed; bitcode goes to workdir
+    proc = subprocess.run(args, cwd=workdir, stdout=subprocess.DEVNULL,
+                          stderr=subprocess.PIPE, timeout=600)
+    if proc.returncode < 0:
+      sys.stderr.write("ERR: %s crashed on %s with signal %d\n" % (command, fname, -proc.returncode))
+      return None, counters
+    for line in proc.stderr.decode().splitlines():
+      if not line.startswith("{"): continue
+      record = json.loads(line)
+      if "phase" in record:
+        phase = record["phase"]
+        best[phase] = min(best.get(phase, record["wall_ms"]), record["wall_ms"])
+      else:
+        counters[record["counter"]] = record["value"]
+  return best, counters
+
+def slope(xs, ys):
+  """ Least squares exponent k of y = c * x^k """
+  lx = [math.log(x) for x in xs]
+  ly = [math.log(max(y, 1e-3)) for y in ys]
+  mx = sum(lx) / len(lx)
+  my = sum(ly) / len(ly)
+  var = sum((x - mx) ** 2 for x in lx)
+  if var == 0: return 0.0
+  return sum((x - mx) * (y - my) for x, y in zip(lx, ly)) / var
+
+def sweep(command, name, values, params, args, workdir):
+  print("== %s" % name)
+  rows = []
+  phases = []
+  crashed = []
+  for value in values:
+    kwargs = params(value)
+    kwargs["seed"] = args.seed
+    fname = os.path.join(workdir, "%s_%d.cmd" % (name, value))
+    with open(fname, "w") as out:
+      out.write(generate.generate(**kwargs))
+    times, counters = measure(command, fname, workdir, args.repeat,
+                              codegen=kwargs.get("errors", 0) == 0)
+    if times is None:
+      crashed.append(value)
+      continue
+    if "ast.nodes" not in counters:
+      sys.stderr.write("ERR: %s did not parse\n" % fname)
+    for phase in times:
+      if phase not in phases: phases.append(phase)
+    rows.append((value, counters.get("ast.nodes", 0), times))
+
+  print("%8s %9s" % (name, "nodes") + "".join(" %10s" % p for p in phases))
+  for value, nodes, times in rows:
+    print("%8d %9d" % (value, nodes) +
+          "".join(" %10.3f" % times[p] if p in times else " %10s" % "-" for p in phases))
+
+  flagged = []
+  line = "%8s %9s" % ("k", "")
+  for phase in phases:
+    points = [(nodes, times[phase]) for value, nodes, times in rows if phase in times and nodes > 0]
+    if len(points) < 3 or max(t for n, t in points) < NOISE_MS:
+      line += " %10s" % "-"
+      continue
+    k = slope([n for n, t in points], [t for n, t in points])
+    line += " %10.2f" % k
+    if k > args.threshold: flagged.append((phase, k))
+  print(line)
+  for phase, k in flagged:
+    print("SUPERLINEAR: %s grows as nodes^%.2f in the %s sweep" % (phase, k, name))
+  for value in crashed:
+    print("CRASH: %s = %d" % (name, value))
+    flagged.append(("crash", value))
+  print("")
+  return flagged
+
+def main(argv):
+  parser = argparse.ArgumentParser(description="Times every compiler phase on growing programs.")
+  parser.add_argument("-c", "--command", default="./command")
+  parser.add_argument("-q", "--quick", action="store_true", help="skip the largest programs")
+  parser.add_argument("-r", "--repeat", type=int, default=3, help="runs per program, the fastest counts")
+  parser.add_argument("-s", "--seed", type=int, default=0)
+  parser.add_argument("-t", "--threshold", type=float, default=1.2, help="exponent above which a phase is flagged")
+  parser.add_argument("sweeps", nargs="*", help="any of " + ", ".join(s[0] for s in SWEEPS))
+  args = parser.parse_args(argv[1:])
+  if not os.path.exists(args.command):
+    sys.stderr.write("ERR: Build %s first.\n" % args.command)
+    return 1
+  command = os.path.abspath(args.command)
+  workdir = tempfile.mkdtemp(prefix="scaling")
+  flagged = []
+  try:
+    for name, values, params in SWEEPS:
+      if args.sweeps and name not in args.sweeps: continue
+      if args.quick: values = values[:-QUICK]
+      flagged += sweep(command, name, values, params, args, workdir)
+  finally:
+    shutil.rmtree(workdir)
+  return 1 if flagged else 0
+
+if __name__ == "__main__":
+  sys.exit(main(sys.argv))
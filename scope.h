@@ -20,76 +20,63 @@
 //
 #ifndef __SCOPE_H_
 #define __SCOPE_H_
-#include <list>
-#include <map>
+#include "intern.h"
+#include "lattice.h"
+#include <utility>
+#include <vector>
 #include <llvm/IR/Value.h>
 #include <llvm/IR/Type.h>
 
 class SType {
 public:
   llvm::Type* type;
-  std::string sec;
-  SType(llvm::Type* type, std::string sec) : type(type), sec(sec) { }
-  SType() : type(NULL), sec("") { }
-};
-
-class Symbol {
-public:
-  llvm::Value* value;
-  SType* stype;
-  Symbol(llvm::Value* value, SType* stype) : value(value), stype(stype) { }
-};
-
-class SymbolTable {
-private:
-  std::string name;
-  std::map<std::string, Symbol*> locals;
-
-public:
-  SymbolTable(std::string name) : name(name) { }
-  ~SymbolTable() {
-    for (std::map<std::string, Symbol*>::iterator it=locals.begin(); it != locals.end(); ++it) {
-      delete it->second;
-    }
-  }
-  void Insert(std::string name, Symbol* sym) { locals[name] = sym; }
-  Symbol* LookUp(std::string name) {
-    if (locals.find(name) == locals.end()) {
-      return NULL;
-    }
-    return locals[name];
-  }
+  Label sec;
+  bool valid; // False for expressions that failed to type-check
+  SType(llvm::Type* type, Label sec) : type(type), sec(sec), valid(true) { }
+  SType() : type(NULL), sec(Lattice::BOTTOM), valid(false) { }
 };
 
+// Flat, contiguous scope stack.  Each name id indexes straight into
+// `bindings`, which holds the slot of the innermost visible declaration.
+// Declarations that shadow an outer one are recorded in an undo log so that
+// FinalizeScope can restore the outer binding.
 class Scope {
 private:
-  std::list<SymbolTable*> scope;
-  std::list<std::string> security_context;
+  std::vector<int> bindings;
+  std::vector<std::pair<uint32_t, int> > undo;
+  std::vector<size_t> marks;
+  std::vector<Label> security_context;
 
 public:
   Scope() { }
-  int depth() { return scope.size(); }
-  void InitializeScope(std::string name = "", std::string sec = "") {
-    scope.push_front(new SymbolTable(name));
-    security_context.push_front(sec);
+  int depth() { return marks.size(); }
+  void InitializeScope(Label sec = Lattice::BOTTOM) {
+    marks.push_back(undo.size());
+    security_context.push_back(sec);
   }
   void FinalizeScope() {
-    SymbolTable* toDelete = scope.front();
-    scope.pop_front();
-    delete toDelete;
-    security_context.pop_front();
-  }
-  void Insert(std::string name, Symbol* sym) { scope.front()->Insert(name, sym); }
-  Symbol* LookUp(std::string name) {
-    for (std::list<SymbolTable*>::iterator it=scope.begin(); it != scope.end(); ++it)
-    {
-      Symbol* sym = (*it)->LookUp(name);
-      if (sym != NULL) return sym;
+    size_t mark = marks.back();
+    while (undo.size() > mark) {
+      bindings[undo.back().first] = undo.back().second;
+      undo.pop_back();
     }
-    return NULL;
+    marks.pop_back();
+    security_context.pop_back();
+  }
+  void Insert(Name name, int slot) {
+    uint32_t id = name.getId();
+    if (id >= bindings.size()) bindings.resize(id + 1, -1);
+    undo.push_back(std::make_pair(id, bindings[id]));
+    bindings[id] = slot;
+  }
+  // Returns the slot bound to name, or -1 if it is not declared
+  int LookUp(Name name) {
+    uint32_t id = name.getId();
+    if (id >= bindings.size()) return -1;
+    return bindings[id];
   }
-  std::string getSecurityContext() {
-    return security_context.front();
+  Label getSecurityContext() {
+    return security_context.back();
   }
 };
 #endif // __SCOPE_H_
@@ -0,0 +1,312 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#include "node.h"
+#include "shadowVis.h"
+#include <iostream>
+
+ShadowVisitor::ShadowVisitor(Lattice* lattice, int slots) : lattice(lattice)
+{
+  assert(lattice->isSealed());
+  declared.assign(slots, Lattice::BOTTOM);
+  declaredAt.assign(slots, 0);
+  shadowed.assign(slots, false);
+  seen.assign(slots, 0);
+  pcs.push_back(Lattice::BOTTOM);
+  guards.push_back(-1);
+}
+
+/* Called once the guard of an if or a while is visited */
+void ShadowVisitor::openBranch(Node* element)
+{
+  int guard = guardCount++;
+  // The guard's label depends on what it reads and on the guards around it
+  for (std::vector<int>::iterator it = reads.begin(); it != reads.end(); ++it) {
+    edges.push_back(std::make_pair(guardNode(guard), *it));
+  }
+  if (guards.back() >= 0) edges.push_back(std::make_pair(guardNode(guard), guardNode(guards.back())));
+  Label sec = bounds.empty() ? (Label) Lattice::BOTTOM : bounds.back();
+  bounds.clear();
+  reads.clear();
+  pcs.push_back(lattice->join(pcs.back(), sec));
+  guards.push_back(guard);
+  Branch& branch = branches[element];
+  branch.pc = pcs.back();
+  branch.declared = declarations;
+  open.push_back(&branch);
+}
+
+/* Keeps the first store to each variable declared outside the branch in
+ * the part that closes, and passes them on to the part around it.  Under a
+ * bottom context nothing is listed: raising to bottom is a no-op, and the
+ * contexts around it are bottom too. */
+void ShadowVisitor::closePart()
+{
+  Branch* branch = open.back();
+  if (branch->pc == Lattice::BOTTOM) return;
+  std::vector<std::pair<int, int> >& stores = branch->raised[branch->part];
+  stamp++;
+  size_t kept = 0;
+  for (size_t i = 0; i < stores.size(); i++) {
+    int slot = stores[i].first;
+    if (seen[slot] == stamp || declaredAt[slot] >= branch->declared) continue;
+    seen[slot] = stamp;
+    stores[kept++] = stores[i];
+  }
+  stores.resize(kept);
+  if (open.size() < 2) return;
+  Branch* outer = open[open.size() - 2];
+  if (outer->pc == Lattice::BOTTOM) return;
+  std::vector<std::pair<int, int> >& outerStores = outer->raised[outer->part];
+  outerStores.insert(outerStores.end(), stores.begin(), stores.end());
+}
+
+void ShadowVisitor::closeBranch()
+{
+  pcs.pop_back();
+  guards.pop_back();
+  open.pop_back();
+}
+
+void ShadowVisitor::visit(NInteger* element, uint64_t flag)
+{
+  bounds.push_back(Lattice::BOTTOM);
+}
+
+void ShadowVisitor::visit(NBool* element, uint64_t flag)
+{
+  bounds.push_back(Lattice::BOTTOM);
+}
+
+void ShadowVisitor::visit(NDouble* element, uint64_t flag)
+{
+  bounds.push_back(Lattice::BOTTOM);
+}
+
+void ShadowVisitor::visit(NSecurity* element, uint64_t flag)
+{
+  // Declarations without a label are low
+  pendingLabel = element->name.empty() ? (Label) Lattice::BOTTOM : (Label) lattice->lookUp(element->name);
+}
+
+void ShadowVisitor::visit(NIdentifier* element, uint64_t flag)
+{
+  if (element->slot < 0) {
+    bounds.push_back(Lattice::BOTTOM); // The type checker reports it
+    return;
+  }
+  bounds.push_back(declared[element->slot]);
+  reads.push_back(element->slot);
+}
+
+void ShadowVisitor::visit(NBinaryOperator* element, uint64_t flag)
+{
+  Label rhs = bounds.back();
+  bounds.pop_back();
+  bounds.back() = lattice->join(bounds.back(), rhs);
+}
+
+void ShadowVisitor::visit(NVariableDeclaration* element, uint64_t flag)
+{
+  int slot = element->id.slot;
+  declared[slot] = pendingLabel;
+  declaredAt[slot] = declarations++;
+  if (element->assignmentExpr != NULL) initializing = slot;
+  bounds.clear();
+  reads.clear();
+  if (verbose) std::cout << "ShadowVisitor declaring " << element->id.name.str() << " "
+                         << lattice->getName(pendingLabel).str() << std::endl;
+}
+
+void ShadowVisitor::visit(NAssignment* element, uint64_t flag)
+{
+  int slot = element->lhs.slot;
+  Label rhs = bounds.empty() ? (Label) Lattice::BOTTOM : bounds.back();
+  bounds.clear();
+  if (slot < 0) {
+    reads.clear();
+    return;
+  }
+  if (slot == initializing) {
+    // The declaration sets the shadow, the initializer is only checked
+    initializing = -1;
+  } else {
+    for (std::vector<int>::iterator it = reads.begin(); it != reads.end(); ++it) {
+      edges.push_back(std::make_pair(slot, *it));
+    }
+    if (guards.back() >= 0) edges.push_back(std::make_pair(slot, guardNode(guards.back())));
+  }
+  if (!lattice->flowsTo(lattice->join(rhs, pcs.back()), declared[slot])) {
+    // Checked at run time, on the shadows of what it reads
+    checks++;
+    roots.insert(roots.end(), reads.begin(), reads.end());
+    if (guards.back() >= 0) roots.push_back(guardNode(guards.back()));
+    if (verbose) std::cout << "ShadowVisitor checking the store to " << element->lhs.name.str()
+                           << " on line " << element->lineno << std::endl;
+  }
+  if (!open.empty() && open.back()->pc != Lattice::BOTTOM) {
+    open.back()->raised[open.back()->part].push_back(std::make_pair(slot, element->lineno));
+  }
+  reads.clear();
+}
+
+void ShadowVisitor::visit(NIfExpression* element, uint64_t flag)
+{
+  switch (flag)
+  {
+    case V_FLAG_GUARD | V_FLAG_ENTER:
+      bounds.clear();
+      reads.clear();
+      break;
+    case V_FLAG_GUARD | V_FLAG_EXIT:
+      openBranch(element);
+      break;
+    case V_FLAG_THEN | V_FLAG_ENTER:
+      open.back()->part = 0;
+      break;
+    case V_FLAG_THEN | V_FLAG_EXIT:
+      closePart();
+      break;
+    case V_FLAG_ELSE | V_FLAG_ENTER:
+      open.back()->part = 1;
+      break;
+    case V_FLAG_ELSE | V_FLAG_EXIT:
+      closePart();
+      break;
+    case V_FLAG_EXIT:
+      closeBranch();
+      break;
+    default:
+      break;
+  }
+}
+
+void ShadowVisitor::visit(NWhileExpression* element, uint64_t flag)
+{
+  switch (flag)
+  {
+    case V_FLAG_GUARD | V_FLAG_ENTER:
+      bounds.clear();
+      reads.clear();
+      break;
+    case V_FLAG_GUARD | V_FLAG_EXIT:
+      openBranch(element);
+      break;
+    case V_FLAG_THEN | V_FLAG_ENTER:
+      open.back()->part = 0;
+      break;
+    case V_FLAG_THEN | V_FLAG_EXIT:
+      closePart();
+      break;
+    case V_FLAG_EXIT:
+      closeBranch();
+      break;
+    default:
+      break;
+  }
+}
+
+void ShadowVisitor::visit(NExpressionStatement* element, uint64_t flag)
+{
+  bounds.clear();
+  reads.clear();
+}
+
+void ShadowVisitor::visit(NBlock* element, uint64_t flag)
+{
+  bounds.clear();
+  reads.clear();
+}
+
+/* Gives a shadow to every variable a check reads, and to every variable
+ * those shadows depend on in turn.  A variable declared low is always low,
+ * so it needs no shadow and what it depends on does not matter.  Then
+ * keeps, of the variables each part of each branch stores to, those to
+ * raise or check when that part is not taken.  A store in a part runs
+ * under a context at least as high as the part's, so if raising a variable
+ * needs a check, so did the store, and the guards are already among the
+ * roots. */
+void ShadowVisitor::finish()
+{
+  size_t nodes = declared.size() + guardCount;
+  std::vector<size_t> first(nodes + 1, 0);
+  for (std::vector<std::pair<int, int> >::iterator it = edges.begin(); it != edges.end(); ++it) {
+    first[it->first + 1]++;
+  }
+  for (size_t i = 0; i < nodes; i++) first[i + 1] += first[i];
+  std::vector<int> targets(edges.size());
+  std::vector<size_t> fill(first.begin(), first.end() - 1);
+  for (std::vector<std::pair<int, int> >::iterator it = edges.begin(); it != edges.end(); ++it) {
+    targets[fill[it->first]++] = it->second;
+  }
+  std::vector<bool> reached(nodes, false);
+  std::vector<int> work;
+  for (std::vector<int>::iterator it = roots.begin(); it != roots.end(); ++it) {
+    if (!reached[*it]) {
+      reached[*it] = true;
+      work.push_back(*it);
+    }
+  }
+  while (!work.empty()) {
+    int node = work.back();
+    work.pop_back();
+    if (node < (int) declared.size()) {
+      if (declared[node] == Lattice::BOTTOM) continue;
+      shadowed[node] = true;
+    }
+    for (size_t i = first[node]; i < first[node + 1]; i++) {
+      if (!reached[targets[i]]) {
+        reached[targets[i]] = true;
+        work.push_back(targets[i]);
+      }
+    }
+  }
+
+  for (std::unordered_map<Node*, Branch>::iterator it = branches.begin(); it != branches.end(); ++it) {
+    Branch& branch = it->second;
+    if (branch.pc == Lattice::BOTTOM) continue; // Lists nothing
+    for (int part = 0; part < 2; part++) {
+      std::vector<std::pair<int, int> >& raised = branch.raised[part];
+      size_t kept = 0;
+      for (size_t i = 0; i < raised.size(); i++) {
+        int slot = raised[i].first;
+        if (shadowed[slot] || !lattice->flowsTo(branch.pc, declared[slot])) raised[kept++] = raised[i];
+      }
+      raised.resize(kept);
+    }
+  }
+  if (verbose) std::cout << "ShadowVisitor " << checks << " checks, " << getShadowCount()
+                         << " shadows" << std::endl;
+}
+
+const std::vector<std::pair<int, int> >& ShadowVisitor::getRaised(Node* branch, int part) const
+{
+  static const std::vector<std::pair<int, int> > none;
+  std::unordered_map<Node*, Branch>::const_iterator it = branches.find(branch);
+  if (it == branches.end()) return none;
+  return it->second.raised[part];
+}
+
+int ShadowVisitor::getShadowCount() const
+{
+  int count = 0;
+  for (size_t i = 0; i < shadowed.size(); i++) count += shadowed[i];
+  return count;
+}
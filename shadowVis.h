@@ -0,0 +1,124 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __SHADOW_VISITOR_H_
+#define __SHADOW_VISITOR_H_
+#include "node.h"
+#include "visitor.h"
+#include "lattice.h"
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Plans run-time information-flow tracking, for programs whose flows the
+// type checker could not prove safe.  At run time every variable holds the
+// label of its current value, its shadow.  A declaration sets the shadow
+// to the label the variable is declared with, and every later store to
+// the label of the value stored, so the shadow never rises above the
+// declared label and drops below it while the variable holds less
+// sensitive data.  A store checks that its value's label,
+// joined with the labels of the guards around it, flows to the declared
+// label, and otherwise stops the program.  A branch not taken raises the
+// shadows of the variables it would have assigned to the guard's label,
+// so that which branch ran cannot leak either.
+//
+// Whatever the declared labels already prove is left out.  Only the stores
+// the static bounds cannot show safe are checked.  Only the variables whose
+// shadows reach one of those checks, through the stores and guards they
+// depend on, get a shadow; every other variable is taken to be as high as
+// it was declared.  Runs after the ResolveVisitor and the SimplifyVisitor,
+// right before code generation, which asks it for the plan.
+class ShadowVisitor : public Visitor {
+private:
+  class Branch {
+  public:
+    Label pc;              // Bound of the context inside the branch
+    size_t declared;       // Variables declared from here on are inside
+    int part = 0;          // 0 in the then part or the body, 1 in the else part
+    // Slot and line of the first store to each variable declared outside,
+    // per part, built as the parts close and filtered by finish()
+    std::vector<std::pair<int, int> > raised[2];
+  };
+
+  bool verbose = false;
+  Lattice* lattice;
+  std::vector<Label> declared;       // Indexed by NIdentifier::slot
+  std::vector<size_t> declaredAt;    // Declarations seen before it
+  std::vector<bool> shadowed;
+  std::vector<Label> bounds;         // Upper bounds of the open expressions
+  std::vector<int> reads;            // Slots read by the open expression
+  std::vector<Label> pcs;            // Bounds of the enclosing contexts
+  std::vector<int> guards;           // Graph nodes of the enclosing guards
+  std::vector<std::pair<int, int> > edges; // Shadow of first depends on second
+  std::vector<int> roots;            // Nodes whose labels a check reads
+  std::vector<size_t> seen;          // Stamp of the last part a slot was listed in
+  std::unordered_map<Node*, Branch> branches;
+  std::vector<Branch*> open;           // Branches being visited
+  int guardCount = 0;
+  size_t stamp = 0;
+  size_t declarations = 0;
+  int checks = 0;
+  Label pendingLabel = Lattice::BOTTOM;
+  int initializing = -1;             // Slot of the declaration being initialized
+
+  int guardNode(int guard) { return declared.size() + guard; };
+  void openBranch(Node* element);
+  void closePart();
+  void closeBranch();
+
+public:
+  virtual void visit(NSkip* nSkip, uint64_t flag) { };
+  virtual void visit(NInteger* nInteger, uint64_t flag);
+  virtual void visit(NBool* nBool, uint64_t flag);
+  virtual void visit(NDouble* nDouble, uint64_t flag);
+  virtual void visit(NType* nType, uint64_t flag) { };
+  virtual void visit(NSecurity* nSecurity, uint64_t flag);
+  virtual void visit(NIdentifier* nIdentifier, uint64_t flag);
+  virtual void visit(NIfExpression* nIfExpression, uint64_t flag);
+  virtual void visit(NWhileExpression* nWhileExpression, uint64_t flag);
+  virtual void visit(NBinaryOperator* nBinaryOperator, uint64_t flag);
+  virtual void visit(NAssignment* nAssignment, uint64_t flag);
+  virtual void visit(NBlock* nBlock, uint64_t flag);
+  virtual void visit(NExpressionStatement* nExpressionStatement, uint64_t flag);
+  virtual void visit(NVariableDeclaration* nVariableDeclaration, uint64_t flag);
+  // Tracking is not offered for programs with procedures or arrays
+  virtual void visit(NProcedure* nProcedure, uint64_t flag) { };
+  virtual void visit(NCall* nCall, uint64_t flag) { };
+  virtual void visit(NElement* nElement, uint64_t flag) { };
+  virtual void visit(NElementAssignment* nElementAssignment, uint64_t flag) { };
+
+  // slots is the number of variable slots handed out by the ResolveVisitor
+  ShadowVisitor(Lattice* lattice, int slots);
+  // Decides which variables get a shadow, once the whole tree is visited
+  void finish();
+  Label getDeclared(int slot) const { return declared[slot]; };
+  bool isShadowed(int slot) const { return shadowed[slot]; };
+  // Variables declared outside branch, an if or a while, that a part of it
+  // assigns to and whose shadows must rise, or whose declared labels must
+  // be checked, when that part is not taken, each with the line of its
+  // first store there.  part is 0 for the then part of an if and the body
+  // of a while, 1 for the else part of an if.
+  const std::vector<std::pair<int, int> >& getRaised(Node* branch, int part) const;
+  int getShadowCount() const;
+  int getCheckCount() const { return checks; };
+  void setVerbose(bool v) { verbose = v; };
+  bool getVerbose() { return verbose; };
+};
+#endif // __SHADOW_VISITOR_H_
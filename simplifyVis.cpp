@@ -0,0 +1,338 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#include "node.h"
+#include "simplifyVis.h"
+#include "parser.hpp"
+#include <stdint.h>
+#include <iostream>
+
+static bool isTrue(NBool* element)
+{
+  return element->value.compare("true") == 0;
+}
+
+/* Expressions without assignments can be dropped when their value is unused.
+ * Reading an element is kept, as an index out of bounds traps. */
+static bool isPure(NExpression* element)
+{
+  if (dynamic_cast<NIdentifier*>(element) || dynamic_cast<NInteger*>(element) ||
+      dynamic_cast<NDouble*>(element) || dynamic_cast<NBool*>(element) ||
+      dynamic_cast<NSkip*>(element)) {
+    return true;
+  }
+  NBinaryOperator* binop = dynamic_cast<NBinaryOperator*>(element);
+  return binop != NULL && isPure(&binop->lhs) && isPure(&binop->rhs);
+}
+
+/* Evaluates an operator over two literals the way the generated code would:
+ * integers wrap, doubles compare unordered, bools only compare for equality.
+ * Returns NULL when the result is left to run time, e.g. division by zero. */
+NExpression* SimplifyVisitor::fold(NBinaryOperator* element, NExpression* lhs, NExpression* rhs)
+{
+  NExpression* result = NULL;
+  NInteger* li = dynamic_cast<NInteger*>(lhs);
+  NInteger* ri = dynamic_cast<NInteger*>(rhs);
+  NDouble* ld = dynamic_cast<NDouble*>(lhs);
+  NDouble* rd = dynamic_cast<NDouble*>(rhs);
+  NBool* lb = dynamic_cast<NBool*>(lhs);
+  NBool* rb = dynamic_cast<NBool*>(rhs);
+  if (li && ri) {
+    int64_t a = li->value, b = ri->value;
+    switch (element->op) {
+      case TPLUS:  result = arena.make<NInteger>((int64_t) ((uint64_t) a + (uint64_t) b)); break;
+      case TMINUS: result = arena.make<NInteger>((int64_t) ((uint64_t) a - (uint64_t) b)); break;
+      case TMUL:   result = arena.make<NInteger>((int64_t) ((uint64_t) a * (uint64_t) b)); break;
+      case TDIV:
+        if (b == 0 || (b == -1 && a == INT64_MIN)) return NULL;
+        result = arena.make<NInteger>(a / b);
+        break;
+      case TCEQ: result = arena.make<NBool>(a == b ? "true" : "false"); break;
+      case TCNE: result = arena.make<NBool>(a != b ? "true" : "false"); break;
+      case TCLT: result = arena.make<NBool>(a < b ? "true" : "false"); break;
+      case TCLE: result = arena.make<NBool>(a <= b ? "true" : "false"); break;
+      case TCGT: result = arena.make<NBool>(a > b ? "true" : "false"); break;
+      case TCGE: result = arena.make<NBool>(a >= b ? "true" : "false"); break;
+      default: return NULL;
+    }
+  } else if (ld && rd) {
+    double a = ld->value, b = rd->value;
+    switch (element->op) {
+      case TPLUS:  result = arena.make<NDouble>(a + b); break;
+      case TMINUS: result = arena.make<NDouble>(a - b); break;
+      case TMUL:   result = arena.make<NDouble>(a * b); break;
+      case TDIV:   result = arena.make<NDouble>(a / b); break;
+      case TCEQ: result = arena.make<NBool>(!(a < b) && !(a > b) ? "true" : "false"); break;
+      case TCNE: result = arena.make<NBool>(a != b ? "true" : "false"); break;
+      case TCLT: result = arena.make<NBool>(!(a >= b) ? "true" : "false"); break;
+      case TCLE: result = arena.make<NBool>(!(a > b) ? "true" : "false"); break;
+      case TCGT: result = arena.make<NBool>(!(a <= b) ? "true" : "false"); break;
+      case TCGE: result = arena.make<NBool>(!(a < b) ? "true" : "false"); break;
+      default: return NULL;
+    }
+  } else if (lb && rb) {
+    switch (element->op) {
+      case TCEQ: result = arena.make<NBool>(isTrue(lb) == isTrue(rb) ? "true" : "false"); break;
+      case TCNE: result = arena.make<NBool>(isTrue(lb) != isTrue(rb) ? "true" : "false"); break;
+      default: return NULL;
+    }
+  } else {
+    return NULL;
+  }
+  result->lineno = element->lineno;
+  folded++;
+  return result;
+}
+
+/* Decides what becomes of a statement once its value is known to be unused */
+SimplifyVisitor::Item SimplifyVisitor::settle(Node* statement)
+{
+  if (NIfExpression* element = dynamic_cast<NIfExpression*>(statement)) {
+    if (NBool* guard = dynamic_cast<NBool*>(&element->iguard)) {
+      pruned++;
+      NBlock& taken = isTrue(guard) ? element->ithen : element->ielse;
+      if (taken.statements.empty()) return Item(NULL);
+      return Item(&taken, true);
+    }
+    if (element->ithen.statements.empty() && element->ielse.statements.empty() &&
+        isPure(&element->iguard)) {
+      dropped++;
+      return Item(NULL);
+    }
+  } else if (NWhileExpression* element = dynamic_cast<NWhileExpression*>(statement)) {
+    NBool* guard = dynamic_cast<NBool*>(&element->iguard);
+    if (guard != NULL && !isTrue(guard)) {
+      pruned++;
+      return Item(NULL);
+    }
+  } else if (NExpression* element = dynamic_cast<NExpression*>(statement)) {
+    if (dynamic_cast<NBlock*>(element) == NULL && isPure(element)) {
+      dropped++;
+      return Item(NULL);
+    }
+  }
+  return Item(statement);
+}
+
+void SimplifyVisitor::visit(NSkip* element, uint64_t flag)
+{
+  if (verbose) std::cout << "SimplifyVisitor " << typeid(element).name() << std::endl;
+  items.push_back(Item(element));
+}
+
+void SimplifyVisitor::visit(NInteger* element, uint64_t flag)
+{
+  if (verbose) std::cout << "SimplifyVisitor " << typeid(element).name() << std::endl;
+  items.push_back(Item(element));
+}
+
+void SimplifyVisitor::visit(NBool* element, uint64_t flag)
+{
+  if (verbose) std::cout << "SimplifyVisitor " << typeid(element).name() << std::endl;
+  items.push_back(Item(element));
+}
+
+void SimplifyVisitor::visit(NDouble* element, uint64_t flag)
+{
+  if (verbose) std::cout << "SimplifyVisitor " << typeid(element).name() << std::endl;
+  items.push_back(Item(element));
+}
+
+void SimplifyVisitor::visit(NIdentifier* element, uint64_t flag)
+{
+  if (verbose) std::cout << "SimplifyVisitor " << typeid(element).name() << std::endl;
+  items.push_back(Item(element));
+}
+
+void SimplifyVisitor::visit(NIfExpression* element, uint64_t flag)
+{
+  if (flag != V_FLAG_EXIT) return;
+  if (verbose) std::cout << "SimplifyVisitor exit " << typeid(element).name() << std::endl;
+  // The branches were simplified in place
+  pop();
+  pop();
+  NExpression* guard = (NExpression*) pop().node;
+  if (guard == &element->iguard) {
+    items.push_back(Item(element));
+    return;
+  }
+  NIfExpression* rebuilt = arena.make<NIfExpression>(*guard, element->ithen, element->ielse);
+  rebuilt->lineno = element->lineno;
+  items.push_back(Item(rebuilt));
+}
+
+void SimplifyVisitor::visit(NWhileExpression* element, uint64_t flag)
+{
+  if (flag != V_FLAG_EXIT) return;
+  if (verbose) std::cout << "SimplifyVisitor exit " << typeid(element).name() << std::endl;
+  pop();
+  NExpression* guard = (NExpression*) pop().node;
+  if (guard == &element->iguard) {
+    items.push_back(Item(element));
+    return;
+  }
+  NWhileExpression* rebuilt = arena.make<NWhileExpression>(*guard, element->ithen);
+  rebuilt->lineno = element->lineno;
+  items.push_back(Item(rebuilt));
+}
+
+void SimplifyVisitor::visit(NBinaryOperator* element, uint64_t flag)
+{
+  if (verbose) std::cout << "SimplifyVisitor " << typeid(element).name() << std::endl;
+  NExpression* rhs = (NExpression*) pop().node;
+  NExpression* lhs = (NExpression*) pop().node;
+  NExpression* result = fold(element, lhs, rhs);
+  if (result == NULL && (lhs != &element->lhs || rhs != &element->rhs)) {
+    result = arena.make<NBinaryOperator>(*lhs, element->op, *rhs);
+    result->lineno = element->lineno;
+  }
+  items.push_back(Item(result != NULL ? result : element));
+}
+
+void SimplifyVisitor::visit(NAssignment* element, uint64_t flag)
+{
+  if (verbose) std::cout << "SimplifyVisitor " << typeid(element).name() << std::endl;
+  NExpression* rhs = (NExpression*) pop().node;
+  if (declaration != NULL && &element->lhs == &declaration->id) {
+    // The initializer of a declaration, visited through a temporary
+    // assignment; the declaration is already on the stack
+    declaration->assignmentExpr = rhs;
+    declaration = NULL;
+    return;
+  }
+  if (rhs == &element->rhs) {
+    items.push_back(Item(element));
+    return;
+  }
+  NAssignment* rebuilt = arena.make<NAssignment>(element->lhs, *rhs);
+  rebuilt->lineno = element->lineno;
+  items.push_back(Item(rebuilt));
+}
+
+void SimplifyVisitor::visit(NBlock* element, uint64_t flag)
+{
+  switch (flag)
+  {
+    case V_FLAG_ENTER:
+      if (verbose) std::cout << "SimplifyVisitor entering " << typeid(element).name() << std::endl;
+      blocks.push_back(items.size());
+      break;
+    case V_FLAG_EXIT:
+      {
+        if (verbose) std::cout << "SimplifyVisitor leaving " << typeid(element).name() << std::endl;
+        StatementList statements;
+        for (size_t i = blocks.back(); i < items.size(); i++) {
+          // Blocks also hold bare expressions, as the parser puts them there
+          Item item = items[i].splice ? items[i] : settle(items[i].node);
+          if (item.node == NULL) continue;
+          if (item.splice) {
+            StatementList& inner = ((NBlock*) item.node)->statements;
+            statements.insert(statements.end(), inner.begin(), inner.end());
+          } else {
+            statements.push_back((NStatement*) item.node);
+          }
+        }
+        element->statements.swap(statements);
+        items.resize(blocks.back(), Item(NULL));
+        blocks.pop_back();
+        items.push_back(Item(element));
+      }
+      break;
+    default:
+      assert(0);
+  }
+}
+
+void SimplifyVisitor::visit(NExpressionStatement* element, uint64_t flag)
+{
+  if (verbose) std::cout << "SimplifyVisitor " << typeid(element).name() << std::endl;
+  Item item = settle(pop().node);
+  if (item.node == NULL || item.splice || item.node == &element->expression) {
+    items.push_back(item.node == &element->expression ? Item(element) : item);
+    return;
+  }
+  NExpressionStatement* rebuilt = arena.make<NExpressionStatement>(*(NExpression*) item.node);
+  rebuilt->lineno = element->lineno;
+  items.push_back(Item(rebuilt));
+}
+
+void SimplifyVisitor::visit(NVariableDeclaration* element, uint64_t flag)
+{
+  if (verbose) std::cout << "SimplifyVisitor " << typeid(element).name() << std::endl;
+  items.push_back(Item(element));
+  if (element->assignmentExpr != NULL) declaration = element;
+}
+
+void SimplifyVisitor::visit(NProcedure* element, uint64_t flag)
+{
+  if (flag != V_FLAG_EXIT) return;
+  if (verbose) std::cout << "SimplifyVisitor exit " << typeid(element).name() << std::endl;
+  // The body was simplified in place, and parameters have nothing to fold
+  pop();
+  items.resize(items.size() - element->params.size(), Item(NULL));
+  items.push_back(Item(element));
+}
+
+void SimplifyVisitor::visit(NCall* element, uint64_t flag)
+{
+  if (verbose) std::cout << "SimplifyVisitor " << typeid(element).name() << std::endl;
+  ExpressionList args(element->args.size());
+  bool changed = false;
+  for (size_t i = args.size(); i-- > 0; ) {
+    args[i] = (NExpression*) pop().node;
+    changed |= args[i] != element->args[i];
+  }
+  if (!changed) {
+    items.push_back(Item(element));
+    return;
+  }
+  NCall* rebuilt = arena.make<NCall>(element->id);
+  rebuilt->args.swap(args);
+  rebuilt->procedure = element->procedure;
+  rebuilt->lineno = element->lineno;
+  items.push_back(Item(rebuilt));
+}
+
+void SimplifyVisitor::visit(NElement* element, uint64_t flag)
+{
+  if (verbose) std::cout << "SimplifyVisitor " << typeid(element).name() << std::endl;
+  NExpression* index = (NExpression*) pop().node;
+  if (index == &element->index) {
+    items.push_back(Item(element));
+    return;
+  }
+  NElement* rebuilt = arena.make<NElement>(element->id, *index);
+  rebuilt->lineno = element->lineno;
+  items.push_back(Item(rebuilt));
+}
+
+void SimplifyVisitor::visit(NElementAssignment* element, uint64_t flag)
+{
+  if (verbose) std::cout << "SimplifyVisitor " << typeid(element).name() << std::endl;
+  NExpression* rhs = (NExpression*) pop().node;
+  NExpression* index = (NExpression*) pop().node;
+  if (index == &element->index && rhs == &element->rhs) {
+    items.push_back(Item(element));
+    return;
+  }
+  NElementAssignment* rebuilt = arena.make<NElementAssignment>(element->id, *index, *rhs);
+  rebuilt->lineno = element->lineno;
+  items.push_back(Item(rebuilt));
+}
@@ -0,0 +1,88 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __SIMPLIFY_VISITOR_H_
+#define __SIMPLIFY_VISITOR_H_
+#include "node.h"
+#include "arena.h"
+#include "visitor.h"
+#include <vector>
+
+// Simplifies the AST between type checking and code generation: folds
+// constant arithmetic and comparisons, replaces if statements with a
+// constant guard by the branch taken, removes while loops that never run,
+// and drops skips and other statements without effect.  The program was
+// already type checked, so its security verdict stays what it was; only the
+// work left to the code generator shrinks.
+//
+// Children are held by reference, so a parent whose children changed is
+// rebuilt in the arena.  Each statement or expression leaves one Item on a
+// stack: its replacement, nothing, or a block to be spliced into the
+// enclosing block.
+class SimplifyVisitor : public Visitor {
+private:
+  class Item {
+  public:
+    Node* node;  // NULL once removed
+    bool splice; // node is an NBlock whose statements replace the item
+    Item(Node* node, bool splice = false) : node(node), splice(splice) { }
+  };
+
+  bool verbose = false;
+  Arena& arena;
+  std::vector<Item> items;
+  std::vector<size_t> blocks; // Item stack depth at each block entry
+  NVariableDeclaration* declaration = NULL; // Waiting for its initializer
+  int folded = 0;
+  int pruned = 0;
+  int dropped = 0;
+
+  Item pop() { Item item = items.back(); items.pop_back(); return item; };
+  NExpression* fold(NBinaryOperator* element, NExpression* lhs, NExpression* rhs);
+  Item settle(Node* statement);
+
+public:
+  virtual void visit(NSkip* nSkip, uint64_t flag);
+  virtual void visit(NInteger* nInteger, uint64_t flag);
+  virtual void visit(NBool* nBool, uint64_t flag);
+  virtual void visit(NDouble* nDouble, uint64_t flag);
+  virtual void visit(NType* nType, uint64_t flag) { };
+  virtual void visit(NSecurity* nSecurity, uint64_t flag) { };
+  virtual void visit(NIdentifier* nIdentifier, uint64_t flag);
+  virtual void visit(NIfExpression* nIfExpression, uint64_t flag);
+  virtual void visit(NWhileExpression* nWhileExpression, uint64_t flag);
+  virtual void visit(NBinaryOperator* nBinaryOperator, uint64_t flag);
+  virtual void visit(NAssignment* nAssignment, uint64_t flag);
+  virtual void visit(NBlock* nBlock, uint64_t flag);
+  virtual void visit(NExpressionStatement* nExpressionStatement, uint64_t flag);
+  virtual void visit(NVariableDeclaration* nVariableDeclaration, uint64_t flag);
+  virtual void visit(NProcedure* nProcedure, uint64_t flag);
+  virtual void visit(NCall* nCall, uint64_t flag);
+  virtual void visit(NElement* nElement, uint64_t flag);
+  virtual void visit(NElementAssignment* nElementAssignment, uint64_t flag);
+
+  SimplifyVisitor(Arena& arena) : arena(arena) { };
+  void setVerbose(bool v) { verbose = v; };
+  bool getVerbose() { return verbose; };
+  int getFoldedCount() { return folded; };
+  int getPrunedCount() { return pruned; };
+  int getDroppedCount() { return dropped; };
+};
+#endif // __SIMPLIFY_VISITOR_H_
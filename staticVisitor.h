@@ -0,0 +1,221 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __STATIC_VISITOR_H_
+#define __STATIC_VISITOR_H_
+#include "node.h"
+#include "visitor.h"
+#include <stdint.h>
+
+// Visitor whose handlers are bound at compile time.  A pass derives from
+// StaticVisitor<Pass>, brings the empty handlers below into scope with
+// "using StaticVisitor<Pass>::visit;", and declares visit, with the same
+// signature as in Visitor, for the nodes it cares about.  walk switches on
+// Node::kind and calls the pass's handlers directly instead of through
+// expand, dispatch and the Visitor vtable, so they can be inlined, and the
+// switch on the flag in a handler folds away wherever the flag is a
+// constant.  Events come in the same order as from Node::accept, on the
+// same kind of work stack.  Visitor stays for the passes that need one
+// type for all of them, such as FlatAst::replay.
+template <class Derived>
+class StaticVisitor {
+public:
+  void visit(NSkip* element, uint64_t flag) { };
+  void visit(NInteger* element, uint64_t flag) { };
+  void visit(NBool* element, uint64_t flag) { };
+  void visit(NDouble* element, uint64_t flag) { };
+  void visit(NType* element, uint64_t flag) { };
+  void visit(NSecurity* element, uint64_t flag) { };
+  void visit(NIdentifier* element, uint64_t flag) { };
+  void visit(NIfExpression* element, uint64_t flag) { };
+  void visit(NWhileExpression* element, uint64_t flag) { };
+  void visit(NBinaryOperator* element, uint64_t flag) { };
+  void visit(NAssignment* element, uint64_t flag) { };
+  void visit(NBlock* element, uint64_t flag) { };
+  void visit(NExpressionStatement* element, uint64_t flag) { };
+  void visit(NVariableDeclaration* element, uint64_t flag) { };
+  void visit(NProcedure* element, uint64_t flag) { };
+  void visit(NCall* element, uint64_t flag) { };
+  void visit(NElement* element, uint64_t flag) { };
+  void visit(NElementAssignment* element, uint64_t flag) { };
+  // Called before a block is entered, returning true leaves it unvisited
+  bool skip(NBlock* element) { return false; };
+
+  void walk(Node* root) {
+    work.accept(root);
+    while (!work.steps.empty()) {
+      WorkStack::Step step = work.steps.back();
+      work.steps.pop_back();
+      if (step.node == NULL) {
+        work.assignments.pop_back();
+      } else if (step.expand) {
+        // The child to be walked first is expanded right away rather
+        // than pushed and popped again
+        for (Node* node = step.node; node != NULL; node = expand(node));
+      } else {
+        dispatch(step.node, step.flag);
+      }
+    }
+  };
+
+private:
+  WorkStack work;
+
+  Derived& self() { return *static_cast<Derived*>(this); };
+  Node* expand(Node* node);
+  void dispatch(Node* node, uint64_t flag);
+};
+
+/* Same events as the expand of each node in node.h, except that the child
+ * to be walked first is returned instead of pushed, NULL if there is none */
+template <class Derived>
+Node* StaticVisitor<Derived>::expand(Node* node)
+{
+  switch (node->kind) {
+    case N_BLOCK:
+      {
+        NBlock* element = static_cast<NBlock*>(node);
+        if (self().skip(element)) return NULL;
+        self().visit(element, V_FLAG_ENTER);
+        work.visit(element, V_FLAG_EXIT);
+        if (element->statements.empty()) return NULL;
+        for (StatementList::reverse_iterator it = element->statements.rbegin();
+             it != element->statements.rend() - 1; ++it) {
+          work.accept(*it);
+        }
+        return element->statements.front();
+      }
+    case N_IF:
+      {
+        NIfExpression* element = static_cast<NIfExpression*>(node);
+        self().visit(element, V_FLAG_ENTER);
+        self().visit(element, V_FLAG_GUARD | V_FLAG_ENTER);
+        work.visit(element, V_FLAG_EXIT);
+        work.visit(element, V_FLAG_ELSE | V_FLAG_EXIT);
+        work.accept(&element->ielse);
+        work.visit(element, V_FLAG_ELSE | V_FLAG_ENTER);
+        work.visit(element, V_FLAG_THEN | V_FLAG_EXIT);
+        work.accept(&element->ithen);
+        work.visit(element, V_FLAG_THEN | V_FLAG_ENTER);
+        work.visit(element, V_FLAG_GUARD | V_FLAG_EXIT);
+        return &element->iguard;
+      }
+    case N_WHILE:
+      {
+        NWhileExpression* element = static_cast<NWhileExpression*>(node);
+        self().visit(element, V_FLAG_ENTER);
+        self().visit(element, V_FLAG_GUARD | V_FLAG_ENTER);
+        work.visit(element, V_FLAG_EXIT);
+        work.visit(element, V_FLAG_THEN | V_FLAG_EXIT);
+        work.accept(&element->ithen);
+        work.visit(element, V_FLAG_THEN | V_FLAG_ENTER);
+        work.visit(element, V_FLAG_GUARD | V_FLAG_EXIT);
+        return &element->iguard;
+      }
+    case N_BINARY:
+      {
+        NBinaryOperator* element = static_cast<NBinaryOperator*>(node);
+        work.visit(element, V_FLAG_NONE);
+        work.accept(&element->rhs);
+        return &element->lhs;
+      }
+    case N_ASSIGNMENT:
+      work.visit(node, V_FLAG_NONE);
+      return &static_cast<NAssignment*>(node)->rhs;
+    case N_EXPRESSION_STATEMENT:
+      work.visit(node, V_FLAG_NONE);
+      return &static_cast<NExpressionStatement*>(node)->expression;
+    case N_DECLARATION:
+      {
+        NVariableDeclaration* element = static_cast<NVariableDeclaration*>(node);
+        self().visit((NType*) &element->type, V_FLAG_NONE);
+        self().visit(&element->security, V_FLAG_NONE);
+        self().visit(element, V_FLAG_NONE);
+        if (element->assignmentExpr != NULL) {
+          work.assignments.emplace_back(element->id, *element->assignmentExpr);
+          work.assignments.back().lineno = element->lineno;
+          work.visit(NULL, 0);
+          return &work.assignments.back();
+        }
+        return NULL;
+      }
+    case N_PROCEDURE:
+      {
+        NProcedure* element = static_cast<NProcedure*>(node);
+        self().visit(element, V_FLAG_ENTER);
+        work.visit(element, V_FLAG_EXIT);
+        work.visit(element, V_FLAG_THEN | V_FLAG_EXIT);
+        work.accept(&element->body);
+        work.visit(element, V_FLAG_THEN | V_FLAG_ENTER);
+        for (VariableList::reverse_iterator it = element->params.rbegin(); it != element->params.rend(); ++it) {
+          work.accept(*it);
+        }
+        return &element->pc;
+      }
+    case N_CALL:
+      {
+        NCall* element = static_cast<NCall*>(node);
+        work.visit(element, V_FLAG_NONE);
+        if (element->args.empty()) return NULL;
+        for (ExpressionList::reverse_iterator it = element->args.rbegin();
+             it != element->args.rend() - 1; ++it) {
+          work.accept(*it);
+        }
+        return element->args.front();
+      }
+    case N_ELEMENT:
+      work.visit(node, V_FLAG_NONE);
+      return &static_cast<NElement*>(node)->index;
+    case N_ELEMENT_ASSIGNMENT:
+      work.visit(node, V_FLAG_NONE);
+      work.accept(&static_cast<NElementAssignment*>(node)->rhs);
+      return &static_cast<NElementAssignment*>(node)->index;
+    default:
+      // Leaves have no children, and are visited when expanded
+      dispatch(node, V_FLAG_NONE);
+      return NULL;
+  }
+}
+
+template <class Derived>
+void StaticVisitor<Derived>::dispatch(Node* node, uint64_t flag)
+{
+  switch (node->kind) {
+    case N_BLOCK: self().visit(static_cast<NBlock*>(node), flag); break;
+    case N_SKIP: self().visit(static_cast<NSkip*>(node), flag); break;
+    case N_INTEGER: self().visit(static_cast<NInteger*>(node), flag); break;
+    case N_BOOL: self().visit(static_cast<NBool*>(node), flag); break;
+    case N_DOUBLE: self().visit(static_cast<NDouble*>(node), flag); break;
+    case N_TYPE: self().visit(static_cast<NType*>(node), flag); break;
+    case N_SECURITY: self().visit(static_cast<NSecurity*>(node), flag); break;
+    case N_IDENTIFIER: self().visit(static_cast<NIdentifier*>(node), flag); break;
+    case N_IF: self().visit(static_cast<NIfExpression*>(node), flag); break;
+    case N_WHILE: self().visit(static_cast<NWhileExpression*>(node), flag); break;
+    case N_BINARY: self().visit(static_cast<NBinaryOperator*>(node), flag); break;
+    case N_ASSIGNMENT: self().visit(static_cast<NAssignment*>(node), flag); break;
+    case N_EXPRESSION_STATEMENT: self().visit(static_cast<NExpressionStatement*>(node), flag); break;
+    case N_DECLARATION: self().visit(static_cast<NVariableDeclaration*>(node), flag); break;
+    case N_PROCEDURE: self().visit(static_cast<NProcedure*>(node), flag); break;
+    case N_CALL: self().visit(static_cast<NCall*>(node), flag); break;
+    case N_ELEMENT: self().visit(static_cast<NElement*>(node), flag); break;
+    case N_ELEMENT_ASSIGNMENT: self().visit(static_cast<NElementAssignment*>(node), flag); break;
+  }
+}
+#endif // __STATIC_VISITOR_H_
@@ -0,0 +1,165 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __TIMINGS_H_
+#define __TIMINGS_H_
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Wall and CPU time of each phase of one compilation, plus a few size
+// counters, for -T.  CPU time is that of the calling thread, so jobs
+// running side by side in batch mode do not count against each other.
+class Timings {
+public:
+  enum Format {
+    OFF = 0,
+    TABLE,  // Aligned columns for people
+    JSON,   // One object per line for scripts
+  };
+
+  class Phase {
+  public:
+    const char* name;
+    double wallMs;
+    double cpuMs;
+    Phase(const char* name, double wallMs, double cpuMs)
+      : name(name), wallMs(wallMs), cpuMs(cpuMs) { }
+  };
+  class Counter {
+  public:
+    const char* name;
+    uint64_t value;
+    Counter(const char* name, uint64_t value) : name(name), value(value) { }
+  };
+
+  // Times the enclosing scope as one phase.  Does nothing when given NULL,
+  // so callers need not check whether timing is on.  Time spent in a timer
+  // nested inside another only counts for the inner one, and a phase timed
+  // several times, as in streaming mode, adds up.
+  class Timer {
+  private:
+    Timings* timings;
+    const char* name;
+    Timer* outer = NULL;
+    std::chrono::steady_clock::time_point wall;
+    double cpu;
+    double wallMs = 0, cpuMs = 0;
+
+    void pause() {
+      wallMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wall).count();
+      cpuMs += Timings::cpuMs() - cpu;
+    }
+    void resume() {
+      wall = std::chrono::steady_clock::now();
+      cpu = Timings::cpuMs();
+    }
+
+  public:
+    Timer(Timings* timings, const char* name) : timings(timings), name(name) {
+      if (timings == NULL) return;
+      outer = timings->current;
+      if (outer != NULL) outer->pause();
+      timings->current = this;
+      resume();
+    }
+    ~Timer() {
+      if (timings == NULL) return;
+      pause();
+      timings->add(name, wallMs, cpuMs);
+      timings->current = outer;
+      if (outer != NULL) outer->resume();
+    }
+  };
+
+private:
+  std::vector<Phase> phases;
+  std::vector<Counter> counters;
+  Timer* current = NULL;    // Innermost running timer
+
+  static double cpuMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+  }
+  static std::string quote(const std::string& s) {
+    std::string out = "\"";
+    for (size_t i = 0; i < s.size(); i++) {
+      unsigned char c = s[i];
+      if (c == '"' || c == '\\') {
+        out += '\\';
+        out += c;
+      } else if (c < 0x20) {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\u%04x", c);
+        out += buf;
+      } else {
+        out += c;
+      }
+    }
+    return out + "\"";
+  }
+
+public:
+  void add(const char* name, double wallMs, double cpuMs) {
+    for (size_t i = 0; i < phases.size(); i++) {
+      if (strcmp(phases[i].name, name) == 0) {
+        phases[i].wallMs += wallMs;
+        phases[i].cpuMs += cpuMs;
+        return;
+      }
+    }
+    phases.push_back(Phase(name, wallMs, cpuMs));
+  }
+  void count(const char* name, uint64_t value) { counters.push_back(Counter(name, value)); };
+  const std::vector<Phase>& getPhases() const { return phases; };
+  const std::vector<Counter>& getCounters() const { return counters; };
+
+  void print(FILE* out, const std::string& file, Format format) const {
+    if (format == JSON) {
+      std::string label = quote(file);
+      for (size_t i = 0; i < phases.size(); i++) {
+        fprintf(out, "{\"file\":%s,\"phase\":\"%s\",\"wall_ms\":%.3f,\"cpu_ms\":%.3f}\n",
+                label.c_str(), phases[i].name, phases[i].wallMs, phases[i].cpuMs);
+      }
+      for (size_t i = 0; i < counters.size(); i++) {
+        fprintf(out, "{\"file\":%s,\"counter\":\"%s\",\"value\":%llu}\n",
+                label.c_str(), counters[i].name, (unsigned long long) counters[i].value);
+      }
+    } else if (format == TABLE) {
+      double wall = 0, cpu = 0;
+      fprintf(out, "%s\n  %-22s %12s %12s\n", file.c_str(), "phase", "wall ms", "cpu ms");
+      for (size_t i = 0; i < phases.size(); i++) {
+        fprintf(out, "  %-22s %12.3f %12.3f\n", phases[i].name, phases[i].wallMs, phases[i].cpuMs);
+        wall += phases[i].wallMs;
+        cpu += phases[i].cpuMs;
+      }
+      fprintf(out, "  %-22s %12.3f %12.3f\n", "total", wall, cpu);
+      for (size_t i = 0; i < counters.size(); i++) {
+        fprintf(out, "  %-22s %12llu\n", counters[i].name, (unsigned long long) counters[i].value);
+      }
+    }
+  }
+};
+#endif // __TIMINGS_H_
@@ -26,15 +26,27 @@
 #include <llvm/IR/Type.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/LLVMContext.h>
-#include <fstream>
 #include <string>
 
 using namespace llvm;
 
-TypeCheckerVisitor::TypeCheckerVisitor()
+static const Name INT_TYPE("int");
+static const Name DOUBLE_TYPE("double");
+static const Name BOOL_TYPE("bool");
+// Arrays live in memory the program zeroes, which should stay reasonable.
+// A procedure's arrays are on the stack, which is much smaller.
+static const int64_t MAX_ARRAY_SIZE = 1 << 24;
+static const int64_t MAX_LOCAL_ARRAY_SIZE = 1 << 16;
+
+TypeCheckerVisitor::TypeCheckerVisitor(Lattice* lattice, LLVMContext& llvmContext) :
+    lattice(lattice), llvmContext(llvmContext),
+    voidType(Type::getVoidTy(llvmContext)), intType(Type::getInt64Ty(llvmContext)),
+    doubleType(Type::getDoubleTy(llvmContext)), boolType(Type::getInt1Ty(llvmContext))
 {
+  assert(lattice->isSealed());
   scope = new Scope();
-  scope->InitializeScope("global");
+  scope->InitializeScope();
+  types.reserve(64);
 }
 
 TypeCheckerVisitor::~TypeCheckerVisitor() {
@@ -43,190 +55,484 @@ TypeCheckerVisitor::~TypeCheckerVisitor() {
   delete scope;
 }
 
-void TypeCheckerVisitor::setFileName(char* filename)
+SType TypeCheckerVisitor::lookUp(int slot)
+{
+  if (slot < 0 || slot >= (int) symbols.size()) return SType();
+  return symbols[slot];
+}
+
+void TypeCheckerVisitor::push(const SType& stype)
+{
+  types.push_back(stype);
+  if (types.size() > peak_depth) peak_depth = types.size();
+}
+
+SType TypeCheckerVisitor::pop()
+{
+  if (types.empty()) return SType();
+  SType stype = types.back();
+  types.pop_back();
+  return stype;
+}
+
+void TypeCheckerVisitor::setSource(const char* filename, LineIndex* lines)
 {
   this->filename = filename;
-  std::ifstream input(filename);
-  int lineno = 0;
-  for(std::string line; getline(input, line);) {
-    fmap[++lineno] = line;
-    if (verbose) std::cout << line << std::endl;
+  this->lines = lines;
+  if (verbose) {
+    std::cout.write(lines->getData(), lines->getSize());
+    if (lines->getSize() > 0 && lines->getData()[lines->getSize() - 1] != '\n') std::cout << std::endl;
   }
 }
 
 void TypeCheckerVisitor::printErrorMessage(std::string message, int lineno)
 {
+  errors++;
   std::cerr << "ERR: " << message << std::endl;
   if (filename != NULL) {
     std::cerr << filename;
     if (lineno > 0) {
-      std::cerr << " line " << lineno << ": " << std::endl << fmap[lineno] << std::endl;
+      std::cerr << " line " << lineno << ": " << std::endl;
+      lines->print(std::cerr, lineno);
     } else {
       std::cerr << std::endl;
     }
   }
 }
 
+void TypeCheckerVisitor::setMemo(CheckCache* memo, const BlockHashVisitor* hashes)
+{
+  this->memo = memo;
+  this->hashes = hashes;
+  // Labels are only numbers, the lattice gives them their meaning
+  latticeHash = hashMix(0, lattice->size());
+  for (size_t a = 0; a < lattice->size(); a++) {
+    latticeHash = hashMix(latticeHash, lattice->getName(a).getId());
+    for (size_t b = 0; b < lattice->size(); b++) {
+      latticeHash = hashMix(latticeHash, lattice->flowsTo(a, b));
+    }
+  }
+}
+
+/* Types are compared by kind, they belong to a different LLVMContext in
+ * every compilation */
+static uint64_t hashSType(const SType& stype)
+{
+  if (!stype.valid) return 0;
+  uint64_t h = hashMix(1, stype.sec);
+  if (stype.type != NULL && stype.type->isArrayTy()) {
+    h = hashMix(h, stype.type->getArrayNumElements());
+    h = hashMix(h, stype.type->getArrayElementType()->getTypeID());
+    h = hashMix(h, stype.type->getArrayElementType()->getPrimitiveSizeInBits());
+  } else if (stype.type != NULL) {
+    h = hashMix(h, stype.type->getTypeID());
+    h = hashMix(h, stype.type->getPrimitiveSizeInBits());
+  }
+  return h;
+}
+
+bool TypeCheckerVisitor::skip(NBlock* element)
+{
+  if (memo == NULL) return false;
+  const BlockHashVisitor::Entry* entry = hashes->find(element);
+  if (entry == NULL) {
+    pending.push_back(0);
+    errorsAtEntry.push_back(errors);
+    return false;
+  }
+  Label next_sec = lattice->join(scope->getSecurityContext(), guard_sec);
+  uint64_t key = hashMix(hashMix(hashMix(hashMix(entry->hash, next_sec), latticeHash), deferring), inProcedure);
+  for (size_t i = entry->firstUse; i < entry->endUse; i++) {
+    key = hashMix(key, hashSType(lookUp(hashes->getUse(i)->slot)));
+  }
+  if (key == 0) key = 1; // 0 marks blocks that are not memoized
+  if (memo->contains(key)) {
+    if (verbose) std::cout << "TypeCheckerVisitor reusing " << typeid(element).name() << std::endl;
+    blocksReused++;
+    // Same state as if the block had been checked
+    types.clear();
+    if (entry->branches) guard_sec = Lattice::BOTTOM;
+    return true;
+  }
+  blocksChecked++;
+  pending.push_back(key);
+  errorsAtEntry.push_back(errors);
+  return false;
+}
+
+/* Values of skips, literals and types are low */
+void TypeCheckerVisitor::pushType(FlatAst::Type type)
+{
+  switch (type) {
+    case FlatAst::T_INT:
+      push(SType(intType, Lattice::BOTTOM));
+      return;
+    case FlatAst::T_DOUBLE:
+      push(SType(doubleType, Lattice::BOTTOM));
+      return;
+    case FlatAst::T_BOOL:
+      push(SType(boolType, Lattice::BOTTOM));
+      return;
+    default:
+      push(SType(voidType, Lattice::BOTTOM));
+      return;
+  }
+}
+
 void TypeCheckerVisitor::visit(NSkip* element, uint64_t flag)
 {
   if (verbose) std::cout << "TypeCheckerVisitor " << typeid(element).name() << std::endl;
-	types.push_front(new SType(Type::getVoidTy(getGlobalContext()), ""));
+  pushType(FlatAst::T_VOID);
 }
 
 void TypeCheckerVisitor::visit(NInteger* element, uint64_t flag)
 {
   if (verbose) std::cout << "TypeCheckerVisitor " << typeid(element).name() << std::endl;
-	types.push_front(new SType(Type::getInt64Ty(getGlobalContext()), ""));
+  pushType(FlatAst::T_INT);
 }
 
 void TypeCheckerVisitor::visit(NDouble* element, uint64_t flag)
 {
   if (verbose) std::cout << "TypeCheckerVisitor " << typeid(element).name() << std::endl;
-	types.push_front(new SType(Type::getDoubleTy(getGlobalContext()), ""));
+  pushType(FlatAst::T_DOUBLE);
 }
 
 void TypeCheckerVisitor::visit(NBool* element, uint64_t flag)
 {
   if (verbose) std::cout << "TypeCheckerVisitor " << typeid(element).name() << std::endl;
-  types.push_front(new SType(Type::getInt1Ty(getGlobalContext()), ""));
+  pushType(FlatAst::T_BOOL);
+}
+
+void TypeCheckerVisitor::pushLabel(Name name)
+{
+  // Declarations without a label are low
+  int label = name.empty() ? Lattice::BOTTOM : lattice->lookUp(name);
+  assert(label >= 0); // The lexer only returns T_SEC for known labels
+  push(SType(NULL, label));
 }
 
 void TypeCheckerVisitor::visit(NSecurity* element, uint64_t flag)
 {
-  if (verbose) std::cout << "TypeCheckerVisitor " << typeid(element).name() << " " << element->name << std::endl;
-  if (element->name == "") element->name = "low";
-  types.push_front(new SType(NULL, element->name));
+  if (verbose) std::cout << "TypeCheckerVisitor " << typeid(element).name() << " " << element->name.str() << std::endl;
+  pushLabel(element->name);
 }
 
 void TypeCheckerVisitor::visit(NType* element, uint64_t flag)
 {
   if (verbose) std::cout << "TypeCheckerVisitor " << typeid(element).name() << std::endl;
-	if (element->name.compare("int") == 0) {
-		types.push_front(new SType(Type::getInt64Ty(getGlobalContext()), ""));
-    return;
-	} else if (element->name.compare("double") == 0) {
-		types.push_front(new SType(Type::getDoubleTy(getGlobalContext()), ""));
+  if (element->name == INT_TYPE) {
+    pushType(FlatAst::T_INT);
+  } else if (element->name == DOUBLE_TYPE) {
+    pushType(FlatAst::T_DOUBLE);
+  } else if (element->name == BOOL_TYPE) {
+    pushType(FlatAst::T_BOOL);
+  } else {
+    pushType(FlatAst::T_VOID);
+  }
+}
+
+void TypeCheckerVisitor::checkIdentifier(Name name, int slot, int lineno)
+{
+  if (slot < 0) {
+    printErrorMessage("Undeclared variable " + name.str(), lineno);
+    passed = false;
+    push(SType());
     return;
-	} else if (element->name.compare("bool") == 0) {
-		types.push_front(new SType(Type::getInt1Ty(getGlobalContext()), ""));
+  }
+  SType stype = lookUp(slot);
+  if (stype.valid && stype.type->isArrayTy()) {
+    printErrorMessage("Array " + name.str() + " used without an index", lineno);
+    passed = false;
+    push(SType());
     return;
   }
-	types.push_front(new SType(Type::getVoidTy(getGlobalContext()), ""));
-  return;
+  push(stype);
 }
 
 void TypeCheckerVisitor::visit(NIdentifier* element, uint64_t flag)
 {
-  if (verbose) std::cout << "TypeCheckerVisitor " << typeid(element).name() << " " << element->name << std::endl;
-  Symbol* sym = scope->LookUp(element->name);
-	if (sym == NULL) {
-    printErrorMessage("Undeclared variable " + element->name, element->lineno);
+  if (verbose) std::cout << "TypeCheckerVisitor " << typeid(element).name() << " " << element->name.str() << std::endl;
+  checkIdentifier(element->name, element->slot, element->lineno);
+}
+
+void TypeCheckerVisitor::visit(NElement* element, uint64_t flag)
+{
+  if (verbose) std::cout << "TypeCheckerVisitor " << typeid(element).name() << " " << element->id.name.str() << std::endl;
+  checkElement(element->id.name, element->id.slot, element->lineno);
+}
+
+void TypeCheckerVisitor::checkElement(Name name, int slot, int lineno)
+{
+  SType itype = pop();
+  if (slot < 0) {
+    printErrorMessage("Undeclared variable " + name.str(), lineno);
     passed = false;
+    push(SType());
     return;
-	}
-  types.push_front(sym->stype);
+  }
+  SType atype = lookUp(slot);
+  if (!atype.valid || !itype.valid) {
+    assert(!passed);
+    push(SType());
+    return;
+  }
+  if (!atype.type->isArrayTy()) {
+    printErrorMessage("Variable " + name.str() + " is not an array", lineno);
+    passed = false;
+    push(SType());
+    return;
+  }
+  if (itype.type != intType) {
+    printErrorMessage("Failed on types of the index", lineno);
+    passed = false;
+    push(SType());
+    return;
+  }
+  // Which element is read depends on the index
+  push(SType(atype.type->getArrayElementType(), lattice->join(atype.sec, itype.sec)));
 }
 
 void TypeCheckerVisitor::visit(NAssignment* element, uint64_t flag)
 {
   if (verbose) std::cout << "TypeCheckerVisitor " << typeid(element).name() << std::endl;
-  Symbol* sym = scope->LookUp(element->lhs.name);
-	if (sym == NULL) {
-    printErrorMessage("Undeclared variable " + element->lhs.name, element->lineno);
+  checkAssignment(element->lhs.name, element->lhs.slot, element->lineno);
+}
+
+void TypeCheckerVisitor::checkAssignment(Name lhs, int slot, int lineno)
+{
+  SType atype = pop();
+  if (slot < 0) {
+    printErrorMessage("Undeclared variable " + lhs.str(), lineno);
     passed = false;
-    return;
-	}
-  SType* dtype = sym->stype;
-  if (dtype == NULL) {
-    assert(!passed);
     return;
   }
-  SType* atype = types.front();
-  if (atype == NULL) {
+  SType dtype = lookUp(slot);
+  if (!dtype.valid || !atype.valid) {
     assert(!passed);
     return;
   }
-  types.pop_front();
-  // Check if the scope allow us to write to a low variable
-  if (dtype->sec == "low" && scope->getSecurityContext() == "high") {
-    printErrorMessage("Failed when trying to assign to a low var from a high context (implicit flow)", element->lineno);
+  // Check if the scope allow us to write to this variable.  A flow left to
+  // run time still has its types checked.
+  bool implicit = !lattice->flowsTo(scope->getSecurityContext(), dtype.sec);
+  if (implicit && !deferring) {
+    printErrorMessage("Failed when trying to assign to a " + lattice->getName(dtype.sec).str() +
+                      " var from a " + lattice->getName(scope->getSecurityContext()).str() +
+                      " context (implicit flow)", lineno);
     passed = false;
     return;
   }
-  if (dtype->type != atype->type) {
+  if (dtype.type != atype.type) {
     // TODO: Print legible types:
-    std::cout << dtype->type << " " << atype->type << std::endl;
-    printErrorMessage("Failed on types", element->lineno);
+    std::cout << dtype.type << " " << atype.type << std::endl;
+    printErrorMessage("Failed on types", lineno);
     passed = false;
     return;
   }
   // If the right hand side expression doesn't have a type,
   // its because it doesn't operate on variables.
   // In this case, its safe to allow this to proceed.
-  if (dtype->sec == "low" && atype->sec == "high") {
-    printErrorMessage("Failed on security (explicit flow)", element->lineno);
+  bool explicitFlow = !lattice->flowsTo(atype.sec, dtype.sec);
+  if (explicitFlow && !deferring) {
+    printErrorMessage("Failed on security (explicit flow)", lineno);
     passed = false;
     return;
   }
+  if (implicit || explicitFlow) defer(lhs, lineno);
 }
 
-void TypeCheckerVisitor::visit(NVariableDeclaration* element, uint64_t flag)
+// Checked like an assignment to the whole array, where the index also
+// flows to the array, since it chooses the element that changes
+void TypeCheckerVisitor::visit(NElementAssignment* element, uint64_t flag)
+{
+  if (verbose) std::cout << "TypeCheckerVisitor " << typeid(element).name() << " " << element->id.name.str() << std::endl;
+  checkElementAssignment(element->id.name, element->id.slot, element->lineno);
+}
+
+void TypeCheckerVisitor::checkElementAssignment(Name name, int slot, int lineno)
 {
-  if (verbose) std::cout << "TypeCheckerVisitor " << typeid(element).name() << " " << element->type.name << " " << element->id.name << std::endl;
-  Symbol* sym = scope->LookUp(element->id.name);
-  if (sym != NULL) {
-    printErrorMessage("Variable redeclaration " + element->id.name, element->lineno);
+  SType rtype = pop();
+  SType itype = pop();
+  if (slot < 0) {
+    printErrorMessage("Undeclared variable " + name.str(), lineno);
     passed = false;
     return;
   }
-  SType* tmp;
-  // Get info about NSecurity
-  tmp =  types.front();
-  types.pop_front();
-  if (tmp == NULL) {
+  SType atype = lookUp(slot);
+  if (!atype.valid || !itype.valid || !rtype.valid) {
     assert(!passed);
     return;
   }
-  std::string sec = tmp->sec;
-  delete tmp;
+  if (!atype.type->isArrayTy()) {
+    printErrorMessage("Variable " + name.str() + " is not an array", lineno);
+    passed = false;
+    return;
+  }
+  if (!lattice->flowsTo(scope->getSecurityContext(), atype.sec)) {
+    printErrorMessage("Failed when trying to assign to a " + lattice->getName(atype.sec).str() +
+                      " array from a " + lattice->getName(scope->getSecurityContext()).str() +
+                      " context (implicit flow)", lineno);
+    passed = false;
+    return;
+  }
+  if (itype.type != intType || rtype.type != atype.type->getArrayElementType()) {
+    printErrorMessage("Failed on types", lineno);
+    passed = false;
+    return;
+  }
+  if (!lattice->flowsTo(lattice->join(rtype.sec, itype.sec), atype.sec)) {
+    printErrorMessage("Failed on security (explicit flow)", lineno);
+    passed = false;
+    return;
+  }
+}
+
+void TypeCheckerVisitor::defer(Name lhs, int lineno)
+{
+  deferred++;
+  if (verbose) std::cout << "TypeCheckerVisitor leaving the flow to " << lhs.str()
+                         << " on line " << lineno << " to run time" << std::endl;
+}
+
+void TypeCheckerVisitor::visit(NVariableDeclaration* element, uint64_t flag)
+{
+  if (verbose) std::cout << "TypeCheckerVisitor " << typeid(element).name() << " " << element->type.name.str() << " " << element->id.name.str() << std::endl;
+  // Get info about NSecurity
+  SType stype = pop();
   // Get info about NType
-  tmp = types.front();
-  types.pop_front();
-  if (tmp == NULL) {
-    assert(!passed);
+  SType ttype = pop();
+  if (element->id.slot >= (int) symbols.size()) symbols.resize(element->id.slot + 1);
+  int64_t maxSize = inProcedure ? MAX_LOCAL_ARRAY_SIZE : MAX_ARRAY_SIZE;
+  if (element->size > maxSize) {
+    printErrorMessage("Array " + element->id.name.str() + " has " + std::to_string(element->size) +
+                      " elements, at most " + std::to_string(maxSize) + " are allowed" +
+                      (inProcedure ? " in a procedure" : ""), element->lineno);
+    passed = false;
+    // Left undeclared, so that its uses are not checked again
+    return;
+  }
+  if (stype.valid && ttype.valid) {
+    Type* type = element->size == 0 ? ttype.type : ArrayType::get(ttype.type, element->size);
+    symbols[element->id.slot] = SType(type, stype.sec);
+  }
+  // The resolver still gives a redeclaration its own slot, so later uses
+  // type-check against it and don't produce spurious errors
+  if (element->redeclared) {
+    printErrorMessage("Variable redeclaration " + element->id.name.str(), element->lineno);
+    passed = false;
+    return;
+  }
+}
+
+void TypeCheckerVisitor::visit(NProcedure* element, uint64_t flag)
+{
+  switch (flag)
+  {
+    case V_FLAG_ENTER:
+      if (verbose) std::cout << "TypeCheckerVisitor entering " << typeid(element).name() << " " << element->id.name.str() << std::endl;
+      if (element->index >= (int) procedures.size()) procedures.resize(element->index + 1);
+      inProcedure = true;
+      break;
+    case V_FLAG_THEN | V_FLAG_ENTER:
+      {
+        // The parameters are declared, the body comes next
+        SType pc = pop();
+        if (element->redeclared) {
+          printErrorMessage("Procedure redeclaration " + element->id.name.str(), element->lineno);
+          passed = false;
+        } else {
+          Signature& signature = procedures[element->index];
+          signature.pc = pc.sec;
+          for (VariableList::iterator it = element->params.begin(); it != element->params.end(); ++it) {
+            signature.params.push_back(lookUp((*it)->id.slot));
+          }
+        }
+        // Writes in the body must be at least as high as pc
+        guard_sec = pc.sec;
+      }
+      break;
+    case V_FLAG_EXIT:
+      if (verbose) std::cout << "TypeCheckerVisitor leaving " << typeid(element).name() << " " << element->id.name.str() << std::endl;
+      guard_sec = Lattice::BOTTOM;
+      inProcedure = false;
+      break;
+    default:
+      break;
+  }
+}
+
+void TypeCheckerVisitor::visit(NCall* element, uint64_t flag)
+{
+  if (verbose) std::cout << "TypeCheckerVisitor " << typeid(element).name() << " " << element->id.name.str() << std::endl;
+  std::vector<SType> args(element->args.size());
+  for (size_t i = args.size(); i-- > 0; ) args[i] = pop();
+  // A call has no value, like skip
+  push(SType(voidType, Lattice::BOTTOM));
+  if (element->procedure < 0) {
+    printErrorMessage("Undeclared procedure " + element->id.name.str(), element->lineno);
+    passed = false;
+    return;
+  }
+  const Signature& callee = procedures[element->procedure];
+  if (args.size() != callee.params.size()) {
+    printErrorMessage("Procedure " + element->id.name.str() + " takes " + std::to_string(callee.params.size()) +
+                      " arguments, not " + std::to_string(args.size()), element->lineno);
+    passed = false;
     return;
   }
-  Type* dtype = tmp->type;
-  delete tmp;
-  scope->Insert(element->id.name, new Symbol(NULL, new SType(dtype, sec)));
+  // The body only writes to variables at least as high as its pc
+  if (!lattice->flowsTo(scope->getSecurityContext(), callee.pc)) {
+    printErrorMessage("Failed when trying to call a " + lattice->getName(callee.pc).str() +
+                      " procedure from a " + lattice->getName(scope->getSecurityContext()).str() +
+                      " context (implicit flow)", element->lineno);
+    passed = false;
+    return;
+  }
+  for (size_t i = 0; i < args.size(); i++) {
+    if (!args[i].valid || !callee.params[i].valid) {
+      if (passed) printErrorMessage("Failed on types", element->lineno);
+      passed = false;
+      return;
+    }
+    if (args[i].type != callee.params[i].type) {
+      printErrorMessage("Failed on types", element->lineno);
+      passed = false;
+      return;
+    }
+    if (!lattice->flowsTo(args[i].sec, callee.params[i].sec)) {
+      printErrorMessage("Failed on security (explicit flow)", element->lineno);
+      passed = false;
+      return;
+    }
+  }
 }
 
 void TypeCheckerVisitor::visit(NBinaryOperator* element, uint64_t flag)
 {
   if (verbose) std::cout << "TypeCheckerVisitor " << typeid(element).name() << std::endl;
-	SType* trhs = types.front();
-  types.pop_front();
-  SType* tlhs = types.front();
-  types.pop_front();
-  if (tlhs == NULL || trhs == NULL) {
+  checkBinary(element->op, element->lineno);
+}
+
+void TypeCheckerVisitor::checkBinary(int op, int lineno)
+{
+  SType trhs = pop();
+  SType tlhs = pop();
+  if (!tlhs.valid || !trhs.valid) {
     assert(!passed);
+    push(SType());
     return;
   }
-  std::string sec = "";
-  if (tlhs->sec == "high" || trhs->sec == "high") {
-    sec = "high";
-  }
+  Label sec = lattice->join(tlhs.sec, trhs.sec);
 
-	switch (element->op) {
+  switch (op) {
 		case TPLUS:
 		case TMINUS:
 		case TMUL:
 		case TDIV:
-      if (tlhs->type == trhs->type && tlhs->type == Type::getInt64Ty(getGlobalContext())) {
-        types.push_front(new SType(Type::getInt64Ty(getGlobalContext()), sec));
+      if (tlhs.type == trhs.type && tlhs.type == intType) {
+        push(SType(intType, sec));
         return;
-      } else if (tlhs->type == trhs->type && tlhs->type == Type::getDoubleTy(getGlobalContext())) {
-        types.push_front(new SType(Type::getDoubleTy(getGlobalContext()), sec));
+      } else if (tlhs.type == trhs.type && tlhs.type == doubleType) {
+        push(SType(doubleType, sec));
         return;
       }
     case TCEQ:
@@ -235,40 +541,47 @@ void TypeCheckerVisitor::visit(NBinaryOperator* element, uint64_t flag)
     case TCLE:
     case TCGT:
     case TCGE :
-      if (tlhs->type == trhs->type && tlhs->type == Type::getInt64Ty(getGlobalContext())) {
-        types.push_front(new SType(Type::getInt1Ty(getGlobalContext()), sec));
+      if (tlhs.type == trhs.type && tlhs.type == intType) {
+        push(SType(boolType, sec));
         return;
-      } else if (tlhs->type == trhs->type && tlhs->type == Type::getDoubleTy(getGlobalContext())) {
-        types.push_front(new SType(Type::getInt1Ty(getGlobalContext()), sec));
+      } else if (tlhs.type == trhs.type && tlhs.type == doubleType) {
+        push(SType(boolType, sec));
         return;
       }
     default:
-      printErrorMessage( "Type mismatch on binary operator", element->lineno );
+      printErrorMessage("Type mismatch on binary operator", lineno);
       passed = false;
+      push(SType());
       return;
 	}
 }
 
+/* The branches or the body that follow run in the guard's context */
+void TypeCheckerVisitor::checkGuard(int lineno)
+{
+  SType gtype = pop();
+  if (!gtype.valid) {
+    assert(!passed);
+    return;
+  }
+  if (gtype.type != boolType) {
+    printErrorMessage("Failed on the guard", lineno);
+    passed = false;
+    return;
+  }
+  guard_sec = gtype.sec;
+}
+
 void TypeCheckerVisitor::visit(NIfExpression* element, uint64_t flag)
 {
   switch (flag)
   {
     case V_FLAG_GUARD | V_FLAG_EXIT:
-      {
-        if (verbose) std::cout << "TypeCheckerVisitor if-guard-enter " << typeid(element).name() << std::endl;
-        SType* gtype = types.front();
-        types.pop_front();
-        assert(gtype != NULL);
-        if (gtype->type != Type::getInt1Ty(getGlobalContext())) {
-          printErrorMessage("Failed on the guard", element->lineno);
-          passed = false;
-          return;
-        }
-        guard_sec = gtype->sec;
-      }
+      if (verbose) std::cout << "TypeCheckerVisitor if-guard-enter " << typeid(element).name() << std::endl;
+      checkGuard(element->lineno);
       return;
     case V_FLAG_EXIT:
-      guard_sec = "";
+      guard_sec = Lattice::BOTTOM;
       return;
     default:
       return;
@@ -280,21 +593,11 @@ void TypeCheckerVisitor::visit(NWhileExpression* element, uint64_t flag)
   switch (flag)
   {
     case V_FLAG_GUARD | V_FLAG_EXIT:
-      {
-        if (verbose) std::cout << "TypeCheckerVisitor while-guard-enter " << typeid(element).name() << std::endl;
-        SType* gtype = types.front();
-        types.pop_front();
-        assert(gtype != NULL);
-        if (gtype->type != Type::getInt1Ty(getGlobalContext())) {
-          printErrorMessage("Failed on the guard", element->lineno);
-          passed = false;
-          return;
-        }
-        guard_sec = gtype->sec;
-      }
+      if (verbose) std::cout << "TypeCheckerVisitor while-guard-enter " << typeid(element).name() << std::endl;
+      checkGuard(element->lineno);
       return;
     case V_FLAG_EXIT:
-      guard_sec = "";
+      guard_sec = Lattice::BOTTOM;
       return;
     default:
       return;
@@ -304,32 +607,105 @@ void TypeCheckerVisitor::visit(NWhileExpression* element, uint64_t flag)
 void TypeCheckerVisitor::visit(NExpressionStatement* element, uint64_t flag)
 {
   if (verbose) std::cout << "TypeCheckerVisitor " << typeid(element).name() << std::endl;
+  // Nothing is pending between statements, drop the unused result
+  types.clear();
 }
 
 void TypeCheckerVisitor::visit(NBlock* element, uint64_t flag)
 {
-  static int size_on_entering = 0;
-  static int size_on_leaving = 0;
   switch (flag)
   {
     case V_FLAG_ENTER:
-      {
-        if (verbose) std::cout << "TypeCheckerVisitor entering " << typeid(element).name() << std::endl;
-        size_on_entering = types.size();
-        //std::cout << "Size on entering: " << size_on_entering << std::endl;;
-        std::string next_sec = scope->getSecurityContext() == "high" ? "high" : guard_sec;
-        next_sec = (next_sec == "" ? "low" : next_sec);
-        if (verbose) std::cout << "TypeCheckerVisitor initializing scope to: " << next_sec << std::endl;;
-        scope->InitializeScope("", next_sec);
-      }
+      if (verbose) std::cout << "TypeCheckerVisitor entering " << typeid(element).name() << std::endl;
+      enterBlock();
       break;
     case V_FLAG_EXIT:
       if (verbose) std::cout << "TypeCheckerVisitor leaving " << typeid(element).name() << std::endl;
-      size_on_leaving = types.size();
-      //std::cout << "Size on leaving: " << size_on_leaving << std::endl;;
-      scope->FinalizeScope();
+      leaveBlock();
       break;
     default:
       assert(0);
   }
 }
+
+void TypeCheckerVisitor::enterBlock()
+{
+  // Guards are popped before their blocks are entered, so anything left on
+  // the stack is the unused result of an earlier statement
+  types.clear();
+  Label next_sec = lattice->join(scope->getSecurityContext(), guard_sec);
+  if (verbose) std::cout << "TypeCheckerVisitor initializing scope to: " << lattice->getName(next_sec).str() << std::endl;
+  scope->InitializeScope(next_sec);
+}
+
+void TypeCheckerVisitor::leaveBlock()
+{
+  types.clear();
+  scope->FinalizeScope();
+  if (memo != NULL) {
+    if (pending.back() != 0 && errors == errorsAtEntry.back()) memo->insert(pending.back());
+    pending.pop_back();
+    errorsAtEntry.pop_back();
+  }
+}
+
+/* Checks the flat form, reading the events of expressions, assignments,
+ * guards and blocks from its arrays; declarations, procedures and calls
+ * are visited through their nodes */
+void TypeCheckerVisitor::check(const FlatAst& flat)
+{
+  size_t n = flat.size();
+  for (size_t i = 0; i < n; i++) {
+    uint64_t flag = flat.getFlag(i);
+    switch (flat.kinds[i]) {
+      case N_SKIP:
+      case N_INTEGER:
+      case N_BOOL:
+      case N_DOUBLE:
+      case N_TYPE:
+        pushType((FlatAst::Type) flat.types[i]);
+        break;
+      case N_SECURITY:
+        pushLabel(Name(flat.operands[i]));
+        break;
+      case N_IDENTIFIER:
+        checkIdentifier(Name(flat.operands[i]), flat.slots[i], flat.lines[i]);
+        break;
+      case N_ELEMENT:
+        checkElement(Name(flat.operands[i]), flat.slots[i], flat.lines[i]);
+        break;
+      case N_BINARY:
+        checkBinary(flat.operands[i], flat.lines[i]);
+        break;
+      case N_ASSIGNMENT:
+        checkAssignment(Name(flat.operands[i]), flat.slots[i], flat.lines[i]);
+        break;
+      case N_ELEMENT_ASSIGNMENT:
+        checkElementAssignment(Name(flat.operands[i]), flat.slots[i], flat.lines[i]);
+        break;
+      case N_IF:
+      case N_WHILE:
+        if (flag == (V_FLAG_GUARD | V_FLAG_EXIT)) {
+          checkGuard(flat.lines[i]);
+        } else if (flag == V_FLAG_EXIT) {
+          guard_sec = Lattice::BOTTOM;
+        }
+        break;
+      case N_EXPRESSION_STATEMENT:
+        types.clear();
+        break;
+      case N_BLOCK:
+        if (flag == V_FLAG_EXIT) {
+          leaveBlock();
+        } else if (skip((NBlock*) flat.nodes[i])) {
+          i = flat.operands[i]; // Its EXIT
+        } else {
+          enterBlock();
+        }
+        break;
+      default:
+        flat.nodes[i]->dispatch(*this, flag);
+        break;
+    }
+  }
+}
@@ -22,19 +22,66 @@
 #define __TYPE_CHECKER_VISITOR_H_
 #include "node.h"
 #include "scope.h"
+#include "lattice.h"
 #include "visitor.h"
-#include <map>
+#include "blockHashVis.h"
+#include "checkCache.h"
+#include "flatAst.h"
+#include "lineIndex.h"
+#include <llvm/IR/LLVMContext.h>
+#include <vector>
 #include <string>
 
 class TypeCheckerVisitor : public Visitor {
 private:
-  char* filename;
-  std::map<int, std::string> fmap;
+  // What a call is checked against
+  class Signature {
+  public:
+    Label pc = Lattice::BOTTOM;
+    std::vector<SType> params;
+  };
+
+  const char* filename = NULL;
+  LineIndex* lines = NULL;    // Source of the lines quoted in errors
   bool verbose = false;
+  Lattice* lattice;
+  llvm::LLVMContext& llvmContext;
+  // Its types, looked up once
+  llvm::Type* voidType;
+  llvm::Type* intType;
+  llvm::Type* doubleType;
+  llvm::Type* boolType;
   Scope* scope; 
-  std::list<SType*> types;
-  std::string guard_sec = "low";
+  std::vector<SType> symbols; // Indexed by NIdentifier::slot
+  std::vector<SType> types;
+  std::vector<Signature> procedures; // Indexed by NProcedure::index
+  size_t peak_depth = 0;
+  Label guard_sec = Lattice::BOTTOM;
+  bool inProcedure = false;   // Its arrays are on the stack
   bool passed = true;
+  int errors = 0;
+  bool deferring = false;     // See setDeferring()
+  int deferred = 0;
+  // Incremental re-checking, see setMemo()
+  CheckCache* memo = NULL;
+  const BlockHashVisitor* hashes = NULL;
+  uint64_t latticeHash = 0;
+  std::vector<uint64_t> pending;     // Key of each open block
+  std::vector<int> errorsAtEntry;    // Error count when it was entered
+  int blocksChecked = 0;
+  int blocksReused = 0;
+
+  // What the visits and check(FlatAst) share, given the fields they read
+  void pushType(FlatAst::Type type);
+  void pushLabel(Name name);
+  void checkIdentifier(Name name, int slot, int lineno);
+  void checkElement(Name name, int slot, int lineno);
+  void checkAssignment(Name lhs, int slot, int lineno);
+  void checkElementAssignment(Name name, int slot, int lineno);
+  void checkBinary(int op, int lineno);
+  void checkGuard(int lineno);
+  void enterBlock();
+  void leaveBlock();
 
 public:
   virtual void visit(NSkip* nSkip, uint64_t flag);
@@ -51,14 +98,35 @@ public:
   virtual void visit(NBlock* nBlock, uint64_t flag);
   virtual void visit(NExpressionStatement* nExpressionStatement, uint64_t flag);
   virtual void visit(NVariableDeclaration* nVariableDeclaration, uint64_t flag);
+  virtual void visit(NProcedure* nProcedure, uint64_t flag);
+  virtual void visit(NCall* nCall, uint64_t flag);
+  virtual void visit(NElement* nElement, uint64_t flag);
+  virtual void visit(NElementAssignment* nElementAssignment, uint64_t flag);
+  virtual bool skip(NBlock* nBlock);
 
-  TypeCheckerVisitor();
+  TypeCheckerVisitor(Lattice* lattice, llvm::LLVMContext& llvmContext);
   ~TypeCheckerVisitor();
   bool check(NBlock& root);
-  void setFileName(char* filename);
+  // Checks the flat form once ResolveVisitor::resolve bound its slots
+  void check(const FlatAst& flat);
+  void setSource(const char* filename, LineIndex* lines);
   void printErrorMessage(std::string message, int lineno);
+  void defer(Name lhs, int lineno);
+  SType lookUp(int slot);
+  void push(const SType& stype);
+  SType pop();
+  // Skips blocks that passed in an earlier compilation under the same
+  // conditions, and remembers the ones that pass now
+  void setMemo(CheckCache* memo, const BlockHashVisitor* hashes);
+  // Leaves the flows it cannot prove safe to checks at run time, planned
+  // by the ShadowVisitor, instead of failing on them
+  void setDeferring(bool d) { deferring = d; };
+  int getDeferred() { return deferred; };
+  int getBlocksChecked() { return blocksChecked; };
+  int getBlocksReused() { return blocksReused; };
   void setVerbose(bool v) { verbose = v; };
   bool getVerbose() { return verbose; };
   bool getPassed() { return passed; };
+  size_t getPeakDepth() { return peak_depth; };
 };
 #endif // __TYPE_CHECKER_VISITOR_H_
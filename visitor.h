@@ -38,6 +38,10 @@ class NBlock;
 class NExpression;
 class NExpressionStatement;
 class NVariableDeclaration;
+class NProcedure;
+class NCall;
+class NElement;
+class NElementAssignment;
 
 // Visitor Flags
 enum {
@@ -51,6 +55,7 @@ enum {
 
 class Visitor {
 public:
+    virtual ~Visitor() {}
     virtual void visit(NSkip* nSkip, uint64_t flag) = 0;
     virtual void visit(NInteger* nInteger, uint64_t flag) = 0;
     virtual void visit(NBool* nBool, uint64_t flag) = 0;
@@ -66,5 +71,11 @@ public:
     virtual void visit(NExpression* nExpression, uint64_t flag) { };
     virtual void visit(NExpressionStatement* nExpressionStatement, uint64_t flag) = 0;
     virtual void visit(NVariableDeclaration* nVariableDeclaration, uint64_t flag) = 0;
+    virtual void visit(NProcedure* nProcedure, uint64_t flag) = 0;
+    virtual void visit(NCall* nCall, uint64_t flag) = 0;
+    virtual void visit(NElement* nElement, uint64_t flag) = 0;
+    virtual void visit(NElementAssignment* nElementAssignment, uint64_t flag) = 0;
+    // Called before a block is entered, returning true leaves it unvisited
+    virtual bool skip(NBlock* nBlock) { return false; };
 };
 #endif // __VISITOR_H_
@@ -0,0 +1,176 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#include "vm.h"
+#include <algorithm>
+#include <stdio.h>
+
+// GCC and clang can jump straight from one handler to the next through a
+// table of label addresses, which gives each opcode its own indirect branch
+// for the predictor.  Other compilers fall back to a switch.
+#if defined(__GNUC__)
+#define VM_THREADED 1
+#endif
+
+static const char* OPCODE_NAMES[Bytecode::OPCODE_COUNT] = {
+  "mov", "i2d",
+  "addi", "subi", "muli", "divi",
+  "addd", "subd", "muld", "divd",
+  "eqi", "nei", "lti", "lei", "gti", "gei",
+  "eqd", "ned", "ltd", "led", "gtd", "ged",
+  "jmp", "jmpf", "jmpt", "halt",
+};
+
+void Bytecode::dump(std::ostream& out) const
+{
+  int vars = getVariableCount();
+  int consts = vars + temporaries;
+  out << "Bytecode: " << code.size() << " instructions, " << getRegisterCount() << " registers" << std::endl;
+  for (int i = 0; i < vars; i++) {
+    out << "  r" << i << " = " << names[i].str() << std::endl;
+  }
+  for (size_t i = 0; i < constants.size(); i++) {
+    out << "  r" << consts + i << " = ";
+    if (constantTypes[i] == DOUBLE) out << constants[i].d << std::endl;
+    else out << constants[i].i << std::endl;
+  }
+  for (size_t pc = 0; pc < code.size(); pc++) {
+    const Instr& in = code[pc];
+    out << "  " << pc << ": " << OPCODE_NAMES[in.op];
+    switch (in.op) {
+      case JMP:  out << " @" << in.dst; break;
+      case JMPF:
+      case JMPT: out << " r" << in.a << ", @" << in.dst; break;
+      case HALT: break;
+      case MOV:
+      case I2D:  out << " r" << in.dst << ", r" << in.a; break;
+      default:   out << " r" << in.dst << ", r" << in.a << ", r" << in.b; break;
+    }
+    out << std::endl;
+  }
+}
+
+int VM::run()
+{
+  registers.assign(program.getRegisterCount(), Bytecode::Value());
+  std::copy(program.constants.begin(), program.constants.end(),
+            registers.begin() + program.getVariableCount() + program.temporaries);
+  Bytecode::Value* r = registers.data();
+  const Bytecode::Instr* code = program.code.data();
+  const Bytecode::Instr* ip = code;
+
+#ifdef VM_THREADED
+  static const void* handlers[Bytecode::OPCODE_COUNT] = {
+    &&op_MOV, &&op_I2D,
+    &&op_ADDI, &&op_SUBI, &&op_MULI, &&op_DIVI,
+    &&op_ADDD, &&op_SUBD, &&op_MULD, &&op_DIVD,
+    &&op_EQI, &&op_NEI, &&op_LTI, &&op_LEI, &&op_GTI, &&op_GEI,
+    &&op_EQD, &&op_NED, &&op_LTD, &&op_LED, &&op_GTD, &&op_GED,
+    &&op_JMP, &&op_JMPF, &&op_JMPT, &&op_HALT,
+  };
+#define CASE(name) op_##name
+#define DISPATCH() goto *handlers[ip->op]
+#define NEXT() do { ip++; DISPATCH(); } while (0)
+  DISPATCH();
+#else
+#define CASE(name) case Bytecode::name
+#define DISPATCH() continue
+#define NEXT() do { ip++; goto next; } while (0)
+  for (;;) {
+    switch (ip->op) {
+#endif
+
+// Integer arithmetic wraps like the LLVM code does
+#define ARITH_I(op) r[ip->dst].i = (int64_t) ((uint64_t) r[ip->a].i op (uint64_t) r[ip->b].i); NEXT()
+#define ARITH_D(op) r[ip->dst].d = r[ip->a].d op r[ip->b].d; NEXT()
+#define CMP_I(op) r[ip->dst].i = r[ip->a].i op r[ip->b].i; NEXT()
+// Unordered comparisons, true when either side is NaN (FCMP_U*)
+#define CMP_D(op) r[ip->dst].i = !(r[ip->a].d op r[ip->b].d); NEXT()
+
+  CASE(MOV):  r[ip->dst] = r[ip->a]; NEXT();
+  CASE(I2D):  r[ip->dst].d = (double) r[ip->a].i; NEXT();
+  CASE(ADDI): ARITH_I(+);
+  CASE(SUBI): ARITH_I(-);
+  CASE(MULI): ARITH_I(*);
+  CASE(DIVI):
+    if (r[ip->b].i == 0) {
+      fprintf(stderr, "ERR: Division by zero\n");
+      return -1;
+    }
+    r[ip->dst].i = r[ip->b].i == -1 ? (int64_t) (0 - (uint64_t) r[ip->a].i)
+                                    : r[ip->a].i / r[ip->b].i;
+    NEXT();
+  CASE(ADDD): ARITH_D(+);
+  CASE(SUBD): ARITH_D(-);
+  CASE(MULD): ARITH_D(*);
+  CASE(DIVD): ARITH_D(/);
+  CASE(EQI):  CMP_I(==);
+  CASE(NEI):  CMP_I(!=);
+  CASE(LTI):  CMP_I(<);
+  CASE(LEI):  CMP_I(<=);
+  CASE(GTI):  CMP_I(>);
+  CASE(GEI):  CMP_I(>=);
+  CASE(EQD):  r[ip->dst].i = !(r[ip->a].d < r[ip->b].d) && !(r[ip->a].d > r[ip->b].d); NEXT();
+  CASE(NED):  r[ip->dst].i = r[ip->a].d != r[ip->b].d; NEXT();
+  CASE(LTD):  CMP_D(>=);
+  CASE(LED):  CMP_D(>);
+  CASE(GTD):  CMP_D(<=);
+  CASE(GED):  CMP_D(<);
+  CASE(JMP):
+    ip = code + ip->dst;
+    DISPATCH();
+  CASE(JMPF):
+    if (r[ip->a].i) NEXT();
+    ip = code + ip->dst;
+    DISPATCH();
+  CASE(JMPT):
+    if (!r[ip->a].i) NEXT();
+    ip = code + ip->dst;
+    DISPATCH();
+  CASE(HALT):
+    return 0;
+
+#ifndef VM_THREADED
+    }
+next:;
+  }
+#endif
+#undef CASE
+#undef DISPATCH
+#undef NEXT
+#undef ARITH_I
+#undef ARITH_D
+#undef CMP_I
+#undef CMP_D
+}
+
+void VM::dumpVariables(std::ostream& out) const
+{
+  for (int i = 0; i < program.getVariableCount() && i < (int) registers.size(); i++) {
+    if (program.names[i].empty()) continue;
+    out << "  " << program.names[i].str() << " = ";
+    switch (program.types[i]) {
+      case Bytecode::DOUBLE: out << registers[i].d; break;
+      case Bytecode::BOOL:   out << (registers[i].i ? "true" : "false"); break;
+      default:               out << registers[i].i; break;
+    }
+    out << std::endl;
+  }
+}
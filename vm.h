@@ -0,0 +1,85 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __VM_H_
+#define __VM_H_
+#include "intern.h"
+#include <stdint.h>
+#include <ostream>
+#include <vector>
+
+// Register machine that runs programs lowered by the BytecodeVisitor.
+// The register file is laid out as [variables | temporaries | constants]:
+// a variable's register is its resolved slot, and constants are loaded
+// once before the first instruction, so operands never need decoding.
+class Bytecode {
+public:
+  enum Opcode {
+    MOV,                                        // dst = a
+    I2D,                                        // dst = (double) a
+    ADDI, SUBI, MULI, DIVI,                     // dst = a op b, int64
+    ADDD, SUBD, MULD, DIVD,                     // dst = a op b, double
+    EQI, NEI, LTI, LEI, GTI, GEI,               // dst = a cmp b, int64
+    EQD, NED, LTD, LED, GTD, GED,               // dst = a cmp b, unordered double
+    JMP,                                        // goto dst
+    JMPF,                                       // if !a goto dst
+    JMPT,                                       // if a goto dst
+    HALT,
+    OPCODE_COUNT
+  };
+  enum Type { INT, DOUBLE, BOOL };
+  union Value {
+    int64_t i;
+    double d;
+  };
+  class Instr {
+  public:
+    uint8_t op;
+    int32_t dst; // Jump target for JMP, JMPF and JMPT
+    int32_t a;
+    int32_t b;
+    Instr(uint8_t op, int32_t dst, int32_t a, int32_t b) : op(op), dst(dst), a(a), b(b) { }
+  };
+
+  std::vector<Instr> code;
+  std::vector<Value> constants;
+  std::vector<Type> constantTypes;
+  std::vector<Name> names;  // One per variable register
+  std::vector<Type> types;  // One per variable register
+  int temporaries = 0;
+
+  int getVariableCount() const { return (int) names.size(); };
+  int getRegisterCount() const { return (int) (names.size() + temporaries + constants.size()); };
+  void dump(std::ostream& out) const;
+};
+
+class VM {
+private:
+  const Bytecode& program;
+  std::vector<Bytecode::Value> registers;
+
+public:
+  VM(const Bytecode& program) : program(program) { }
+  // Returns 0, or -1 if the program trapped
+  int run();
+  // Prints every variable with its final value
+  void dumpVariables(std::ostream& out) const;
+};
+#endif // __VM_H_
@@ -0,0 +1,93 @@
+// Copyright (C) 2014, Daniel S. Fava
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell 
+// copies of the Software, and to permit persons to whom the Software is 
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in 
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER 
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING 
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+// IN THE SOFTWARE.
+//
+#ifndef __WORK_POOL_H_
+#define __WORK_POOL_H_
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own task deque.  A worker takes
+// tasks from the back of its own deque and, once that runs dry, steals from
+// the front of the others.  Tasks are all submitted before run(), which
+// returns when every deque is empty.
+class WorkStealingPool {
+private:
+  class Worker {
+  public:
+    std::mutex lock;
+    std::deque<std::function<void()> > tasks;
+  };
+  std::vector<Worker*> workers;
+  size_t next = 0;
+
+  bool take(size_t self, std::function<void()>& task) {
+    {
+      Worker* own = workers[self];
+      std::lock_guard<std::mutex> guard(own->lock);
+      if (!own->tasks.empty()) {
+        task = own->tasks.back();
+        own->tasks.pop_back();
+        return true;
+      }
+    }
+    for (size_t i = 1; i < workers.size(); i++) {
+      Worker* victim = workers[(self + i) % workers.size()];
+      std::lock_guard<std::mutex> guard(victim->lock);
+      if (!victim->tasks.empty()) {
+        task = victim->tasks.front();
+        victim->tasks.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+  void work(size_t self) {
+    std::function<void()> task;
+    while (take(self, task)) task();
+  }
+
+public:
+  WorkStealingPool(unsigned threads) {
+    if (threads == 0) threads = 1;
+    for (unsigned i = 0; i < threads; i++) workers.push_back(new Worker());
+  }
+  ~WorkStealingPool() {
+    for (size_t i = 0; i < workers.size(); i++) delete workers[i];
+  }
+  // Tasks are dealt round robin, stealing evens out the uneven ones
+  void submit(const std::function<void()>& task) {
+    Worker* worker = workers[next++ % workers.size()];
+    std::lock_guard<std::mutex> guard(worker->lock);
+    worker->tasks.push_back(task);
+  }
+  void run() {
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers.size(); i++) {
+      threads.push_back(std::thread(&WorkStealingPool::work, this, i));
+    }
+    work(0);
+    for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+  }
+  size_t size() { return workers.size(); }
+};
+#endif // __WORK_POOL_H_